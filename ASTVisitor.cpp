@@ -138,6 +138,20 @@ namespace halang {
         }
     }
 
+    void ASTVisitor::Visit(YieldStatementNode *node) {
+        Out() << "YieldStatement:" << std::endl;
+
+        if (node->expression) {
+            depth++;
+            Out() << "expression:" << std::endl;
+            depth++;
+            Visit(node->expression);
+            depth--;
+
+            depth--;
+        }
+    }
+
     void ASTVisitor::Visit(DefStatementNode *node) {
         Out() << "DefStatement:" << std::endl;
         depth++;
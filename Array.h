@@ -2,6 +2,7 @@
 
 #include "halang.h"
 #include "object.h"
+#include "GC.h"
 #include <vector>
 
 namespace halang {
@@ -19,22 +20,29 @@ namespace halang {
 
     protected:
 
-        Array() {
+        Array() : GCObject(TypeId::Array) {
 
         }
 
         Array(unsigned int i) :
-                std::vector<Value>(i) {
+                GCObject(TypeId::Array), std::vector<Value>(i) {
+            GC::AddExternal(this, GetExternalSize());
         }
 
-    public:
-
-        virtual Value toValue() override {
-            return Value(this, TypeId::Array);
+        // the heap size follows the capacity of the vector
+        inline void Regrown(std::size_t old_capacity) {
+            if (std::vector<Value>::capacity() != old_capacity)
+                GC::AddExternal(this, (std::vector<Value>::capacity() - old_capacity) * sizeof(Value));
         }
 
+    public:
+
         void Push(Value v) {
+            GC::Mutation m;
+            auto old_capacity = std::vector<Value>::capacity();
             std::vector<Value>::push_back(v);
+            Regrown(old_capacity);
+            GC::WriteBarrier(this, v);
         }
 
         Value Pop() {
@@ -54,19 +62,28 @@ namespace halang {
         inline void Set(unsigned int index, Value _v) {
             if (index >= GetLength())
                 throw std::runtime_error("<Array>index out of range");
+            GC::Mutation m;
+            GC::SnapshotBarrier(std::vector<Value>::operator[](index));
             std::vector<Value>::operator[](index) = _v;
+            GC::WriteBarrier(this, _v);
         }
 
         inline void Resize(unsigned int _size) {
+            GC::Mutation m;
+            for (auto i = GetLength(); i > _size; --i)
+                GC::SnapshotBarrier(std::vector<Value>::operator[](i - 1));
+            auto old_capacity = std::vector<Value>::capacity();
             std::vector<Value>::resize(_size);
+            Regrown(old_capacity);
         }
 
-        virtual void Mark() override {
-            marked = true;
+        virtual void Scan() override {
             for (auto i = begin(); i != end(); ++i)
-                if (i->isGCObject()) {
-                    i->value.gc->Mark();
-                }
+                GC::Shade(*i);
+        }
+
+        virtual std::size_t GetExternalSize() const override {
+            return std::vector<Value>::capacity() * sizeof(Value);
         }
 
         Value &operator[](unsigned int i) {
@@ -0,0 +1,567 @@
+#include "BigInt.h"
+#include "GC.h"
+#include "context.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace halang {
+
+    typedef BigInt::limb_type limb_type;
+    typedef BigInt::Magnitude Magnitude;
+
+    static const int LIMB_BITS = 32;
+
+    // the most of decimal digits a limb takes at once
+    static const limb_type DECIMAL_CHUNK = 1000000000u;
+    static const int DECIMAL_CHUNK_DIGITS = 9;
+
+    /// <summary>
+    /// A small int or a BigInt as a sign and a magnitude, which the
+    /// operations work on.
+    /// </summary>
+    struct Integer {
+        bool negative;
+        Magnitude magnitude;
+    };
+
+    static void Trim(Magnitude &m) {
+        while (!m.empty() && m.back() == 0)
+            m.pop_back();
+    }
+
+    static Magnitude FromUnsigned(std::uint64_t u) {
+        Magnitude m;
+        while (u != 0) {
+            m.push_back(static_cast<limb_type>(u));
+            u >>= LIMB_BITS;
+        }
+        return m;
+    }
+
+    static Integer FromSmall(TSmallInt i) {
+        // the magnitude of the smallest one only fits unsigned
+        std::uint64_t u = static_cast<std::uint64_t>(i);
+        return Integer{i < 0, FromUnsigned(i < 0 ? 0 - u : u)};
+    }
+
+    static int CompareMagnitude(const Magnitude &a, const Magnitude &b) {
+        if (a.size() != b.size())
+            return a.size() < b.size() ? -1 : 1;
+        for (std::size_t i = a.size(); i-- > 0;)
+            if (a[i] != b[i])
+                return a[i] < b[i] ? -1 : 1;
+        return 0;
+    }
+
+    static Magnitude AddMagnitude(const Magnitude &a, const Magnitude &b) {
+        const Magnitude &longer = a.size() >= b.size() ? a : b;
+        const Magnitude &shorter = a.size() >= b.size() ? b : a;
+        Magnitude r(longer.size() + 1);
+        std::uint64_t carry = 0;
+        for (std::size_t i = 0; i < longer.size(); ++i) {
+            std::uint64_t sum = carry + longer[i] + (i < shorter.size() ? shorter[i] : 0);
+            r[i] = static_cast<limb_type>(sum);
+            carry = sum >> LIMB_BITS;
+        }
+        r[longer.size()] = static_cast<limb_type>(carry);
+        Trim(r);
+        return r;
+    }
+
+    // a - b, with a not less than b
+    static Magnitude SubMagnitude(const Magnitude &a, const Magnitude &b) {
+        Magnitude r(a.size());
+        std::int64_t borrow = 0;
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            std::int64_t diff = static_cast<std::int64_t>(a[i]) - borrow -
+                                (i < b.size() ? static_cast<std::int64_t>(b[i]) : 0);
+            borrow = diff < 0 ? 1 : 0;
+            r[i] = static_cast<limb_type>(diff + (borrow << LIMB_BITS));
+        }
+        Trim(r);
+        return r;
+    }
+
+    // r += x << (shift limbs), r long enough
+    static void AddShifted(Magnitude &r, const Magnitude &x, std::size_t shift) {
+        std::uint64_t carry = 0;
+        std::size_t i = 0;
+        for (; i < x.size(); ++i) {
+            std::uint64_t sum = carry + r[i + shift] + x[i];
+            r[i + shift] = static_cast<limb_type>(sum);
+            carry = sum >> LIMB_BITS;
+        }
+        for (; carry != 0; ++i) {
+            std::uint64_t sum = carry + r[i + shift];
+            r[i + shift] = static_cast<limb_type>(sum);
+            carry = sum >> LIMB_BITS;
+        }
+    }
+
+    static Magnitude MulSchoolbook(const Magnitude &a, const Magnitude &b) {
+        if (a.empty() || b.empty())
+            return Magnitude();
+        Magnitude r(a.size() + b.size());
+        for (std::size_t i = 0; i < a.size(); ++i) {
+            std::uint64_t carry = 0;
+            for (std::size_t j = 0; j < b.size(); ++j) {
+                std::uint64_t p = static_cast<std::uint64_t>(a[i]) * b[j] + r[i + j] + carry;
+                r[i + j] = static_cast<limb_type>(p);
+                carry = p >> LIMB_BITS;
+            }
+            r[i + b.size()] = static_cast<limb_type>(carry);
+        }
+        Trim(r);
+        return r;
+    }
+
+    static Magnitude Slice(const Magnitude &m, std::size_t begin, std::size_t end) {
+        begin = std::min(begin, m.size());
+        end = std::min(end, m.size());
+        Magnitude r(m.begin() + begin, m.begin() + end);
+        Trim(r);
+        return r;
+    }
+
+    /// <summary>
+    /// With a = a1 B + a0 and b = b1 B + b0, a b is
+    /// z2 B^2 + z1 B + z0 where z1 = (a1 + a0)(b1 + b0) - z2 - z0,
+    /// three products of half the length instead of four.
+    /// </summary>
+    static Magnitude MulKaratsuba(const Magnitude &a, const Magnitude &b) {
+        if (std::min(a.size(), b.size()) < BigInt::KARATSUBA_THRESHOLD)
+            return MulSchoolbook(a, b);
+
+        std::size_t half = std::max(a.size(), b.size()) / 2;
+        Magnitude a0 = Slice(a, 0, half), a1 = Slice(a, half, a.size());
+        Magnitude b0 = Slice(b, 0, half), b1 = Slice(b, half, b.size());
+
+        Magnitude z0 = MulKaratsuba(a0, b0);
+        Magnitude z2 = MulKaratsuba(a1, b1);
+        Magnitude z1 = MulKaratsuba(AddMagnitude(a0, a1), AddMagnitude(b0, b1));
+        z1 = SubMagnitude(SubMagnitude(z1, z2), z0);
+
+        Magnitude r(a.size() + b.size() + 1);
+        AddShifted(r, z0, 0);
+        AddShifted(r, z1, half);
+        AddShifted(r, z2, 2 * half);
+        Trim(r);
+        return r;
+    }
+
+    // a / d, the remainder in "rem"
+    static Magnitude DivSmall(const Magnitude &a, limb_type d, limb_type &rem) {
+        Magnitude q(a.size());
+        std::uint64_t r = 0;
+        for (std::size_t i = a.size(); i-- > 0;) {
+            std::uint64_t cur = (r << LIMB_BITS) | a[i];
+            q[i] = static_cast<limb_type>(cur / d);
+            r = cur % d;
+        }
+        Trim(q);
+        rem = static_cast<limb_type>(r);
+        return q;
+    }
+
+    // m = m * f + add
+    static void MulAddSmall(Magnitude &m, limb_type f, limb_type add) {
+        std::uint64_t carry = add;
+        for (std::size_t i = 0; i < m.size(); ++i) {
+            std::uint64_t p = static_cast<std::uint64_t>(m[i]) * f + carry;
+            m[i] = static_cast<limb_type>(p);
+            carry = p >> LIMB_BITS;
+        }
+        if (carry != 0)
+            m.push_back(static_cast<limb_type>(carry));
+    }
+
+    static int LeadingZeros(limb_type x) {
+        int n = 0;
+        while ((x & 0x80000000u) == 0) {
+            x <<= 1;
+            ++n;
+        }
+        return n;
+    }
+
+    /// <summary>
+    /// Long division of Knuth's algorithm D, a divisor of one limb
+    /// goes to DivSmall.
+    /// </summary>
+    static void DivMagnitude(const Magnitude &a, const Magnitude &b, Magnitude &q, Magnitude &r) {
+        if (CompareMagnitude(a, b) < 0) {
+            q.clear();
+            r = a;
+            return;
+        }
+        if (b.size() == 1) {
+            limb_type rem;
+            q = DivSmall(a, b[0], rem);
+            r = FromUnsigned(rem);
+            return;
+        }
+
+        std::size_t n = b.size(), m = a.size() - n;
+        int s = LeadingZeros(b.back());
+
+        // both shifted so that the top limb of the divisor has its
+        // top bit set, which keeps qhat at most 2 off
+        Magnitude vn(n), un(a.size() + 1);
+        for (std::size_t i = n - 1; i > 0; --i)
+            vn[i] = (b[i] << s) | (s == 0 ? 0 : static_cast<limb_type>(
+                    static_cast<std::uint64_t>(b[i - 1]) >> (LIMB_BITS - s)));
+        vn[0] = b[0] << s;
+        un[a.size()] = s == 0 ? 0 : static_cast<limb_type>(
+                static_cast<std::uint64_t>(a.back()) >> (LIMB_BITS - s));
+        for (std::size_t i = a.size() - 1; i > 0; --i)
+            un[i] = (a[i] << s) | (s == 0 ? 0 : static_cast<limb_type>(
+                    static_cast<std::uint64_t>(a[i - 1]) >> (LIMB_BITS - s)));
+        un[0] = a[0] << s;
+
+        const std::uint64_t base = static_cast<std::uint64_t>(1) << LIMB_BITS;
+        q.assign(m + 1, 0);
+        for (std::size_t j = m + 1; j-- > 0;) {
+            std::uint64_t num = (static_cast<std::uint64_t>(un[j + n]) << LIMB_BITS) | un[j + n - 1];
+            std::uint64_t qhat = num / vn[n - 1];
+            std::uint64_t rhat = num % vn[n - 1];
+            while (qhat >= base ||
+                   qhat * vn[n - 2] > ((rhat << LIMB_BITS) | un[j + n - 2])) {
+                --qhat;
+                rhat += vn[n - 1];
+                if (rhat >= base)
+                    break;
+            }
+
+            // un[j .. j + n] -= qhat * vn
+            std::int64_t k = 0, t;
+            for (std::size_t i = 0; i < n; ++i) {
+                std::uint64_t p = qhat * vn[i];
+                t = static_cast<std::int64_t>(un[i + j]) - k - static_cast<std::int64_t>(p & 0xffffffffu);
+                un[i + j] = static_cast<limb_type>(t);
+                k = static_cast<std::int64_t>(p >> LIMB_BITS) - (t >> LIMB_BITS);
+            }
+            t = static_cast<std::int64_t>(un[j + n]) - k;
+            un[j + n] = static_cast<limb_type>(t);
+
+            // it went below zero, so qhat was one too many
+            q[j] = static_cast<limb_type>(qhat);
+            if (t < 0) {
+                --q[j];
+                std::uint64_t carry = 0;
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::uint64_t sum = static_cast<std::uint64_t>(un[i + j]) + vn[i] + carry;
+                    un[i + j] = static_cast<limb_type>(sum);
+                    carry = sum >> LIMB_BITS;
+                }
+                un[j + n] = static_cast<limb_type>(un[j + n] + carry);
+            }
+        }
+        Trim(q);
+
+        r.assign(n, 0);
+        for (std::size_t i = 0; i < n; ++i)
+            r[i] = (un[i] >> s) | (s == 0 ? 0 : static_cast<limb_type>(
+                    static_cast<std::uint64_t>(un[i + 1]) << (LIMB_BITS - s)));
+        Trim(r);
+    }
+
+    static Integer ToInteger(const Value &v) {
+        if (v.isSmallInt())
+            return FromSmall(v.AsSmallInt());
+        if (v.isBigInt()) {
+            auto big = reinterpret_cast<const BigInt *>(v.AsGC());
+            return Integer{big->IsNegative(), big->GetMagnitude()};
+        }
+        throw std::runtime_error("<BigInt>operand is not an integer");
+    }
+
+    static Value FromInteger(Integer &&i) {
+        return BigInt::Normalize(i.negative, std::move(i.magnitude));
+    }
+
+    // "d" finite and integral, each step exact in doubles
+    static Magnitude FromIntegral(TNumber d) {
+        Magnitude m;
+        for (d = std::fabs(d); d >= 1; ) {
+            TNumber q = std::floor(d / 4294967296.0);
+            m.push_back(static_cast<limb_type>(d - q * 4294967296.0));
+            d = q;
+        }
+        return m;
+    }
+
+    // a zero is never negative
+    static int CompareInteger(const Integer &left, const Integer &right) {
+        int order;
+        if (left.magnitude.empty() && right.magnitude.empty())
+            order = 0;
+        else if (left.negative != right.negative)
+            order = left.negative ? -1 : 1;
+        else {
+            order = CompareMagnitude(left.magnitude, right.magnitude);
+            if (left.negative)
+                order = -order;
+        }
+        return order;
+    }
+
+    /// <summary>
+    /// The order of the integer "i" against the number "d", without
+    /// rounding either, false if "d" is NaN.
+    /// </summary>
+    static bool CompareToNumber(const Integer &i, TNumber d, int &order) {
+        if (d != d)
+            return false;
+        if (std::isinf(d)) {
+            order = d > 0 ? -1 : 1;
+            return true;
+        }
+
+        TNumber t = std::trunc(d);
+        order = CompareInteger(i, Integer{t < 0, FromIntegral(t)});
+
+        // what the truncation took away decides a tie
+        if (order == 0)
+            order = d > t ? -1 : d < t ? 1 : 0;
+        return true;
+    }
+
+    static bool EitherNumber(const Value &a, const Value &b) {
+        return a.isNumber() || b.isNumber();
+    }
+
+    static Integer AddInteger(const Integer &a, const Integer &b) {
+        if (a.negative == b.negative)
+            return Integer{a.negative, AddMagnitude(a.magnitude, b.magnitude)};
+        if (CompareMagnitude(a.magnitude, b.magnitude) >= 0)
+            return Integer{a.negative, SubMagnitude(a.magnitude, b.magnitude)};
+        return Integer{b.negative, SubMagnitude(b.magnitude, a.magnitude)};
+    }
+
+    BigInt::BigInt(bool _negative, Magnitude &&_magnitude) :
+            GCObject(TypeId::BigInt), negative(_negative), magnitude(std::move(_magnitude)) {
+        GC::AddExternal(this, GetExternalSize());
+    }
+
+    Value BigInt::Create(TSmallInt i) {
+        Integer integer = FromSmall(i);
+        return Context::GetGC()->New<BigInt>(integer.negative, std::move(integer.magnitude))->toValue();
+    }
+
+    Value BigInt::Normalize(bool negative, Magnitude &&magnitude) {
+        Trim(magnitude);
+        if (magnitude.size() <= 2) {
+            std::uint64_t u = magnitude.empty() ? 0 : magnitude[0];
+            if (magnitude.size() == 2)
+                u |= static_cast<std::uint64_t>(magnitude[1]) << LIMB_BITS;
+
+            // the magnitude of the smallest small int is one more
+            // than that of the largest
+            const std::uint64_t limit = static_cast<std::uint64_t>(INT64_MAX) + (negative ? 1 : 0);
+            if (u <= limit) {
+                TSmallInt i = negative ? static_cast<TSmallInt>(0 - u) : static_cast<TSmallInt>(u);
+                if (Value::FitsSmallInt(i))
+                    return Value(i);
+            }
+        }
+        if (magnitude.empty())
+            negative = false;
+        return Context::GetGC()->New<BigInt>(negative, std::move(magnitude))->toValue();
+    }
+
+    bool BigInt::Parse(const std::string &text, Value &result) {
+        std::size_t i = 0;
+        bool negative = false;
+        if (i < text.size() && (text[i] == '-' || text[i] == '+'))
+            negative = text[i++] == '-';
+
+        bool hex = text.size() - i > 2 && text[i] == '0' && (text[i + 1] == 'x' || text[i + 1] == 'X');
+        if (hex)
+            i += 2;
+        if (i == text.size())
+            return false;
+
+        Magnitude m;
+        if (hex) {
+            // eight digits make one limb, from the last one
+            for (std::size_t end = text.size(); end > i;) {
+                std::size_t begin = end >= i + 8 ? end - 8 : i;
+                limb_type limb = 0;
+                for (std::size_t j = begin; j < end; ++j) {
+                    char c = text[j];
+                    int digit;
+                    if (c >= '0' && c <= '9')
+                        digit = c - '0';
+                    else if (c >= 'a' && c <= 'f')
+                        digit = c - 'a' + 10;
+                    else if (c >= 'A' && c <= 'F')
+                        digit = c - 'A' + 10;
+                    else
+                        return false;
+                    limb = (limb << 4) | static_cast<limb_type>(digit);
+                }
+                m.push_back(limb);
+                end = begin;
+            }
+        } else {
+            while (i < text.size()) {
+                limb_type chunk = 0, scale = 1;
+                for (int d = 0; d < DECIMAL_CHUNK_DIGITS && i < text.size(); ++d, ++i) {
+                    if (text[i] < '0' || text[i] > '9')
+                        return false;
+                    chunk = chunk * 10 + static_cast<limb_type>(text[i] - '0');
+                    scale *= 10;
+                }
+                MulAddSmall(m, scale, chunk);
+            }
+        }
+
+        result = Normalize(negative, std::move(m));
+        return true;
+    }
+
+    Value BigInt::Add(Value a, Value b) {
+        if (EitherNumber(a, b))
+            return Value(ToNumber(a) + ToNumber(b));
+        return FromInteger(AddInteger(ToInteger(a), ToInteger(b)));
+    }
+
+    Value BigInt::Sub(Value a, Value b) {
+        if (EitherNumber(a, b))
+            return Value(ToNumber(a) - ToNumber(b));
+        Integer right = ToInteger(b);
+        right.negative = !right.negative;
+        return FromInteger(AddInteger(ToInteger(a), right));
+    }
+
+    Value BigInt::Mul(Value a, Value b) {
+        if (EitherNumber(a, b))
+            return Value(ToNumber(a) * ToNumber(b));
+        Integer left = ToInteger(a), right = ToInteger(b);
+        return Normalize(left.negative != right.negative,
+                         MulKaratsuba(left.magnitude, right.magnitude));
+    }
+
+    Value BigInt::Div(Value a, Value b) {
+        if (EitherNumber(a, b))
+            return Value(ToNumber(a) / ToNumber(b));
+        Integer left = ToInteger(a), right = ToInteger(b);
+        if (right.magnitude.empty())
+            throw std::runtime_error("<BigInt>division by zero");
+        Magnitude q, r;
+        DivMagnitude(left.magnitude, right.magnitude, q, r);
+        return Normalize(left.negative != right.negative, std::move(q));
+    }
+
+    Value BigInt::Mod(Value a, Value b) {
+        if (EitherNumber(a, b))
+            throw std::runtime_error("<BigInt>operand is not an integer");
+        Integer left = ToInteger(a), right = ToInteger(b);
+        if (right.magnitude.empty())
+            throw std::runtime_error("<BigInt>division by zero");
+        Magnitude q, r;
+        DivMagnitude(left.magnitude, right.magnitude, q, r);
+        return Normalize(left.negative, std::move(r));
+    }
+
+    Value BigInt::Neg(Value a) {
+        if (a.isNumber())
+            return Value(-a.AsNumber());
+        Integer i = ToInteger(a);
+        i.negative = !i.negative;
+        return FromInteger(std::move(i));
+    }
+
+    bool BigInt::Compare(Value a, Value b, int &order) {
+        if (EitherNumber(a, b)) {
+            if (!IsInteger(a) && !a.isNumber())
+                return false;
+            if (!IsInteger(b) && !b.isNumber())
+                return false;
+
+            // an integer is not cast, which would round it
+            if (IsInteger(a)) {
+                if (!CompareToNumber(ToInteger(a), b.AsNumber(), order))
+                    return false;
+            } else if (IsInteger(b)) {
+                if (!CompareToNumber(ToInteger(b), a.AsNumber(), order))
+                    return false;
+                order = -order;
+            } else {
+                TNumber x = a.AsNumber(), y = b.AsNumber();
+                if (x != x || y != y)
+                    return false;
+                order = x < y ? -1 : x > y ? 1 : 0;
+            }
+            return true;
+        }
+        if (!IsInteger(a) || !IsInteger(b))
+            return false;
+
+        order = CompareInteger(ToInteger(a), ToInteger(b));
+        return true;
+    }
+
+    TNumber BigInt::ToNumber(Value v) {
+        if (v.isNumber())
+            return v.AsNumber();
+        if (v.isSmallInt())
+            return static_cast<TNumber>(v.AsSmallInt());
+        Integer i = ToInteger(v);
+        TNumber n = 0;
+        for (std::size_t k = i.magnitude.size(); k-- > 0;)
+            n = n * 4294967296.0 + i.magnitude[k];
+        return i.negative ? -n : n;
+    }
+
+    std::string BigInt::Format(Value v, int radix) {
+        Integer i = ToInteger(v);
+        std::string digits;
+
+        if (radix == 16) {
+            static const char *HEX = "0123456789abcdef";
+            for (std::size_t k = 0; k < i.magnitude.size(); ++k)
+                for (int d = 0; d < 8; ++d)
+                    digits.push_back(HEX[(i.magnitude[k] >> (4 * d)) & 0xf]);
+        } else {
+            // nine digits at a time by the fast division
+            Magnitude m = i.magnitude;
+            while (!m.empty()) {
+                limb_type rem;
+                m = DivSmall(m, DECIMAL_CHUNK, rem);
+                for (int d = 0; d < DECIMAL_CHUNK_DIGITS; ++d) {
+                    digits.push_back(static_cast<char>('0' + rem % 10));
+                    rem /= 10;
+                }
+            }
+        }
+
+        while (digits.size() > 1 && digits.back() == '0')
+            digits.pop_back();
+        if (digits.empty())
+            digits.push_back('0');
+        if (radix == 16)
+            digits += "x0";
+        if (i.negative && !i.magnitude.empty())
+            digits.push_back('-');
+        std::reverse(digits.begin(), digits.end());
+        return digits;
+    }
+
+    unsigned int BigInt::GetHash() const {
+        unsigned int hash = negative ? 1 : 0;
+        for (auto i = magnitude.begin(); i != magnitude.end(); ++i)
+            hash = hash * 31 + *i;
+        return hash;
+    }
+
+    bool BigInt::Equals(const BigInt *that) const {
+        return negative == that->negative && magnitude == that->magnitude;
+    }
+
+    Dict *BigInt::GetPrototype() {
+        return Context::GetBigIntPrototype();
+    }
+
+}
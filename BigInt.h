@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "object.h"
+#include "halang.h"
+
+namespace halang {
+
+    /// <summary>
+    /// An integer of any size, for what does not fit a small int.
+    ///
+    /// The magnitude is a vector of 32-bit limbs, the least
+    /// significant first and without zero limbs on the top, and the
+    /// sign is kept apart. A BigInt is never made for a value a
+    /// small int can hold: every operation gives a small int back
+    /// when its result fits, so the operators stay on their inline
+    /// paths as long as the values are small, and a small int and
+    /// a BigInt are never equal.
+    ///
+    /// The operations take small ints, BigInts and numbers; with a
+    /// number the other one is made a number as well.
+    /// </summary>
+    class BigInt : public GCObject {
+    public:
+
+        friend class GC;
+
+        typedef std::uint32_t limb_type;
+        typedef std::vector<limb_type> Magnitude;
+
+        // shorter operands are multiplied the schoolbook way
+        static const std::size_t KARATSUBA_THRESHOLD = 32;
+
+    protected:
+
+        BigInt(bool _negative, Magnitude &&_magnitude);
+
+    private:
+
+        bool negative;
+        Magnitude magnitude;
+
+        static Value Create(TSmallInt);
+
+    public:
+
+        /// <summary>
+        /// The small int "i", or a BigInt where Value cannot hold it.
+        /// </summary>
+        static inline Value FromSmallInt(TSmallInt i) {
+            if (Value::FitsSmallInt(i))
+                return Value(i);
+            return Create(i);
+        }
+
+        /// <summary>
+        /// The value of "magnitude" with the sign, a small int if it fits.
+        /// </summary>
+        static Value Normalize(bool negative, Magnitude &&magnitude);
+
+        /// <summary>
+        /// Parse an optional sign and decimal digits, or hex digits
+        /// after "0x", false if there is anything else.
+        /// </summary>
+        static bool Parse(const std::string &, Value &result);
+
+        static inline bool IsInteger(const Value &v) {
+            return v.isSmallInt() || v.isBigInt();
+        }
+
+        static Value Add(Value, Value);
+
+        static Value Sub(Value, Value);
+
+        static Value Mul(Value, Value);
+
+        // truncated, as the small int operators are
+        static Value Div(Value, Value);
+
+        static Value Mod(Value, Value);
+
+        static Value Neg(Value);
+
+        /// <summary>
+        /// Less than 0, 0 or more than 0 in "order" as a is less than,
+        /// equal to or more than b, false if they are unordered: a
+        /// NaN or not a number at all.
+        /// </summary>
+        static bool Compare(Value a, Value b, int &order);
+
+        static TNumber ToNumber(Value);
+
+        /// <summary>
+        /// The digits of a small int or a BigInt in radix 10 or 16,
+        /// hex with "0x" after the sign.
+        /// </summary>
+        static std::string Format(Value, int radix);
+
+        inline bool IsNegative() const { return negative; }
+
+        inline const Magnitude &GetMagnitude() const { return magnitude; }
+
+        unsigned int GetHash() const;
+
+        bool Equals(const BigInt *) const;
+
+        virtual Dict *GetPrototype() override;
+
+        virtual std::size_t GetExternalSize() const override {
+            return magnitude.capacity() * sizeof(limb_type);
+        }
+
+    };
+
+}
@@ -1,18 +1,80 @@
 #include "Dict.h"
 #include "String.h"
+#include "GC.h"
+#include "context.h"
 
 namespace halang {
 
-    Dict::Dict() {
-        entries = new Entry *[DEFAULT_ENTRY_SIZE]();
-        _size = DEFAULT_ENTRY_SIZE;
+    Dict::version_type Dict::last_version = 0;
+
+    Dict::Dict() :
+            GCObject(TypeId::Dict), shape(Shape::Empty()), slots(nullptr), slots_capacity(0),
+            entries(nullptr), _size(0), entry_count(0) {
+        Touch();
+    }
+
+    bool Dict::FindSlot(Value key, size_type &index) const {
+        if (!key.isString())
+            return false;
+        return shape->TryGetIndex(reinterpret_cast<String *>(key.AsGC()), index);
     }
 
-    Value Dict::toValue() {
-        return Value(this, TypeId::Dict);
+    void Dict::AddSlot(Shape *next, Value value) {
+        auto count = shape->GetCount();
+        if (count == slots_capacity) {
+            auto new_capacity = slots_capacity == 0 ? 4 : slots_capacity * 2;
+            auto new_slots = new Value[new_capacity];
+            for (size_type i = 0; i < count; ++i)
+                new_slots[i] = slots[i];
+            delete[] slots;
+            slots = new_slots;
+            GC::AddExternal(this, (new_capacity - slots_capacity) * sizeof(Value));
+            slots_capacity = new_capacity;
+        }
+        slots[count] = value;
+        shape = next;
+        GC::WriteBarrier(this, value);
+    }
+
+    /// <summary>
+    /// Move the slots into the hash table. The names only live
+    /// in the shape, so the keys are made into strings again,
+    /// persistent ones for a persistent dict like the prototypes.
+    /// </summary>
+    void Dict::ToDictionaryMode() {
+        _size = DEFAULT_ENTRY_SIZE;
+        entries = new Entry *[_size]();
+        GC::AddExternal(this, _size * sizeof(Entry *));
+
+        for (size_type i = 0; i < shape->GetCount(); ++i) {
+            String *name = persistent ?
+                           Context::GetGC()->NewPersistent<SimpleString>(shape->GetName(i)) :
+                           String::FromU16String(shape->GetName(i));
+            Value key = name->toValue();
+            auto _hash = std::hash<Value>{}(key);
+            auto index = _hash % _size;
+            entries[index] = new Entry(_hash, key, slots[i], entries[index]);
+            ++entry_count;
+            GC::WriteBarrier(this, key);
+        }
+        GC::AddExternal(this, entry_count * sizeof(Entry));
+
+        delete[] slots;
+        GC::RemoveExternal(this, slots_capacity * sizeof(Value));
+        slots = nullptr;
+        slots_capacity = 0;
+        shape = nullptr;
     }
 
     bool Dict::TryGetValue(Value key, Value &value) {
+        if (shape != nullptr) {
+            size_type slot;
+            if (!FindSlot(key, slot))
+                return false;
+            value = slots[slot];
+            return true;
+        }
+
         auto _hh = std::hash<Value>{}(key);
         auto index = _hh % _size;
         if (entries[index] != nullptr) {
@@ -29,13 +91,29 @@ namespace halang {
     }
 
     bool Dict::TryEmplace(Value key, Value value) {
+        if (shape != nullptr) {
+            size_type slot;
+            if (!FindSlot(key, slot))
+                return false;
+            GC::Mutation m;
+            GC::SnapshotBarrier(slots[slot]);
+            slots[slot] = value;
+            GC::WriteBarrier(this, value);
+            Touch();
+            return true;
+        }
+
         auto _hh = std::hash<Value>{}(key);
         auto index = _hh % _size;
         if (entries[index] != nullptr) {
             Entry *en = entries[index];
             while (en != nullptr) {
                 if (en->hash == _hh) {
+                    GC::Mutation m;
+                    GC::SnapshotBarrier(en->value);
                     en->value = value;
+                    GC::WriteBarrier(this, value);
+                    Touch();
                     return true;
                 }
                 en = en->next;
@@ -45,14 +123,27 @@ namespace halang {
     }
 
     bool Dict::TryRemove(Value key) {
+        GC::Mutation m;
+        if (shape != nullptr) {
+            size_type slot;
+            if (!FindSlot(key, slot))
+                return false;
+            ToDictionaryMode();
+        }
+
         auto _hash = std::hash<Value>{}(key);
         auto index = _hash % _size;
         Entry **enptr = &entries[index];
         while (*enptr != nullptr) {
             if ((*enptr)->hash == _hash) {
                 auto ptr = *enptr;
-                (*enptr)->next = ptr->next;
+                GC::SnapshotBarrier(ptr->key);
+                GC::SnapshotBarrier(ptr->value);
+                *enptr = ptr->next;
                 delete ptr;
+                --entry_count;
+                GC::RemoveExternal(this, sizeof(Entry));
+                Touch();
                 return true;
             }
             enptr = &((*enptr)->next);
@@ -61,10 +152,28 @@ namespace halang {
     }
 
     void Dict::Insert(Value key, Value value) {
+        GC::Mutation m;
+        if (shape != nullptr) {
+            if (key.isString()) {
+                auto next = shape->AddProperty(reinterpret_cast<String *>(key.AsGC()));
+                if (next != nullptr) {
+                    AddSlot(next, value);
+                    Touch();
+                    return;
+                }
+            }
+            ToDictionaryMode();
+        }
+
         auto _hash = std::hash<Value>{}(key);
         auto index = _hash % _size;
         auto new_entry = new Entry(_hash, key, value, entries[index]);
         entries[index] = new_entry;
+        ++entry_count;
+        GC::AddExternal(this, sizeof(Entry));
+        GC::WriteBarrier(this, key);
+        GC::WriteBarrier(this, value);
+        Touch();
     }
 
     void Dict::SetValue(Value key, Value value) {
@@ -80,6 +189,11 @@ namespace halang {
     }
 
     bool Dict::Exist(Value key) {
+        if (shape != nullptr) {
+            size_type slot;
+            return FindSlot(key, slot);
+        }
+
         auto _hash = std::hash<Value>{}(key);
         auto index = _hash % _size;
         auto en = entries[index];
@@ -93,7 +207,13 @@ namespace halang {
         return false;
     }
 
+    std::size_t Dict::GetExternalSize() const {
+        return slots_capacity * sizeof(Value) + _size * sizeof(Entry *) + entry_count * sizeof(Entry);
+    }
+
     Dict::~Dict() {
+        delete[] slots;
+
         for (size_type i = 0; i < _size; ++i) {
             if (entries[i] != nullptr) {
                 auto ptr = entries[i];
@@ -108,19 +228,20 @@ namespace halang {
         delete[] entries;
     }
 
-    void Dict::Mark() {
-        if (!marked) {
-            marked = true;
-            Entry *enptr;
-            for (size_type i = 0; i < _size; ++i) {
-                enptr = entries[i];
-                while (enptr != nullptr) {
-                    if (enptr->key.isGCObject())
-                        enptr->key.value.gc->Mark();
-                    if (enptr->value.isGCObject())
-                        enptr->value.value.gc->Mark();
-                    enptr = enptr->next;
-                }
+    void Dict::Scan() {
+        if (shape != nullptr) {
+            for (size_type i = 0; i < shape->GetCount(); ++i)
+                GC::Shade(slots[i]);
+            return;
+        }
+
+        Entry *enptr;
+        for (size_type i = 0; i < _size; ++i) {
+            enptr = entries[i];
+            while (enptr != nullptr) {
+                GC::Shade(enptr->key);
+                GC::Shade(enptr->value);
+                enptr = enptr->next;
             }
         }
     }
@@ -3,10 +3,17 @@
 #include "halang.h"
 #include "object.h"
 #include "string.h"
+#include "Shape.h"
 #include <utility>
 #include <unordered_map>
 
 namespace halang {
+    /// <summary>
+    /// Dict starts with a shape and keeps its values in a compact
+    /// array of slots indexed by it. It goes to dictionary mode,
+    /// the chained hash table, for good once it gets a key that is
+    /// not a string, a removal, or too many properties.
+    /// </summary>
     class Dict :
             public GCObject {
     public:
@@ -15,8 +22,12 @@ namespace halang {
 
         friend class StackVM;
 
+        friend class JitCompiler;
+
         typedef unsigned int size_type;
 
+        typedef unsigned long long version_type;
+
         static const size_type DEFAULT_ENTRY_SIZE = 64;
 
     protected:
@@ -26,12 +37,53 @@ namespace halang {
 
         struct Entry;
 
+        // shape mode, shape is nullptr in dictionary mode
+        Shape *shape;
+        Value *slots;
+        size_type slots_capacity;
+
+        // dictionary mode
         Entry **entries;
         size_type _size;
+        size_type entry_count;
+
+        // renewed on every change of the keys or values, the versions
+        // are never reused, even by a dict at the same address.
+        version_type version;
+
+        static version_type last_version;
+
+        inline void Touch() {
+            version = ++last_version;
+        }
+
+        bool FindSlot(Value key, size_type &index) const;
+
+        void AddSlot(Shape *next, Value value);
+
+        void ToDictionaryMode();
 
     public:
 
-        Value toValue() override;
+        inline version_type GetVersion() const {
+            return version;
+        }
+
+        inline Shape *GetShape() const {
+            return shape;
+        }
+
+        inline Value GetSlot(size_type index) const {
+            return slots[index];
+        }
+
+        /// <summary>
+        /// The slot of "key" in shape mode,
+        /// always false in dictionary mode.
+        /// </summary>
+        inline bool TryGetSlot(Value key, size_type &index) const {
+            return shape != nullptr && FindSlot(key, index);
+        }
 
         bool TryGetValue(Value key, Value &value);
 
@@ -47,7 +99,9 @@ namespace halang {
 
         void SetValue(Value key, Value value);
 
-        virtual void Mark() override;
+        virtual void Scan() override;
+
+        virtual std::size_t GetExternalSize() const override;
 
         virtual ~Dict() override;
 
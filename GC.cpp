@@ -1,66 +1,563 @@
 #include "GC.h"
+#include "WorkDeque.h"
 #include "svm.h"
 #include "context.h"
 #include "Dict.h"
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 namespace halang {
 
+    bool GC::marking = false;
+    bool GC::snapshot = false;
+
+    bool GC::marker_active = false;
+    bool GC::locked = false;
+    std::mutex GC::heap_lock;
+
+    bool GC::concurrent_marking = false;
+
+    // set in the marking thread, which holds heap_lock all the
+    // time it shades
+    static thread_local bool in_marker = false;
+
+    // the deque of a thread of a parallel mark
+    static thread_local WorkDeque *local_deque = nullptr;
+
+    unsigned int GC::thread_count = 1;
+
+    double GC::growth_factor = 2.0;
+    std::size_t GC::min_heap_size = 1 << 20;
+    std::size_t GC::nursery_size = 1 << 18;
+    double GC::pause_budget = 0;
+
+    // how many objects a slice traces between two looks at the
+    // clock, it clears a page at a time
+    static const unsigned int TRACE_CHECK = 64;
+
+    // how many objects the marking thread scans before it lets
+    // the scripts have heap_lock
+    static const unsigned int MARK_BATCH = 256;
+
+    double GC::GetGrowthFactor() { return growth_factor; }
+
+    void GC::SetGrowthFactor(double factor) {
+        if (!(factor > 1.0))
+            throw std::runtime_error("<GC>growth factor must be more than 1");
+        growth_factor = factor;
+    }
+
+    std::size_t GC::GetMinHeapSize() { return min_heap_size; }
+
+    void GC::SetMinHeapSize(std::size_t size) { min_heap_size = size; }
+
+    std::size_t GC::GetNurserySize() { return nursery_size; }
+
+    void GC::SetNurserySize(std::size_t size) { nursery_size = size; }
+
+    double GC::GetPauseBudget() { return pause_budget; }
+
+    void GC::SetPauseBudget(double ms) {
+        if (!(ms >= 0))
+            throw std::runtime_error("<GC>pause budget must not be negative");
+        pause_budget = ms;
+    }
+
+    bool GC::GetConcurrentMarking() { return concurrent_marking; }
+
+    void GC::SetConcurrentMarking(bool on) { concurrent_marking = on; }
+
+    unsigned int GC::GetThreadCount() { return thread_count; }
+
+    void GC::SetThreadCount(unsigned int count) {
+        if (count == 0)
+            throw std::runtime_error("<GC>thread count must be at least 1");
+        thread_count = count;
+    }
+
     GC::GC() :
-            objects(nullptr), counter(0) {
+            heap_size(0), next_heap_size(min_heap_size),
+            next_gc(std::min(nursery_size, min_heap_size)),
+            phase(Phase::Idle), cursor(0),
+            pause_count(0), max_pause(0), cycle_count(0), cleared(false), shutdown(false),
+            job(nullptr), job_serial(0), job_threads(0), job_pending(0) {
         Context::gc = this;
     }
 
-    GCObject *GC::Erase(GCObject *obj) {
-        GCObject *_next = obj->next;
-        delete obj;
-        return _next;
+    void GC::Destroy(GCObject *obj) {
+        heap_size -= Page::Of(obj)->cell_size;
+        if (obj->external)
+            heap_size -= obj->GetExternalSize();
+        obj->~GCObject();
+        heap.Free(obj);
     }
 
-    void GC::ClearAllMarks() {
-        // std::cout << "full gc" << std::endl;
-        auto ptr = objects;
-        while (ptr != nullptr) {
-            ptr->marked = false;
-            ptr = ptr->next;
+    void GC::MakePersistent(GCObject *obj) {
+        // the marking thread shades them after clearing the marks
+        Mutation m;
+        obj->persistent = true;
+        persistents.push_back(obj);
+        Page::Mark(obj);
+
+        // a full cycle under way traces it as well
+        if (phase != Phase::Idle)
+            PushGray(obj);
+    }
+
+    void GC::AddExternal(GCObject *owner, std::size_t bytes) {
+        GC *gc = Context::GetGC();
+        if (!owner->external) {
+            owner->external = true;
+            // one marked in the cycle under way is alive at its end
+            if (owner->old)
+                (marking && Page::IsMarked(owner) ? gc->black_externals : gc->externals).push_back(owner);
         }
+        gc->heap_size += bytes;
+    }
+
+    void GC::RemoveExternal(GCObject *owner, std::size_t bytes) {
+        if (owner->external)
+            Context::GetGC()->heap_size -= bytes;
     }
 
-    void GC::SweepAll() {
-        GCObject **ptr = &objects;
+    void GC::DiscountExternals() {
+        std::size_t kept = 0;
+        for (auto i = externals.begin(); i != externals.end(); ++i) {
+            GCObject *obj = *i;
+            if (Page::IsMarked(obj) || obj->persistent)
+                externals[kept++] = obj;
+            else {
+                heap_size -= obj->GetExternalSize();
+                obj->external = false;
+            }
+        }
+        externals.resize(kept);
+        externals.insert(externals.end(), black_externals.begin(), black_externals.end());
+        black_externals.clear();
+    }
 
-        while (*ptr != nullptr) {
-            if (!(*ptr)->marked && !(*ptr)->persistent)
-                *ptr = Erase(*ptr);
+    void GC::RememberSlow(GCObject *target) {
+        target->remembered = true;
+        Context::GetGC()->remembered.push_back(target);
+    }
+
+    void GC::ShadeSlow(GCObject *obj) {
+        // the marking thread may shade it at the same time
+        if (Page::Mark(obj)) {
+            if (local_deque != nullptr)
+                local_deque->Push(obj);
+            else
+                Context::GetGC()->PushGray(obj);
+        }
+    }
+
+    void GC::PushGray(GCObject *obj) {
+        if (in_marker || !marker_active || locked)
+            gray.push_back(obj);
+        else {
+            Lock();
+            gray.push_back(obj);
+            Unlock();
+        }
+    }
+
+    void GC::ForgetRemembered() {
+        for (auto i = remembered.begin(); i != remembered.end(); ++i)
+            (*i)->remembered = false;
+        remembered.clear();
+    }
+
+    void GC::SweepNursery() {
+        for (auto i = young.begin(); i != young.end(); ++i) {
+            // Context makes some young ones persistent
+            if (!Page::IsMarked(*i) && !(*i)->persistent)
+                Destroy(*i);
             else
-                ptr = &((*ptr)->next);
+                Promote(*i);
         }
+        young.clear();
+    }
+
+    void GC::SweepPages() {
+        auto pages = heap.TakeUnswept();
+        if (pages.empty())
+            return;
+
+        if (thread_count > 1) {
+            std::atomic<std::size_t> next_page(0);
+            RunParallel([&pages, &next_page](unsigned int) {
+                std::size_t i;
+                while ((i = next_page.fetch_add(1)) < pages.size())
+                    Heap::SweepPage(pages[i]);
+            });
+        } else
+            for (auto i = pages.begin(); i != pages.end(); ++i)
+                Heap::SweepPage(*i);
+
+        heap.Rebuild();
+    }
+
+    void GC::Collect() {
+        auto start = clock::now();
+
+        if (phase == Phase::Idle && heap_size < next_heap_size)
+            MinorGC();
+        else if (marker_active || (phase == Phase::Idle && concurrent_marking))
+            // late if the heap has grown by the growth factor again
+            // meanwhile, the scripts wait for the cycle to end then
+            ConcurrentStep(heap_size >= next_heap_size * growth_factor);
+        else {
+            if (phase == Phase::Idle)
+                StartCycle();
+
+            auto deadline = clock::time_point::max();
+            if (pause_budget > 0)
+                deadline = start + std::chrono::duration_cast<clock::duration>(
+                        std::chrono::duration<double, std::milli>(pause_budget));
+            if (Advance(deadline))
+                FinishCycle();
+        }
+
+        EndPause(start);
     }
 
     void GC::FullGC() {
+        auto start = clock::now();
+
+        if (marker_active)
+            ConcurrentStep(true);
+        else {
+            if (phase == Phase::Idle)
+                StartCycle();
+            Advance(clock::time_point::max());
+            FinishCycle();
+        }
+        SweepPages();
+
+        EndPause(start);
+    }
+
+    void GC::EndPause(clock::time_point start) {
+        // the next slice of a cycle is due after as many bytes
+        // as would fill the nursery
+        next_gc = heap_size + nursery_size;
+        if (phase == Phase::Idle)
+            next_gc = std::min(next_gc, next_heap_size);
+
+        double pause = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+        max_pause = std::max(max_pause, pause);
+        ++pause_count;
+    }
+
+    void GC::ShadeRoots() {
+        Context::GetVM()->MarkRoots();
+
+        auto scs = Context::GetRunningContexts();
+        for (auto i = scs->begin(); i != scs->end(); ++i) {
+            Page::Unmark(*i);
+            Shade(*i);
+        }
+    }
+
+    void GC::ShadePersistents() {
+        for (auto i = persistents.begin(); i != persistents.end(); ++i)
+            Shade(*i);
+    }
+
+    void GC::MinorGC() {
+        // the old objects are still marked, only the young ones
+        // reachable from the roots or the remembered set get marked
+        ShadeRoots();
+
+        for (auto i = remembered.begin(); i != remembered.end(); ++i) {
+            (*i)->remembered = false;
+            Shade(*i);
+        }
+        remembered.clear();
+
+        Drain(clock::time_point::max());
+        SweepNursery();
+    }
+
+    void GC::StartCycle() {
 #ifdef _DEBUG
         // std::cout << "Full GC" << std::endl;
 #endif
-        ClearAllMarks();
-        auto scs = Context::GetRunningContexts();
-        for (auto i = scs->begin(); i != scs->end(); ++i) {
-            (*i)->Mark();
+        // the last cycle is swept first, the nursery waits for this
+        // one, which sweeps it too
+        SweepPages();
+        ForgetRemembered();
+        phase = Phase::Clearing;
+        clearing = heap.GetPages();
+        cursor = 0;
+    }
+
+    bool GC::Advance(clock::time_point deadline) {
+        bool bounded = deadline != clock::time_point::max();
+
+        if (phase == Phase::Clearing) {
+            // nothing may be black before every old mark is cleared
+            while (cursor < clearing.size()) {
+                clearing[cursor++]->ClearMarks();
+                if (bounded && clock::now() >= deadline)
+                    return false;
+            }
+            clearing.clear();
+
+            ShadePersistents();
+            phase = Phase::Marking;
+            marking = true;
+            ShadeRoots();
         }
-        SweepAll();
+
+        return Drain(deadline);
+    }
+
+    void GC::FinishCycle() {
+        // the roots as they are now, and what the marking thread
+        // left to the last pause
+        ShadeRoots();
+        for (auto i = deferred.begin(); i != deferred.end(); ++i)
+            (*i)->Scan();
+        deferred.clear();
+        Drain(clock::time_point::max());
+        marking = false;
+        snapshot = false;
+
+        ForgetRemembered();
+
+        // what survived of the nursery is old, the rest is swept
+        // with the pages as they are needed
+        for (auto i = young.begin(); i != young.end(); ++i)
+            if (Page::IsMarked(*i))
+                Promote(*i);
+            else if ((*i)->external) {
+                heap_size -= (*i)->GetExternalSize();
+                (*i)->external = false;
+            }
+        young.clear();
+        DiscountExternals();
+        heap_size -= heap.StartSweeping();
+        phase = Phase::Idle;
+        ++cycle_count;
+
+        // what survived decides when the next one is due
+        next_heap_size = std::max(static_cast<std::size_t>(heap_size * growth_factor),
+                                  min_heap_size);
     }
 
-    void GC::CheckAndGC() {
-        if (counter >= 128) {
-            FullGC();
-            counter = 0;
+    bool GC::Drain(clock::time_point deadline) {
+        bool bounded = deadline != clock::time_point::max();
+        unsigned int count = 0;
+
+        // a minor collection has too little to share out
+        if (!bounded && thread_count > 1 && phase == Phase::Marking) {
+            DrainParallel();
+            return true;
+        }
+
+        while (!gray.empty()) {
+            GCObject *obj = gray.back();
+            gray.pop_back();
+            obj->Scan();
+            if (bounded && ++count % TRACE_CHECK == 0 && clock::now() >= deadline)
+                return gray.empty();
+        }
+        return true;
+    }
+
+    void GC::ConcurrentStep(bool late) {
+        if (phase == Phase::Idle) {
+            Lock();
+            StartCycle();
+            marker_active = true;
+            cleared = false;
+            Unlock();
+            if (!marker.joinable())
+                marker = std::thread(&GC::MarkerLoop, this);
+            marker_cv.notify_one();
+            return;
+        }
+
+        Lock();
+        while (phase == Phase::Clearing && !cleared && late) {
+            Unlock();
+            std::this_thread::yield();
+            Lock();
+        }
+
+        if (phase == Phase::Clearing && cleared) {
+            phase = Phase::Marking;
+            marking = true;
+            snapshot = true;
+            ShadeRoots();
+        }
+
+        if (phase == Phase::Marking && (gray.empty() || late)) {
+            marker_active = false;
+            FinishCycle();
+        }
+        Unlock();
+        marker_cv.notify_one();
+    }
+
+    void GC::MarkerLoop() {
+        in_marker = true;
+        std::unique_lock<std::mutex> lock(heap_lock);
+
+        for (;;) {
+            marker_cv.wait(lock, [this] {
+                return shutdown || (marker_active && phase == Phase::Clearing && !cleared) ||
+                       (marker_active && phase == Phase::Marking && !gray.empty());
+            });
+            if (shutdown)
+                return;
+
+            if (phase == Phase::Clearing) {
+                // the scripts do not look at the marks before the
+                // snapshot, nor free a cell
+                lock.unlock();
+                for (auto i = clearing.begin(); i != clearing.end(); ++i)
+                    (*i)->ClearMarks();
+                lock.lock();
+                clearing.clear();
+                ShadePersistents();
+                cleared = true;
+                continue;
+            }
+
+            for (unsigned int count = 0; count < MARK_BATCH && !gray.empty(); ++count) {
+                GCObject *obj = gray.back();
+                gray.pop_back();
+                if (obj->IsScannedConcurrently())
+                    obj->Scan();
+                else
+                    deferred.push_back(obj);
+            }
+
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+    }
+
+    void GC::DrainParallel() {
+        unsigned int n = thread_count;
+        while (deques.size() < n)
+            deques.push_back(new WorkDeque());
+
+        // no thread runs yet, so one may push to them all
+        for (std::size_t i = 0; i < gray.size(); ++i)
+            deques[i % n]->Push(gray[i]);
+        gray.clear();
+
+        std::atomic<unsigned int> idle(0);
+        RunParallel([this, n, &idle](unsigned int id) {
+            WorkDeque *own = deques[id];
+            local_deque = own;
+
+            for (;;) {
+                GCObject *obj = own->Pop();
+                for (unsigned int k = 1; obj == nullptr && k < n; ++k)
+                    obj = deques[(id + k) % n]->Steal();
+                if (obj != nullptr) {
+                    obj->Scan();
+                    continue;
+                }
+
+                // an idle thread has nothing in its own deque, so
+                // once all are there is nothing left to mark
+                idle.fetch_add(1);
+                for (;;) {
+                    if (idle.load() == n) {
+                        local_deque = nullptr;
+                        return;
+                    }
+                    bool found = false;
+                    for (unsigned int k = 0; k < n && !found; ++k)
+                        found = !deques[k]->Empty();
+                    if (found) {
+                        idle.fetch_sub(1);
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        });
+
+        for (unsigned int i = 0; i < n; ++i)
+            deques[i]->Reset();
+    }
+
+    void GC::RunParallel(const std::function<void(unsigned int)> &fn) {
+        unsigned int n = thread_count;
+        while (helpers.size() + 1 < n)
+            helpers.emplace_back(&GC::HelperLoop, this,
+                                 static_cast<unsigned int>(helpers.size() + 1), job_serial);
+
+        {
+            std::lock_guard<std::mutex> guard(pool_lock);
+            job = &fn;
+            job_threads = n;
+            job_pending = n - 1;
+            ++job_serial;
+        }
+        pool_cv.notify_all();
+
+        fn(0);
+
+        std::unique_lock<std::mutex> guard(pool_lock);
+        pool_done.wait(guard, [this] { return job_pending == 0; });
+        job = nullptr;
+    }
+
+    void GC::HelperLoop(unsigned int id, unsigned long serial) {
+        std::unique_lock<std::mutex> guard(pool_lock);
+
+        for (;;) {
+            pool_cv.wait(guard, [this, serial] { return shutdown || job_serial != serial; });
+            if (shutdown)
+                return;
+            serial = job_serial;
+
+            // fewer threads may be asked for than there are
+            if (id >= job_threads)
+                continue;
+
+            auto fn = job;
+            guard.unlock();
+            (*fn)(id);
+            guard.lock();
+            if (--job_pending == 0)
+                pool_done.notify_one();
         }
     }
 
     GC::~GC() {
-        // clear all objects
-        while (objects != nullptr) {
-            objects = Erase(objects);
+        // "shutdown" is read under both locks, taken in the order
+        // of a parallel mark in the last pause of a concurrent one
+        Lock();
+        {
+            std::lock_guard<std::mutex> guard(pool_lock);
+            shutdown = true;
         }
+        Unlock();
+        pool_cv.notify_all();
+        for (auto i = helpers.begin(); i != helpers.end(); ++i)
+            i->join();
+        for (auto i = deques.begin(); i != deques.end(); ++i)
+            delete *i;
+
+        if (marker.joinable()) {
+            marker_cv.notify_one();
+            marker.join();
+        }
+
+        // clear all objects, the heap unmaps their pages
+        auto &pages = heap.GetPages();
+        for (auto i = pages.begin(); i != pages.end(); ++i)
+            (*i)->ForEachObject([](GCObject *obj) { obj->~GCObject(); });
     }
 
 }
@@ -1,15 +1,98 @@
 #pragma once
 
 #include <memory>
+#include <cstddef>
+#include <vector>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <new>
 #include "object.h"
+#include "Heap.h"
 
 namespace halang {
 
+    class WorkDeque;
+
+    /// <summary>
+    /// Generational mark and sweep, incremental or concurrent.
+    ///
+    /// New puts an object in the nursery, the young generation,
+    /// which a minor collection sweeps once it holds the nursery
+    /// size in bytes. What survives is promoted to the old
+    /// generation in place, no object is ever moved, as native
+    /// code keeps raw pointers to them all.
+    ///
+    /// Marking is tri-color: an unmarked object is white, Shade
+    /// marks it gray and puts it on the gray worklist, and it is
+    /// black once taken off and traced.
+    ///
+    /// The mark bits of old objects stay set between collections,
+    /// so the marking of a minor collection stops at the first old
+    /// object on each path and only goes through the young ones.
+    /// A young object an old one refers to is kept alive by the
+    /// write barrier instead, which puts it in the remembered set
+    /// when the reference is stored; the minor collection marks
+    /// from it as a root.
+    ///
+    /// A full collection is due when the heap reaches the bytes the
+    /// last one left alive times the growth factor, or the minimum
+    /// heap size while it is still small. With a pause budget it is
+    /// a cycle of slices, one each time the nursery would be full,
+    /// which first clear the old mark bits and then mark, each
+    /// within the budget, while the scripts run in between; minor
+    /// collections wait for it. The write barrier shades what is
+    /// stored into a marked object meanwhile (Dijkstra), what New
+    /// gives once the marking has begun is black and old already,
+    /// and the roots, written without the barrier, are marked again
+    /// in the last slice.
+    ///
+    /// The heap counts the cells of the objects and the bytes they
+    /// hold outside of it, the storage of arrays, dicts, strings,
+    /// BigInts and contexts, which they tell of by AddExternal and
+    /// RemoveExternal. Those of an object a full collection finds
+    /// dead are taken off the count at once, the object waits for
+    /// its page to be swept.
+    ///
+    /// With concurrent marking a thread of its own clears and marks
+    /// instead, while the scripts run on. It marks what was alive
+    /// when the cycle took its snapshot of the roots: the snapshot
+    /// barrier shades every reference about to be overwritten or
+    /// removed (Yuasa), and what New gives meanwhile is already
+    /// black, its references shaded. The thread scans an object
+    /// holding heap_lock, which the scripts take in turn over every
+    /// change to one it may be scanning (Mutation); ScriptContext
+    /// and UpValue, which the VMs write without the barrier, wait
+    /// for the last pause. That pause marks the roots and the
+    /// running contexts again.
+    ///
+    /// With more than one thread, what a full collection marks in
+    /// one go, and its sweep, are shared out among them. Each has a
+    /// deque of gray objects of its own and steals from the others
+    /// once it is empty; the sweep hands out the pages.
+    ///
+    /// The objects live in the pages of the Heap, by size, and
+    /// their mark bits in bitmaps of the pages: a cycle clears them
+    /// page by page. Its last pause ends once it has marked, the
+    /// Heap sweeps the unmarked objects of a page when it needs
+    /// cells of its class, and the next cycle what is left first.
+    /// A minor collection only sweeps the nursery, the young
+    /// objects New has given since the last collection.
+    /// The persistent objects are shaded as roots once the marks
+    /// are cleared.
+    ///
+    /// It only collects at the safepoints of the VMs, where every
+    /// value in use is reachable from the roots, never inside New.
+    /// </summary>
     final class GC {
 
     private:
 
-        GCObject *objects;
+        Heap heap;
+        std::vector<GCObject *> young;
+        std::vector<GCObject *> persistents;
 
     protected:
 
@@ -23,38 +106,385 @@ namespace halang {
 
         template<class _Ty, class... _Types>
         inline _Ty *New(_Types &&... _Args) {
-            _Ty *new_obj = new _Ty(std::forward<_Types>(_Args)...);
-            new_obj->next = objects;
-            objects = new_obj;
+            _Ty *new_obj = Make<_Ty>(std::forward<_Types>(_Args)...);
+            Page::Of(new_obj)->Publish(new_obj);
+
+            // black at once while a cycle marks, so what the
+            // constructor stored is shaded; it is old at the end of
+            // the cycle anyway, so it is old from the start rather
+            // than one more young object for the last pause
+            if (marking) {
+                Page::Mark(new_obj);
+                new_obj->Scan();
+                new_obj->old = true;
+                if (new_obj->external)
+                    black_externals.push_back(new_obj);
+            } else
+                young.push_back(new_obj);
 
-            counter++;
+            heap_size += Heap::CellSize(sizeof(_Ty));
 
             return new_obj;
         }
 
         template<class _Ty, class... _Types>
         inline _Ty *NewPersistent(_Types &&... _Args) {
-            _Ty *new_obj = new _Ty(std::forward<_Types>(_Args)...);
-            new_obj->next = objects;
-            new_obj->persistent = true;
-            objects = new_obj;
+            _Ty *new_obj = Make<_Ty>(std::forward<_Types>(_Args)...);
+            new_obj->old = true;
+            Page::Of(new_obj)->Publish(new_obj);
+            MakePersistent(new_obj);
+            if (new_obj->external)
+                externals.push_back(new_obj);
 
             return new_obj;
         }
 
-        void CheckAndGC();
+        /// <summary>
+        /// Keep "obj" alive from now on, and what it refers to.
+        /// </summary>
+        void MakePersistent(GCObject *obj);
+
+        // a safepoint
+        inline void CheckAndGC() {
+            if (heap_size >= next_gc)
+                Collect();
+        }
+
+        /// <summary>
+        /// Finish the full cycle under way, or do a whole one, in
+        /// this pause.
+        /// </summary>
+        void FullGC();
+
+        /// <summary>
+        /// Make "obj" gray if it is white.
+        /// </summary>
+        static inline void Shade(GCObject *obj) {
+            if (!Page::IsMarked(obj))
+                ShadeSlow(obj);
+        }
+
+        static inline void Shade(const Value &v) {
+            if (v.isGCObject())
+                Shade(v.AsGC());
+        }
+
+        /// <summary>
+        /// The write barrier, for every store of a reference into a
+        /// GC object other than through the value stack.
+        /// </summary>
+        static inline void WriteBarrier(const GCObject *owner, const Value &v) {
+            if (v.isGCObject())
+                WriteBarrier(owner, v.AsGC());
+        }
+
+        static inline void WriteBarrier(const GCObject *owner, GCObject *target) {
+            if (owner == nullptr)
+                return;
+            if (owner->old)
+                Remember(target);
+            if (marking && Page::IsMarked(owner))
+                Shade(target);
+        }
+
+        // where the owner is not at hand, as if it were old and marked
+        static inline void WriteBarrier(GCObject *target) {
+            Remember(target);
+            if (marking)
+                Shade(target);
+        }
+
+        /// <summary>
+        /// The snapshot barrier, for a reference about to be
+        /// overwritten in or removed from a GC object.
+        /// </summary>
+        static inline void SnapshotBarrier(const Value &old) {
+            if (snapshot)
+                Shade(old);
+        }
+
+        static inline void SnapshotBarrier(GCObject *old) {
+            if (snapshot && old != nullptr)
+                Shade(old);
+        }
+
+        /// <summary>
+        /// Held over every change to the references in an object
+        /// the marking thread may scan, which never sees one then
+        /// half done. Nothing while the thread is not marking.
+        /// </summary>
+        class Mutation {
+        public:
+
+            inline Mutation() : held(marker_active && !locked) {
+                if (held)
+                    Lock();
+            }
+
+            inline ~Mutation() {
+                if (held)
+                    Unlock();
+            }
+
+            Mutation(const Mutation &) = delete;
+
+            Mutation &operator=(const Mutation &) = delete;
+
+        private:
+
+            bool held;
+
+        };
+
+        /// <summary>
+        /// "owner" holds "bytes" more outside the heap, from its
+        /// constructor on, which GetExternalSize must tell as well.
+        /// </summary>
+        static void AddExternal(GCObject *owner, std::size_t bytes);
+
+        // "owner" has given back "bytes" of them while alive
+        static void RemoveExternal(GCObject *owner, std::size_t bytes);
+
+        inline std::size_t GetHeapSize() const { return heap_size; }
+
+        inline std::size_t GetPageCount() const { return heap.GetPages().size(); }
+
+        // the pauses of the collector so far, and the longest one
+        // in milliseconds
+        inline unsigned long GetPauseCount() const { return pause_count; }
+
+        inline double GetMaxPause() const { return max_pause; }
+
+        // the full cycles finished so far, and whether one has
+        // started and not finished yet
+        inline unsigned long GetCycleCount() const { return cycle_count; }
+
+        inline bool IsCycleUnderWay() const { return phase != Phase::Idle; }
+
+        static double GetGrowthFactor();
+
+        // more than 1, 2 by default
+        static void SetGrowthFactor(double);
+
+        static std::size_t GetMinHeapSize();
+
+        static void SetMinHeapSize(std::size_t);
+
+        static std::size_t GetNurserySize();
+
+        static void SetNurserySize(std::size_t);
+
+        static double GetPauseBudget();
+
+        // in milliseconds, 0, the default, does a full
+        // collection in one pause
+        static void SetPauseBudget(double);
+
+        static bool GetConcurrentMarking();
+
+        // off by default, the pause budget does not count then
+        static void SetConcurrentMarking(bool);
+
+        static unsigned int GetThreadCount();
+
+        // the threads a full collection marks and sweeps on, 1, the
+        // default, for the thread of the scripts only
+        static void SetThreadCount(unsigned int);
 
     private:
 
-        GCObject *Erase(GCObject *obj);
+        typedef std::chrono::steady_clock clock;
 
-        unsigned int counter;
+        enum class Phase {
+            Idle,
+            Clearing,
+            Marking,
+        };
 
-        void FullGC();
+        static inline void Remember(GCObject *target) {
+            if (!target->old && !target->remembered)
+                RememberSlow(target);
+        }
+
+        static void RememberSlow(GCObject *);
+
+        static void ShadeSlow(GCObject *);
+
+        // the scripts take heap_lock by these, never the marking thread
+        static inline void Lock() {
+            heap_lock.lock();
+            locked = true;
+        }
+
+        static inline void Unlock() {
+            locked = false;
+            heap_lock.unlock();
+        }
+
+        void PushGray(GCObject *);
+
+        // a cell of the heap made into a _Ty
+        template<class _Ty, class... _Types>
+        inline _Ty *Make(_Types &&... _Args) {
+            void *cell = heap.Allocate(sizeof(_Ty));
+            try {
+                return new(cell) _Ty(std::forward<_Types>(_Args)...);
+            } catch (...) {
+                heap.Free(cell);
+                throw;
+            }
+        }
+
+        // its destructor run and its cell given back
+        void Destroy(GCObject *obj);
+
+        // the bytes of the objects from New and those they hold
+        // outside the heap, the size at which a full collection is
+        // due, and the one at which CheckAndGC collects
+        std::size_t heap_size;
+        std::size_t next_heap_size;
+        std::size_t next_gc;
+
+        // the young objects stored into old ones since the last
+        // collection
+        std::vector<GCObject *> remembered;
+
+        // the old objects with bytes outside the heap
+        std::vector<GCObject *> externals;
+
+        // those New has given black in the cycle under way, alive
+        // at its end, which DiscountExternals need not look at
+        std::vector<GCObject *> black_externals;
+
+        // the gray objects
+        std::vector<GCObject *> gray;
+
+        // where the full cycle is, the pages there were when it
+        // started, and the next one whose marks are to be cleared
+        Phase phase;
+        std::vector<Page *> clearing;
+        std::size_t cursor;
+
+        unsigned long pause_count;
+        double max_pause;
+        unsigned long cycle_count;
+
+        // the marking thread, and what it has put off for the last
+        // pause; "cleared" once it has cleared the old marks
+        std::thread marker;
+        std::condition_variable marker_cv;
+        std::vector<GCObject *> deferred;
+        bool cleared;
+        bool shutdown;
+
+        // the threads which help this one mark and sweep, the job
+        // they are given and how many of them have yet to finish it
+        std::vector<std::thread> helpers;
+        std::vector<WorkDeque *> deques;
+        std::mutex pool_lock;
+        std::condition_variable pool_cv;
+        std::condition_variable pool_done;
+        const std::function<void(unsigned int)> *job;
+        unsigned long job_serial;
+        unsigned int job_threads;
+        unsigned int job_pending;
+
+        // the write barrier shades, the snapshot barrier shades and
+        // New gives black objects
+        static bool marking;
+        static bool snapshot;
+
+        // the marking thread may be scanning, and the scripts hold
+        // heap_lock, which guards the gray worklist and the objects
+        // the thread scans
+        static bool marker_active;
+        static bool locked;
+        static std::mutex heap_lock;
+
+        static bool concurrent_marking;
+        static unsigned int thread_count;
+
+        static double growth_factor;
+        static std::size_t min_heap_size;
+        static std::size_t nursery_size;
+        static double pause_budget;
+
+        void Collect();
+
+        // how long "start" was ago is a pause
+        void EndPause(clock::time_point start);
+
+        void MinorGC();
+
+        /// <summary>
+        /// Shade the roots, the running contexts marked again as the
+        /// registers of the RegisterVM are written without the barrier.
+        /// </summary>
+        void ShadeRoots();
+
+        // once the marks are cleared, as they are alive
+        void ShadePersistents();
+
+        void StartCycle();
+
+        /// <summary>
+        /// Do the work of the full cycle until the deadline, true if
+        /// only the last slice is left.
+        /// </summary>
+        bool Advance(clock::time_point deadline);
+
+        void FinishCycle();
+
+        /// <summary>
+        /// The share of the scripts in a concurrent cycle: start it,
+        /// take the snapshot once the old marks are cleared, and
+        /// finish it when the marking thread runs out of gray objects,
+        /// or at once if it is "late".
+        /// </summary>
+        void ConcurrentStep(bool late);
+
+        void MarkerLoop();
+
+        /// <summary>
+        /// Run "fn" on thread_count threads, this one as 0, until
+        /// they all return.
+        /// </summary>
+        void RunParallel(const std::function<void(unsigned int)> &fn);
+
+        void HelperLoop(unsigned int id, unsigned long serial);
+
+        /// <summary>
+        /// Trace the gray objects until there are none, or until
+        /// the deadline, false if some are left.
+        /// </summary>
+        bool Drain(clock::time_point deadline);
+
+        void DrainParallel();
+
+        void ForgetRemembered();
+
+        // young or old, it holds on to its bytes outside the heap
+        inline void Promote(GCObject *obj) {
+            if (!obj->old && obj->external)
+                externals.push_back(obj);
+            obj->old = true;
+        }
+
+        // take the bytes outside the heap of the objects found dead
+        // off the heap size
+        void DiscountExternals();
 
-        void ClearAllMarks();
+        /// <summary>
+        /// Delete the unmarked objects of the nursery and promote the
+        /// rest to the old generation, marked.
+        /// </summary>
+        void SweepNursery();
 
-        void SweepAll();
+        /// <summary>
+        /// Sweep the pages the allocation has not swept yet since
+        /// the last full collection, on as many threads as there are.
+        /// </summary>
+        void SweepPages();
 
     };
 
@@ -0,0 +1,15 @@
+#include "Generator.h"
+#include "context.h"
+
+namespace halang {
+
+    Dict *Generator::GetPrototype() {
+        return Context::GetGeneratorPrototype();
+    }
+
+    void Generator::Scan() {
+        GC::Shade(self);
+        GC::Shade(context);
+    }
+
+}
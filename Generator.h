@@ -0,0 +1,52 @@
+#pragma once
+
+#include "object.h"
+#include "ScriptContext.h"
+
+namespace halang {
+
+    /// <summary>
+    /// The suspended call of a function containing yield.
+    ///
+    /// Calling such a function runs nothing but gives a generator,
+    /// whose ScriptContext keeps the arguments. Each resume copies
+    /// the variables and operands of the ScriptContext onto the value
+    /// stack as a frame and runs it from saved_ptr, and YIELD copies
+    /// them back. The ScriptContext is allocated once with the
+    /// generator and reused by every resume.
+    /// </summary>
+    class Generator : public GCObject {
+    public:
+
+        friend class GC;
+
+        friend class StackVM;
+
+        enum class State {
+            Suspended,
+            Running,
+            Done,
+        };
+
+    protected:
+
+        Generator(Value _self, ScriptContext *_sc) :
+                GCObject(TypeId::Generator), state(State::Suspended), self(_self), context(_sc) {}
+
+    private:
+
+        State state;
+        Value self;
+        ScriptContext *context;
+
+    public:
+
+        inline State GetState() const { return state; }
+
+        virtual Dict *GetPrototype() override;
+
+        virtual void Scan() override;
+
+    };
+
+}
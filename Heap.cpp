@@ -0,0 +1,235 @@
+#include "Heap.h"
+#include <new>
+#include <cstdlib>
+
+// pages are mapped where there is mmap, and given back with madvise
+#if defined(__linux__) || defined(__APPLE__)
+#define HALANG_HEAP_MMAP
+#include <sys/mman.h>
+#endif
+
+namespace halang {
+
+    static const std::size_t HEADER_SIZE =
+            (sizeof(Page) + Page::MIN_CELL - 1) / Page::MIN_CELL * Page::MIN_CELL;
+
+    // "bytes" rounded up to SIZE, aligned to SIZE
+    static void *MapPage(std::size_t bytes) {
+#ifdef HALANG_HEAP_MMAP
+        auto mapped = static_cast<char *>(mmap(nullptr, bytes + Page::SIZE, PROT_READ | PROT_WRITE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+        if (mapped == MAP_FAILED)
+            throw std::bad_alloc();
+
+        // the slack around the aligned part goes back at once
+        auto aligned = reinterpret_cast<char *>(
+                (reinterpret_cast<std::uintptr_t>(mapped) + Page::SIZE - 1) & ~(Page::SIZE - 1));
+        if (aligned != mapped)
+            munmap(mapped, static_cast<std::size_t>(aligned - mapped));
+        auto tail = static_cast<std::size_t>(mapped + bytes + Page::SIZE - (aligned + bytes));
+        if (tail != 0)
+            munmap(aligned + bytes, tail);
+        return aligned;
+#else
+        void *mapped = std::malloc(bytes + Page::SIZE);
+        if (mapped == nullptr)
+            throw std::bad_alloc();
+        return mapped;
+#endif
+    }
+
+    // "bytes" apart, as a released page has no header left
+    static void UnmapPage(Page *page, std::size_t bytes) {
+#ifdef HALANG_HEAP_MMAP
+        munmap(page, bytes);
+#else
+        std::free(page->base);
+#endif
+    }
+
+    Page *Heap::NewPage(unsigned int cell_size, std::size_t bytes) {
+        void *base;
+        if (bytes == Page::SIZE && !released.empty()) {
+#ifdef HALANG_HEAP_MMAP
+            // madvise has cleared the header, the page is the mapping
+            base = released.back();
+#else
+            base = released.back()->base;
+#endif
+            released.pop_back();
+        } else
+            base = MapPage(bytes);
+
+#ifdef HALANG_HEAP_MMAP
+        Page *page = new(base) Page;
+#else
+        Page *page = new(reinterpret_cast<void *>(
+                (reinterpret_cast<std::uintptr_t>(base) + Page::SIZE - 1) & ~(Page::SIZE - 1))) Page;
+#endif
+        page->base = base;
+        page->bytes = bytes;
+        page->cell_size = cell_size;
+        page->large = cell_size > MAX_CELL;
+        page->cell_count = page->large ? 1 : static_cast<unsigned int>((Page::SIZE - HEADER_SIZE) / cell_size);
+        page->live = 0;
+        page->listed = false;
+        page->free_list = nullptr;
+        page->cells = reinterpret_cast<char *>(page) + HEADER_SIZE;
+        page->bump = page->cells;
+        page->end = page->cells + static_cast<std::size_t>(page->cell_count) * cell_size;
+        for (unsigned int i = 0; i < Page::WORDS; ++i)
+            page->allocated[i].store(0, std::memory_order_relaxed);
+        page->ClearMarks();
+
+        page->index = pages.size();
+        pages.push_back(page);
+        return page;
+    }
+
+    void *Heap::AllocateSlow(std::size_t size) {
+        auto c = (size + Page::MIN_CELL - 1) / Page::MIN_CELL - 1;
+        auto &list = partial[c];
+        while (!list.empty() && list.back()->IsFull()) {
+            list.back()->listed = false;
+            list.pop_back();
+        }
+
+        // the cells of the dead objects before a new page
+        while (list.empty() && !unswept[c].empty()) {
+            Page *page = unswept[c].back();
+            unswept[c].pop_back();
+            SweepPage(page);
+            if (!page->IsFull()) {
+                page->listed = true;
+                list.push_back(page);
+            }
+        }
+
+        if (list.empty()) {
+            Page *page = NewPage(static_cast<unsigned int>((c + 1) * Page::MIN_CELL), Page::SIZE);
+            page->listed = true;
+            list.push_back(page);
+        }
+        return Allocate(size);
+    }
+
+    void *Heap::AllocateLarge(std::size_t size) {
+        auto bytes = (HEADER_SIZE + size + Page::SIZE - 1) / Page::SIZE * Page::SIZE;
+        Page *page = NewPage(static_cast<unsigned int>(size), bytes);
+        page->bump = page->end;
+        page->live = 1;
+        return page->cells;
+    }
+
+    void Heap::Free(void *cell) {
+        Page *page = Page::Of(cell);
+        page->Free(cell);
+
+        // no sweep would find it, its object is gone already
+        if (page->large) {
+            Page *last = pages.back();
+            pages[page->index] = last;
+            last->index = page->index;
+            pages.pop_back();
+            Release(page);
+            return;
+        }
+        if (!page->listed) {
+            page->listed = true;
+            partial[page->cell_size / Page::MIN_CELL - 1].push_back(page);
+        }
+    }
+
+    void Heap::Release(Page *page) {
+        if (page->large) {
+            UnmapPage(page, page->bytes);
+            return;
+        }
+#ifdef HALANG_HEAP_MMAP
+        // the header goes too, "released" is all that is kept of it
+        madvise(page, Page::SIZE, MADV_DONTNEED);
+#endif
+        released.push_back(page);
+    }
+
+    std::size_t Heap::StartSweeping() {
+        for (unsigned int c = 0; c < CLASSES; ++c)
+            partial[c].clear();
+
+        std::size_t dead = 0;
+        std::size_t kept = 0;
+        for (auto i = pages.begin(); i != pages.end(); ++i) {
+            Page *page = *i;
+            auto count = page->CountUnmarked();
+            dead += static_cast<std::size_t>(count) * page->cell_size;
+
+            if (page->large && count != 0) {
+                SweepPage(page);
+                Release(page);
+                continue;
+            }
+            page->index = kept;
+            pages[kept++] = page;
+            page->listed = false;
+            if (page->large)
+                continue;
+
+            auto c = page->cell_size / Page::MIN_CELL - 1;
+            if (count != 0)
+                // its free cells wait for it to be swept too
+                unswept[c].push_back(page);
+            else if (!page->IsFull()) {
+                page->listed = true;
+                partial[c].push_back(page);
+            }
+        }
+        pages.resize(kept);
+        return dead;
+    }
+
+    std::vector<Page *> Heap::TakeUnswept() {
+        std::vector<Page *> taken;
+        for (unsigned int c = 0; c < CLASSES; ++c) {
+            taken.insert(taken.end(), unswept[c].begin(), unswept[c].end());
+            unswept[c].clear();
+        }
+        return taken;
+    }
+
+    void Heap::SweepPage(Page *page) {
+        page->ForEachUnmarked([page](GCObject *obj) {
+            if (obj->persistent)
+                return;
+            obj->~GCObject();
+            page->Free(obj);
+        });
+    }
+
+    void Heap::Rebuild() {
+        for (unsigned int c = 0; c < CLASSES; ++c)
+            partial[c].clear();
+
+        std::size_t kept = 0;
+        for (auto i = pages.begin(); i != pages.end(); ++i) {
+            Page *page = *i;
+            if (page->live == 0) {
+                Release(page);
+                continue;
+            }
+            page->index = kept;
+            pages[kept++] = page;
+            page->listed = !page->large && !page->IsFull();
+            if (page->listed)
+                partial[page->cell_size / Page::MIN_CELL - 1].push_back(page);
+        }
+        pages.resize(kept);
+    }
+
+    Heap::~Heap() {
+        for (auto i = pages.begin(); i != pages.end(); ++i)
+            UnmapPage(*i, (*i)->bytes);
+        for (auto i = released.begin(); i != released.end(); ++i)
+            UnmapPage(*i, Page::SIZE);
+    }
+
+}
@@ -0,0 +1,255 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "object.h"
+
+namespace halang {
+
+    /// <summary>
+    /// A page of the GC heap, SIZE bytes aligned to SIZE, of cells
+    /// of one size class, or of one large object in as many bytes
+    /// as it needs.
+    ///
+    /// The cells past "bump" have never been used, the others are
+    /// either on the free list or hold an object, which the bit of
+    /// the cell in "allocated" tells. The mark bits of the objects
+    /// are in "marks" beside them, so that clearing them all is a
+    /// memset of each page; the mark bit of a free cell is clear.
+    ///
+    /// A bit of either is for MIN_CELL bytes, so any cell finds its
+    /// own from its address alone, without the division by the
+    /// cell size.
+    /// </summary>
+    struct Page {
+
+        static const std::size_t SIZE = 1 << 16;
+        static const std::size_t MIN_CELL = 16;
+        static const unsigned int WORDS = SIZE / MIN_CELL / 64;
+
+        // the mapping, which "this" is inside of, and where the
+        // page is in the pages of the heap
+        void *base;
+        std::size_t bytes;
+        std::size_t index;
+
+        unsigned int cell_size;
+        unsigned int cell_count;
+        unsigned int live;
+
+        // of one large object, and among the pages of its class
+        // with free cells
+        bool large;
+        bool listed;
+
+        void *free_list;
+        char *bump;
+        char *cells;
+        char *end;
+
+        std::atomic<std::uint64_t> allocated[WORDS];
+        std::atomic<std::uint64_t> marks[WORDS];
+
+        static inline Page *Of(const void *cell) {
+            return reinterpret_cast<Page *>(reinterpret_cast<std::uintptr_t>(cell) & ~(SIZE - 1));
+        }
+
+        inline bool IsFull() const { return free_list == nullptr && bump == end; }
+
+        static inline unsigned int BitOf(const void *cell) {
+            return static_cast<unsigned int>((reinterpret_cast<std::uintptr_t>(cell) & (SIZE - 1)) / MIN_CELL);
+        }
+
+        static inline std::uint64_t MaskOf(unsigned int bit) {
+            return static_cast<std::uint64_t>(1) << (bit % 64);
+        }
+
+        static inline bool IsMarked(const void *cell) {
+            auto bit = BitOf(cell);
+            return (Of(cell)->marks[bit / 64].load(std::memory_order_relaxed) & MaskOf(bit)) != 0;
+        }
+
+        // true if it was not marked before, which one thread alone
+        // gets when several mark it at once
+        static inline bool Mark(const void *cell) {
+            auto bit = BitOf(cell);
+            auto mask = MaskOf(bit);
+            return (Of(cell)->marks[bit / 64].fetch_or(mask, std::memory_order_relaxed) & mask) == 0;
+        }
+
+        static inline void Unmark(const void *cell) {
+            auto bit = BitOf(cell);
+            Of(cell)->marks[bit / 64].fetch_and(~MaskOf(bit), std::memory_order_relaxed);
+        }
+
+        inline void ClearMarks() {
+            for (unsigned int i = 0; i < WORDS; ++i)
+                marks[i].store(0, std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// The cell holds a constructed object from now on, which
+        /// the marking thread may see.
+        /// </summary>
+        inline void Publish(const void *cell) {
+            auto bit = BitOf(cell);
+            auto &word = allocated[bit / 64];
+            word.store(word.load(std::memory_order_relaxed) | MaskOf(bit), std::memory_order_release);
+        }
+
+        // the object of the cell is destroyed, or was never made,
+        // and it is not marked
+        inline void Free(void *cell) {
+            auto bit = BitOf(cell);
+            auto &word = allocated[bit / 64];
+            word.store(word.load(std::memory_order_relaxed) & ~MaskOf(bit), std::memory_order_relaxed);
+            *static_cast<void **>(cell) = free_list;
+            free_list = cell;
+            --live;
+        }
+
+        template<class F>
+        inline void ForEachObject(F f) const { ForEach(f, false); }
+
+        // the ones a sweep is to delete, unless they are persistent
+        template<class F>
+        inline void ForEachUnmarked(F f) const { ForEach(f, true); }
+
+        inline unsigned int CountUnmarked() const {
+            unsigned int count = 0;
+            for (unsigned int w = BitOf(cells) / 64; w < WORDS; ++w)
+                count += static_cast<unsigned int>(__builtin_popcountll(
+                        allocated[w].load(std::memory_order_relaxed) & ~marks[w].load(std::memory_order_relaxed)));
+            return count;
+        }
+
+    private:
+
+        template<class F>
+        inline void ForEach(F f, bool unmarked) const {
+            auto first = BitOf(cells) / 64;
+            auto words = large ? first + 1 : WORDS;
+            for (unsigned int w = first; w < words; ++w) {
+                auto bits = allocated[w].load(std::memory_order_acquire);
+                if (unmarked)
+                    bits &= ~marks[w].load(std::memory_order_relaxed);
+                while (bits != 0) {
+                    auto bit = w * 64 + static_cast<unsigned int>(__builtin_ctzll(bits));
+                    bits &= bits - 1;
+                    f(reinterpret_cast<GCObject *>(
+                            reinterpret_cast<std::uintptr_t>(this) + static_cast<std::size_t>(bit) * MIN_CELL));
+                }
+            }
+        }
+
+    };
+
+    /// <summary>
+    /// Where GC::New puts the objects: pages of the size classes
+    /// of MIN_CELL to MAX_CELL bytes, in steps of MIN_CELL, and a
+    /// page of its own for a bigger object. An empty page is given
+    /// back to the system with madvise, and used again before a new
+    /// one is mapped.
+    ///
+    /// A full collection only marks, the sweep is lazy: each page
+    /// of a class is swept when Allocate runs out of free cells of
+    /// that class, and what is left when the next one starts.
+    /// </summary>
+    class Heap {
+    public:
+
+        static const std::size_t MAX_CELL = 512;
+        static const unsigned int CLASSES = MAX_CELL / Page::MIN_CELL;
+
+        Heap() {}
+
+        // the objects left must be destroyed first
+        ~Heap();
+
+        Heap(const Heap &) = delete;
+
+        Heap &operator=(const Heap &) = delete;
+
+        // the bytes of the cell Allocate gives for "size"
+        static inline std::size_t CellSize(std::size_t size) {
+            return size > MAX_CELL ? size : (size + Page::MIN_CELL - 1) / Page::MIN_CELL * Page::MIN_CELL;
+        }
+
+        /// <summary>
+        /// A cell of "size" bytes at least, for an object which the
+        /// page is told of by Publish once it is made, or which is
+        /// given back by Free.
+        /// </summary>
+        inline void *Allocate(std::size_t size) {
+            if (size > MAX_CELL)
+                return AllocateLarge(size);
+
+            auto &list = partial[(size + Page::MIN_CELL - 1) / Page::MIN_CELL - 1];
+            if (list.empty() || list.back()->IsFull())
+                return AllocateSlow(size);
+
+            Page *page = list.back();
+            void *cell = page->free_list;
+            if (cell != nullptr)
+                page->free_list = *static_cast<void **>(cell);
+            else {
+                cell = page->bump;
+                page->bump += page->cell_size;
+            }
+            ++page->live;
+            return cell;
+        }
+
+        // a large page goes back to the system with its object
+        void Free(void *cell);
+
+        // in no particular order
+        inline const std::vector<Page *> &GetPages() const { return pages; }
+
+        /// <summary>
+        /// Once a full collection has marked: leave the pages with
+        /// unmarked objects to be swept, and tell the bytes of those,
+        /// which are as good as deleted. A large page is swept at
+        /// once, its object is all there is to it.
+        /// </summary>
+        std::size_t StartSweeping();
+
+        // the pages not swept yet, which the heap leaves to the caller
+        std::vector<Page *> TakeUnswept();
+
+        // delete the unmarked objects of the page, on any thread
+        // while no other one uses the page
+        static void SweepPage(Page *page);
+
+        /// <summary>
+        /// After every page has been swept: give the empty ones
+        /// back, and make the free cells of the others the next to
+        /// be allocated.
+        /// </summary>
+        void Rebuild();
+
+    private:
+
+        void *AllocateSlow(std::size_t size);
+
+        void *AllocateLarge(std::size_t size);
+
+        Page *NewPage(unsigned int cell_size, std::size_t bytes);
+
+        void Release(Page *page);
+
+        std::vector<Page *> pages;
+
+        // the pages of each class with free cells, the last one
+        // allocated from first, and those yet to be swept
+        std::vector<Page *> partial[CLASSES];
+        std::vector<Page *> unswept[CLASSES];
+
+        // empty pages of SIZE bytes given back to the system
+        std::vector<Page *> released;
+
+    };
+
+}
@@ -1,6 +1,7 @@
 #include "ScriptContext.h"
 #include "halang.h"
 #include <cstdlib>
+#include <algorithm>
 
 namespace halang {
 
@@ -20,7 +21,8 @@ namespace halang {
         } else {
             CodePack *cp = _fun->codepack;
 
-            variable_size = cp->_var_names_size;
+            // in register format the variables are the registers
+            variable_size = std::max(cp->_var_names_size, cp->_register_size);
 
             var_ptr = variables = new Value[variable_size]();
 
@@ -28,6 +30,7 @@ namespace halang {
         }
 
         function = _fun;
+        GC::AddExternal(this, GetExternalSize());
     }
 
     ScriptContext::ScriptContext(const ScriptContext &sc) :
@@ -45,6 +48,7 @@ namespace halang {
         var_ptr = variables + (sc.var_ptr - sc.variables);
 
         host_upvals = sc.host_upvals;
+        GC::AddExternal(this, GetExternalSize());
     }
 
     Value ScriptContext::Top(int i) {
@@ -59,6 +63,7 @@ namespace halang {
         if (sptr - stack >= stack_size)
             throw std::runtime_error("stack overflow");
         *(sptr++) = v;
+        GC::WriteBarrier(this, v);
     }
 
     Value ScriptContext::GetVariable(unsigned int i) const {
@@ -71,10 +76,14 @@ namespace halang {
 
     void ScriptContext::SetVariable(unsigned int i, Value v) {
         variables[i] = v;
+        GC::WriteBarrier(this, v);
     }
 
     void ScriptContext::SetUpValue(unsigned int i, UpValue *uv) {
+        GC::Mutation m;
+        GC::SnapshotBarrier(function->upvalues[i]);
         function->upvalues[i] = uv;
+        GC::WriteBarrier(function, uv);
     }
 
     void ScriptContext::CloseAllUpValue() {
@@ -83,29 +92,25 @@ namespace halang {
             (*i)->close();
     }
 
-    void ScriptContext::Mark() {
-        if (!marked) {
-            marked = true;
-            function->Mark();
+    void ScriptContext::Scan() {
+        GC::Shade(function);
 
-            if (prev != nullptr)
-                prev->Mark();
+        if (prev != nullptr)
+            GC::Shade(prev);
 
-            Value *t = stack;
-            while (t != sptr) {
-                if (t->isGCObject())
-                    t->value.gc->Mark();
-                t++;
-            }
+        for (Value *t = stack; t != sptr; ++t)
+            GC::Shade(*t);
 
-            for (size_type i = 0; i < variable_size; ++i)
-                if (variables[i].isGCObject())
-                    variables[i].value.gc->Mark();
+        for (size_type i = 0; i < variable_size; ++i)
+            GC::Shade(variables[i]);
 
-            for (auto i = host_upvals.begin();
-                 i != host_upvals.end(); i++)
-                (*i)->Mark();
-        }
+        for (auto i = host_upvals.begin();
+             i != host_upvals.end(); i++)
+            GC::Shade(*i);
+    }
+
+    std::size_t ScriptContext::GetExternalSize() const {
+        return static_cast<std::size_t>(stack_size + variable_size) * sizeof(Value);
     }
 
     ScriptContext::~ScriptContext() {
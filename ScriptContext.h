@@ -14,6 +14,8 @@ namespace halang {
 
         friend class StackVM;
 
+        friend class RegisterVM;
+
         friend class GC;
 
         typedef unsigned int size_type;
@@ -72,7 +74,12 @@ namespace halang {
 
         void CloseAllUpValue();
 
-        virtual void Mark() override;
+        virtual void Scan() override;
+
+        virtual std::size_t GetExternalSize() const override;
+
+        // the RegisterVM writes the registers in place
+        virtual bool IsScannedConcurrently() const override { return false; }
 
         virtual ~ScriptContext();
     };
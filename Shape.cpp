@@ -0,0 +1,62 @@
+#include "Shape.h"
+#include "String.h"
+
+namespace halang {
+
+    Shape::Shape() {
+    }
+
+    Shape *Shape::Empty() {
+        static Shape empty;
+        return &empty;
+    }
+
+    bool Shape::SameName(String *key, unsigned int hash, const Property &prop) {
+        if (prop.hash != hash || key->GetLength() != prop.name.size())
+            return false;
+        for (size_type i = 0; i < prop.name.size(); ++i)
+            if (key->CharAt(i) != prop.name[i])
+                return false;
+        return true;
+    }
+
+    bool Shape::TryGetIndex(String *key, size_type &index) const {
+        auto hash = key->GetHash();
+        for (size_type i = 0; i < properties.size(); ++i)
+            if (SameName(key, hash, properties[i])) {
+                index = i;
+                return true;
+            }
+        return false;
+    }
+
+    Shape *Shape::AddProperty(String *key) {
+        if (GetCount() >= MAX_PROPERTIES)
+            return nullptr;
+
+        auto hash = key->GetHash();
+        for (auto i = transitions.begin(); i != transitions.end(); ++i)
+            if (SameName(key, hash, (*i)->properties.back()))
+                return *i;
+
+        if (transitions.size() >= MAX_TRANSITIONS)
+            return nullptr;
+
+        auto next = new Shape();
+        next->properties = properties;
+
+        Property prop;
+        prop.hash = hash;
+        key->ToU16String(prop.name);
+        next->properties.push_back(prop);
+
+        transitions.push_back(next);
+        return next;
+    }
+
+    Shape::~Shape() {
+        for (auto i = transitions.begin(); i != transitions.end(); ++i)
+            delete *i;
+    }
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "halang.h"
+#include "object.h"
+
+namespace halang {
+
+    class String;
+
+    /// <summary>
+    /// Shape (hidden class) of the dicts with string keys.
+    ///
+    /// A shape is the ordered list of the property names of a
+    /// dict, the index of a name in it is the slot of the value
+    /// in the dict. Dicts that got the same names in the same
+    /// order share one shape, which are linked into a transition
+    /// tree growing from Shape::Empty().
+    ///
+    /// Shapes are not GC objects, they keep a copy of the names
+    /// and live as long as the program, so an inline cache can
+    /// hold a shape without marking it.
+    /// </summary>
+    class Shape {
+    public:
+
+        typedef unsigned int size_type;
+
+        // a dict with more properties goes to dictionary mode
+        static const size_type MAX_PROPERTIES = 32;
+
+        // a shape with more transitions does not get new ones
+        static const size_type MAX_TRANSITIONS = 64;
+
+        static Shape *Empty();
+
+        Shape(const Shape &) = delete;
+
+        Shape &operator=(const Shape &) = delete;
+
+        inline size_type GetCount() const {
+            return static_cast<size_type>(properties.size());
+        }
+
+        inline const std::u16string &GetName(size_type index) const {
+            return properties[index].name;
+        }
+
+        bool TryGetIndex(String *key, size_type &index) const;
+
+        /// <summary>
+        /// The shape with "key" appended, shared with every other
+        /// dict that went the same way. Returns nullptr if the dict
+        /// should leave shapes for dictionary mode.
+        /// </summary>
+        Shape *AddProperty(String *key);
+
+        ~Shape();
+
+    private:
+
+        struct Property {
+            unsigned int hash;
+            std::u16string name;
+        };
+
+        Shape();
+
+        static bool SameName(String *key, unsigned int hash, const Property &prop);
+
+        std::vector<Property> properties;
+        std::vector<Shape *> transitions;
+
+    };
+
+}
@@ -37,6 +37,7 @@ namespace halang {
         s_value = reinterpret_cast<char16_t *>(std::malloc(sizeof(char16_t) * (length + 1)));
         // s_value = new char16_t[length + 1];
         s_value[length] = u'\0';
+        GC::AddExternal(this, GetExternalSize());
 
         // calculate hash;
         _hash = 5381;
@@ -56,6 +57,7 @@ namespace halang {
             s_value[i] = _str[i];
 
         s_value[length] = u'\0';
+        GC::AddExternal(this, GetExternalSize());
 
         // calculate hash;
         _hash = 5381;
@@ -74,14 +76,15 @@ namespace halang {
 
         for (size_type i = 0; i < _str.length; ++i)
             s_value[i] = _str.s_value[i];
+        GC::AddExternal(this, GetExternalSize());
     }
 
     void SimpleString::ToU16String(std::u16string &str) {
         str = std::u16string(s_value);
     }
 
-    void SimpleString::Mark() {
-        marked = true;
+    std::size_t SimpleString::GetExternalSize() const {
+        return sizeof(char16_t) * (length + 1);
     }
 
     SimpleString::~SimpleString() {
@@ -145,12 +148,11 @@ namespace halang {
             return right->CharAt(index);
     }
 
-    void ConsString::Mark() {
-        marked = true;
+    void ConsString::Scan() {
         if (left != nullptr)
-            left->Mark();
+            GC::Shade(left);
         if (right != nullptr)
-            right->Mark();
+            GC::Shade(right);
     }
 
     void ConsString::ToU16String(std::u16string &str) {
@@ -208,9 +210,8 @@ namespace halang {
             str.push_back(this->CharAt(i));
     }
 
-    void SliceString::Mark() {
-        marked = true;
-        source->Mark();
+    void SliceString::Scan() {
+        GC::Shade(source);
     }
 
 };
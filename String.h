@@ -7,6 +7,7 @@
 #include <string>
 #include "object.h"
 #include "halang.h"
+#include "BigInt.h"
 
 namespace halang {
 
@@ -25,9 +26,7 @@ namespace halang {
 
         static String *Slice(String *, unsigned int begin, unsigned int end);
 
-        virtual void Mark() override {}
-
-        virtual Value toValue() override { return Value(this, TypeId::String); }
+        virtual void Scan() override {}
 
         virtual char16_t CharAt(unsigned int) const = 0;
 
@@ -41,6 +40,10 @@ namespace halang {
 
         virtual ~String() {}
 
+    protected:
+
+        String() : GCObject(TypeId::String) {}
+
     };
 
     class SimpleString : public String {
@@ -72,10 +75,10 @@ namespace halang {
 
         virtual unsigned int GetLength() const override;
 
-        virtual void Mark() override;
-
         virtual void ToU16String(std::u16string &) override;
 
+        virtual std::size_t GetExternalSize() const override;
+
     };
 
     class ConsString : public String {
@@ -108,7 +111,7 @@ namespace halang {
 
         virtual char16_t CharAt(unsigned int index) const override;
 
-        virtual void Mark() override;
+        virtual void Scan() override;
 
         virtual void ToU16String(std::u16string &) override;
 
@@ -142,7 +145,7 @@ namespace halang {
 
         virtual unsigned int GetHash() const override;
 
-        virtual void Mark() override;
+        virtual void Scan() override;
 
         virtual void ToU16String(std::u16string &) override;
 
@@ -164,15 +167,17 @@ namespace std {
     struct hash<Value> {
 
         unsigned int operator()(const Value &v) const {
-            switch (v.type) {
+            switch (v.GetType()) {
                 case TypeId::Null:
                     return 0;
                 case TypeId::SmallInt:
-                    return hash<TSmallInt>{}(v.value.si);
+                    return hash<TSmallInt>{}(v.AsSmallInt());
                 case TypeId::Number:
-                    return hash<TNumber>{}(v.value.number);
+                    return hash<TNumber>{}(v.AsNumber());
                 case TypeId::String:
-                    return reinterpret_cast<String *>(v.value.si)->GetHash();
+                    return reinterpret_cast<String *>(v.AsGC())->GetHash();
+                case TypeId::BigInt:
+                    return reinterpret_cast<BigInt *>(v.AsGC())->GetHash();
                 default:
                     throw std::runtime_error("do hash to wrong type");
                     return 0;
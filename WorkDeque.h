@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include "object.h"
+
+namespace halang {
+
+    /// <summary>
+    /// The gray objects of one thread of a parallel mark, a
+    /// Chase-Lev deque: the thread which owns it pushes and pops
+    /// at the bottom, the others steal from the top once they run
+    /// out of their own.
+    ///
+    /// A full buffer is replaced by one twice as big; the old ones
+    /// are kept until Reset, as a thief may still read them.
+    /// </summary>
+    class WorkDeque {
+    public:
+
+        WorkDeque() : top(0), bottom(0), buffer(new Buffer(INITIAL_SIZE)) {}
+
+        ~WorkDeque() {
+            Reset();
+            delete buffer.load(std::memory_order_relaxed);
+        }
+
+        WorkDeque(const WorkDeque &) = delete;
+
+        WorkDeque &operator=(const WorkDeque &) = delete;
+
+        // the owner only
+        inline void Push(GCObject *obj) {
+            long b = bottom.load(std::memory_order_relaxed);
+            long t = top.load(std::memory_order_acquire);
+            Buffer *a = buffer.load(std::memory_order_relaxed);
+            if (b - t >= static_cast<long>(a->size))
+                a = Grow(a, t, b);
+            a->Put(b, obj);
+            bottom.store(b + 1, std::memory_order_release);
+        }
+
+        // the owner only, nullptr if it is empty
+        inline GCObject *Pop() {
+            long b = bottom.load(std::memory_order_relaxed) - 1;
+            Buffer *a = buffer.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_seq_cst);
+            long t = top.load(std::memory_order_seq_cst);
+
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            GCObject *obj = a->Get(b);
+            if (t == b) {
+                // the last one, which a thief may be taking too
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed))
+                    obj = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return obj;
+        }
+
+        // any thread, nullptr if it is empty or another one was faster
+        inline GCObject *Steal() {
+            long t = top.load(std::memory_order_seq_cst);
+            long b = bottom.load(std::memory_order_seq_cst);
+            if (t >= b)
+                return nullptr;
+
+            GCObject *obj = buffer.load(std::memory_order_acquire)->Get(t);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+                return nullptr;
+            return obj;
+        }
+
+        inline bool Empty() const {
+            return top.load(std::memory_order_relaxed) >= bottom.load(std::memory_order_relaxed);
+        }
+
+        // when no other thread uses it
+        void Reset() {
+            for (auto i = retired.begin(); i != retired.end(); ++i)
+                delete *i;
+            retired.clear();
+            top.store(0, std::memory_order_relaxed);
+            bottom.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+
+        static const std::size_t INITIAL_SIZE = 1024;
+
+        struct Buffer {
+
+            // a power of two
+            std::size_t size;
+            std::atomic<GCObject *> *slots;
+
+            Buffer(std::size_t _size) : size(_size), slots(new std::atomic<GCObject *>[_size]) {}
+
+            ~Buffer() { delete[] slots; }
+
+            inline GCObject *Get(long i) const {
+                return slots[static_cast<std::size_t>(i) & (size - 1)].load(std::memory_order_relaxed);
+            }
+
+            inline void Put(long i, GCObject *obj) {
+                slots[static_cast<std::size_t>(i) & (size - 1)].store(obj, std::memory_order_relaxed);
+            }
+
+        };
+
+        Buffer *Grow(Buffer *a, long t, long b) {
+            Buffer *bigger = new Buffer(a->size * 2);
+            for (long i = t; i < b; ++i)
+                bigger->Put(i, a->Get(i));
+            retired.push_back(a);
+            buffer.store(bigger, std::memory_order_release);
+            return bigger;
+        }
+
+        std::atomic<long> top;
+        std::atomic<long> bottom;
+        std::atomic<Buffer *> buffer;
+        std::vector<Buffer *> retired;
+
+    };
+
+}
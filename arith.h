@@ -0,0 +1,218 @@
+#pragma once
+
+#include "halang.h"
+#include "object.h"
+#include "context.h"
+#include "BigInt.h"
+
+/// <summary>
+/// The binary operators that have a dedicated code in both
+/// machines, with the name of the method in the prototype
+/// they fall back to.
+/// </summary>
+#define ARITH_OPERATORS(V) \
+    V(ADD,      __ADD__) \
+    V(SUB,      __SUB__) \
+    V(MUL,      __MUL__) \
+    V(DIV,      __DIV__) \
+    V(MOD,      __MOD__) \
+    V(LT,       __LT__) \
+    V(GT,       __GT__) \
+    V(LTEQ,     __LTEQ__) \
+    V(GTEQ,     __GTEQ__) \
+    V(EQ,       __EQ__) \
+
+namespace halang {
+
+    /// <summary>
+    /// Inline paths of the operators for small int and number.
+    ///
+    /// Each one returns false when the operands must go through
+    /// the prototype instead: any other type, or a prototype of
+    /// small int or number that has been changed since the
+    /// Context initialized it.
+    /// </summary>
+    namespace arith {
+
+        inline bool ToNumbers(const Value &a, const Value &b, TNumber &x, TNumber &y) {
+            if (a.isSmallInt()) {
+                if (!Context::IsSmallIntPrototypeIntact())
+                    return false;
+                x = static_cast<TNumber>(a.AsSmallInt());
+            } else if (a.isNumber()) {
+                if (!Context::IsNumberPrototypeIntact())
+                    return false;
+                x = a.AsNumber();
+            } else
+                return false;
+
+            if (b.isSmallInt()) {
+                if (!Context::IsSmallIntPrototypeIntact())
+                    return false;
+                y = static_cast<TNumber>(b.AsSmallInt());
+            } else if (b.isNumber()) {
+                if (!Context::IsNumberPrototypeIntact())
+                    return false;
+                y = b.AsNumber();
+            } else
+                return false;
+
+            return true;
+        }
+
+        // a small int result that overflows is the BigInt the
+        // same operation gives, or a BigInt when Value cannot
+        // hold the small int
+        inline Value AddSmallInt(TSmallInt x, TSmallInt y) {
+            TSmallInt r;
+            if (__builtin_add_overflow(x, y, &r))
+                return BigInt::Add(BigInt::FromSmallInt(x), BigInt::FromSmallInt(y));
+            return BigInt::FromSmallInt(r);
+        }
+
+        inline Value SubSmallInt(TSmallInt x, TSmallInt y) {
+            TSmallInt r;
+            if (__builtin_sub_overflow(x, y, &r))
+                return BigInt::Sub(BigInt::FromSmallInt(x), BigInt::FromSmallInt(y));
+            return BigInt::FromSmallInt(r);
+        }
+
+        inline Value MulSmallInt(TSmallInt x, TSmallInt y) {
+            TSmallInt r;
+            if (__builtin_mul_overflow(x, y, &r))
+                return BigInt::Mul(BigInt::FromSmallInt(x), BigInt::FromSmallInt(y));
+            return BigInt::FromSmallInt(r);
+        }
+
+        // the smallest one over -1 is the only one that overflows
+        inline Value DivSmallInt(TSmallInt x, TSmallInt y) {
+            if (y == -1)
+                return SubSmallInt(0, x);
+            return BigInt::FromSmallInt(x / y);
+        }
+
+        inline Value ModSmallInt(TSmallInt x, TSmallInt y) {
+            if (y == -1)
+                return Value(static_cast<TSmallInt>(0));
+            return BigInt::FromSmallInt(x % y);
+        }
+
+        inline bool BothSmallInt(const Value &a, const Value &b) {
+            return a.isSmallInt() && b.isSmallInt() &&
+                   Context::IsSmallIntPrototypeIntact();
+        }
+
+        /// <summary>
+        /// The order of the small int "i" against the number "d",
+        /// exact where the cast of "i" to a number would round, as
+        /// it does above 2^53. False if "d" is NaN.
+        /// </summary>
+        inline bool CompareSmallInt(TSmallInt i, TNumber d, int &order) {
+            if (d != d)
+                return false;
+
+            // 2^63, which no small int reaches
+            if (d >= 9223372036854775808.0)
+                order = -1;
+            else if (d < -9223372036854775808.0)
+                order = 1;
+            else {
+                auto t = static_cast<TSmallInt>(d);
+                if (i != t)
+                    order = i < t ? -1 : 1;
+                else {
+                    // what the truncation took away decides
+                    TNumber frac = d - static_cast<TNumber>(t);
+                    order = frac > 0 ? -1 : frac < 0 ? 1 : 0;
+                }
+            }
+            return true;
+        }
+
+        // one small int and one number, "ordered" false for NaN
+        inline bool MixedOrder(const Value &a, const Value &b, bool &ordered, int &order) {
+            if (a.isSmallInt() && b.isNumber())
+                ordered = CompareSmallInt(a.AsSmallInt(), b.AsNumber(), order);
+            else if (a.isNumber() && b.isSmallInt()) {
+                ordered = CompareSmallInt(b.AsSmallInt(), a.AsNumber(), order);
+                order = -order;
+            } else
+                return false;
+            return true;
+        }
+
+        // a small int meets a number without the cast
+#define ARITH_COMPARE_PATH(NAME, OP) \
+        inline bool NAME(const Value &a, const Value &b, Value &result) { \
+            if (BothSmallInt(a, b)) { \
+                result = Value(a.AsSmallInt() OP b.AsSmallInt()); \
+                return true; \
+            } \
+            bool ordered; \
+            int order; \
+            if (MixedOrder(a, b, ordered, order)) { \
+                if (!Context::IsSmallIntPrototypeIntact() || !Context::IsNumberPrototypeIntact()) \
+                    return false; \
+                result = Value(ordered && order OP 0); \
+                return true; \
+            } \
+            TNumber x, y; \
+            if (!ToNumbers(a, b, x, y)) \
+                return false; \
+            result = Value(x OP y); \
+            return true; \
+        }
+
+        // small int stays small int unless it overflows, anything
+        // mixed with a number becomes a number
+#define ARITH_CHECKED_PATH(NAME, OP, INT) \
+        inline bool NAME(const Value &a, const Value &b, Value &result) { \
+            if (BothSmallInt(a, b)) { \
+                result = INT(a.AsSmallInt(), b.AsSmallInt()); \
+                return true; \
+            } \
+            TNumber x, y; \
+            if (!ToNumbers(a, b, x, y)) \
+                return false; \
+            result = Value(x OP y); \
+            return true; \
+        }
+
+        ARITH_CHECKED_PATH(ADD, +, AddSmallInt)
+        ARITH_CHECKED_PATH(SUB, -, SubSmallInt)
+        ARITH_CHECKED_PATH(MUL, *, MulSmallInt)
+        ARITH_COMPARE_PATH(LT, <)
+        ARITH_COMPARE_PATH(GT, >)
+        ARITH_COMPARE_PATH(LTEQ, <=)
+        ARITH_COMPARE_PATH(GTEQ, >=)
+        ARITH_COMPARE_PATH(EQ, ==)
+
+#undef ARITH_CHECKED_PATH
+#undef ARITH_COMPARE_PATH
+
+        inline bool DIV(const Value &a, const Value &b, Value &result) {
+            if (BothSmallInt(a, b)) {
+                // let the prototype decide what dividing by zero means
+                if (b.AsSmallInt() == 0)
+                    return false;
+                result = DivSmallInt(a.AsSmallInt(), b.AsSmallInt());
+                return true;
+            }
+            TNumber x, y;
+            if (!ToNumbers(a, b, x, y))
+                return false;
+            result = Value(x / y);
+            return true;
+        }
+
+        inline bool MOD(const Value &a, const Value &b, Value &result) {
+            if (BothSmallInt(a, b) && b.AsSmallInt() != 0) {
+                result = ModSmallInt(a.AsSmallInt(), b.AsSmallInt());
+                return true;
+            }
+            return false;
+        }
+
+    }
+
+}
@@ -21,6 +21,7 @@ namespace halang {
     V(BreakStatement) \
     V(ContinueStatement) \
     V(ReturnStatement) \
+    V(YieldStatement) \
     V(DefStatement) \
     V(MemberExpression) \
     V(CallExpression) \
@@ -80,6 +81,8 @@ namespace halang {
 
         virtual ReturnStatementNode *AsReturnStatement() { return nullptr; }
 
+        virtual YieldStatementNode *AsYieldStatement() { return nullptr; }
+
         virtual MemberExpressionNode *AsMemberExpression() { return nullptr; }
 
         virtual DefStatementNode *AsDefStatement() { return nullptr; }
@@ -257,6 +260,21 @@ namespace halang {
         VISIT_OVERRIDE
     };
 
+    class YieldStatementNode : public Node {
+    public:
+        YieldStatementNode(Node *exp = nullptr) : expression(exp) {}
+
+        virtual
+        YieldStatementNode *
+        AsYieldStatement() override {
+            return this;
+        }
+
+        Node *expression = nullptr;
+
+        VISIT_OVERRIDE
+    };
+
     class DefStatementNode : public Node {
     public:
 
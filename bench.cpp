@@ -0,0 +1,207 @@
+// bench.cpp : Array and Dict work timed with the Value of this build,
+// compare a default build with one made with NAN_BOXING=1, and a full
+// collection of a big heap on one thread and on all the cores. The fib
+// of examples/fib.ha times the dispatch of the interpreter, compare a
+// default build with one made with NO_THREADED_CODE=1.
+//
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include "svm.h"
+#include "context.h"
+#include "Array.h"
+#include "Dict.h"
+#include "String.h"
+#include "function.h"
+#include "jit.h"
+#include "trace.h"
+#include "builder.h"
+
+using namespace halang;
+
+typedef std::chrono::steady_clock Clock;
+
+static const unsigned int ARRAY_LENGTH = 1 << 20;
+static const unsigned int ARRAY_ROUNDS = 20;
+static const unsigned int DICT_KEYS = 1 << 12;
+static const unsigned int DICT_ROUNDS = 20;
+static const unsigned int RECORDS = 1 << 17;
+static const unsigned int RECORD_ROUNDS = 20;
+static const unsigned int GC_OBJECTS = 10000000;
+static const unsigned int GC_BUCKET = 4096;
+static const TSmallInt FIB_N = 30;
+
+static void Report(const char *name, Clock::time_point begin, double check) {
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    std::cout << std::left << std::setw(16) << name
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1) << ms << " ms"
+              << "    (" << std::setprecision(0) << check << ")" << std::endl;
+}
+
+// fill an array, then sum it over and over
+static void ArrayOfSmallInts() {
+    Array *arr = Context::GetGC()->NewPersistent<Array>();
+    auto begin = Clock::now();
+    for (unsigned int i = 0; i < ARRAY_LENGTH; ++i)
+        arr->Push(Value(static_cast<TSmallInt>(i & 0xff)));
+
+    double sum = 0;
+    for (unsigned int r = 0; r < ARRAY_ROUNDS; ++r)
+        for (unsigned int i = 0; i < ARRAY_LENGTH; ++i)
+            sum += arr->At(i).AsSmallInt();
+    Report("array int", begin, sum);
+}
+
+static void ArrayOfNumbers() {
+    Array *arr = Context::GetGC()->NewPersistent<Array>();
+    auto begin = Clock::now();
+    for (unsigned int i = 0; i < ARRAY_LENGTH; ++i)
+        arr->Push(Value(static_cast<TNumber>(i) * 0.5));
+
+    double sum = 0;
+    for (unsigned int r = 0; r < ARRAY_ROUNDS; ++r)
+        for (unsigned int i = 0; i < ARRAY_LENGTH; ++i) {
+            Value v = arr->At(i);
+            if (v.isNumber())
+                sum += v.AsNumber();
+        }
+    Report("array number", begin, sum);
+}
+
+// a dict in dictionary mode, keyed by small ints
+static void DictOfSmallInts() {
+    Dict *dict = Context::GetGC()->NewPersistent<Dict>();
+    auto begin = Clock::now();
+    for (unsigned int i = 0; i < DICT_KEYS; ++i)
+        dict->SetValue(Value(static_cast<TSmallInt>(i)), Value(static_cast<TSmallInt>(i & 0xff)));
+
+    double sum = 0;
+    for (unsigned int r = 0; r < DICT_ROUNDS; ++r)
+        for (unsigned int i = 0; i < DICT_KEYS; ++i)
+            sum += dict->GetValue(Value(static_cast<TSmallInt>(i))).AsSmallInt();
+    Report("dict int keys", begin, sum);
+}
+
+// many small dicts of one shape, as objects of a script are
+static void Records() {
+    Value x = String::FromCharArray("x")->toValue();
+    Value y = String::FromCharArray("y")->toValue();
+    Value z = String::FromCharArray("z")->toValue();
+
+    std::vector<Dict *> records;
+    records.reserve(RECORDS);
+
+    auto begin = Clock::now();
+    for (unsigned int i = 0; i < RECORDS; ++i) {
+        Dict *rec = Context::GetGC()->NewPersistent<Dict>();
+        rec->SetValue(x, Value(static_cast<TSmallInt>(i & 0xff)));
+        rec->SetValue(y, Value(0.5));
+        rec->SetValue(z, Value(true));
+        records.push_back(rec);
+    }
+
+    double sum = 0;
+    for (unsigned int r = 0; r < RECORD_ROUNDS; ++r)
+        for (auto i = records.begin(); i != records.end(); ++i)
+            sum += (*i)->GetValue(x).AsSmallInt() + (*i)->GetValue(y).AsNumber();
+    Report("dict records", begin, sum);
+}
+
+// fib(n) = n < 3 ? 1 : fib(n - 1) + fib(n - 2), in the interpreter
+// alone, so that every call and operator goes through the dispatch
+static void Fib(StackVM &vm) {
+    CodePackBuilder b;
+    b.AddParameter("n");
+    auto self = b.AddSelf();
+    b.Emit(VM_CODE::PUSH_INT, 3);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::LT);
+    auto branch = b.Emit(VM_CODE::IFNO);
+    b.Emit(VM_CODE::PUSH_INT, 1);
+    b.Emit(VM_CODE::RETURN, 1);
+    b.PatchJump(branch, b.Here());
+    b.Emit(VM_CODE::PUSH_INT, 2);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::SUB);
+    b.Emit(VM_CODE::PUSH_NULL);
+    b.Emit(VM_CODE::LOAD_C, self);
+    b.Emit(VM_CODE::CALL, 1);
+    b.Emit(VM_CODE::PUSH_INT, 1);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::SUB);
+    b.Emit(VM_CODE::PUSH_NULL);
+    b.Emit(VM_CODE::LOAD_C, self);
+    b.Emit(VM_CODE::CALL, 1);
+    b.Emit(VM_CODE::ADD);
+    b.Emit(VM_CODE::RETURN, 1);
+    Function *fib = b.Build();
+    Context::GetGC()->MakePersistent(fib);
+
+    Jit::SetEnabled(false);
+    Tracer::SetEnabled(false);
+    Value n(FIB_N);
+    Value *values = &n;
+    FunctionArgs args(values, 0, 1);
+
+    auto begin = Clock::now();
+    Value result = vm.CallFunction(fib, Value(), args);
+    Report(("fib " + std::to_string(FIB_N)).c_str(), begin, result.AsSmallInt());
+}
+
+// GC_OBJECTS arrays, every other one kept in a bucket of a persistent
+// array, then one full collection on "threads" threads
+static void FullCollection(unsigned int threads) {
+    GC *gc = Context::GetGC();
+    Array *keep = gc->NewPersistent<Array>();
+    Array *bucket = nullptr;
+    for (unsigned int i = 0; i < GC_OBJECTS; ++i) {
+        Array *arr = gc->New<Array>();
+        if (i % 2 != 0)
+            continue;
+        if (bucket == nullptr || bucket->GetLength() == GC_BUCKET) {
+            bucket = gc->New<Array>();
+            keep->Push(bucket->toValue());
+        }
+        bucket->Push(arr->toValue());
+    }
+
+    GC::SetThreadCount(threads);
+    auto begin = Clock::now();
+    gc->FullGC();
+    Report(("gc " + std::to_string(threads) + " thread" + (threads == 1 ? "" : "s")).c_str(),
+           begin, gc->GetHeapSize());
+    GC::SetThreadCount(1);
+
+    keep->Resize(0);
+    gc->FullGC();
+}
+
+int main() {
+    StackVM vm;
+
+#ifdef HALANG_NAN_BOXING
+    std::cout << "Value: NaN-boxed, ";
+#else
+    std::cout << "Value: tagged union, ";
+#endif
+    std::cout << sizeof(Value) << " bytes" << std::endl;
+#ifdef HALANG_THREADED_CODE
+    std::cout << "dispatch: computed goto" << std::endl;
+#else
+    std::cout << "dispatch: switch" << std::endl;
+#endif
+
+    ArrayOfSmallInts();
+    ArrayOfNumbers();
+    DictOfSmallInts();
+    Records();
+    Fib(vm);
+    FullCollection(1);
+    FullCollection(std::max(std::thread::hardware_concurrency(), 1u));
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdexcept>
+#include "builder.h"
+#include "function.h"
+#include "context.h"
+#include "GC.h"
+#include "String.h"
+
+namespace halang {
+
+    CodePackBuilder::size_type CodePackBuilder::AddVariable(const std::string &name) {
+        var_names.push_back(name);
+        return static_cast<size_type>(var_names.size()) - 1;
+    }
+
+    CodePackBuilder::size_type CodePackBuilder::AddParameter(const std::string &name) {
+        if (param_size != var_names.size())
+            throw std::logic_error("the parameters come before the other variables");
+        ++param_size;
+        return AddVariable(name);
+    }
+
+    CodePackBuilder::size_type CodePackBuilder::AddConstant(Value v) {
+        constants.push_back(v);
+        return static_cast<size_type>(constants.size()) - 1;
+    }
+
+    CodePackBuilder::size_type CodePackBuilder::AddSelf() {
+        auto index = AddConstant(Value());
+        selves.push_back(index);
+        return index;
+    }
+
+    CodePackBuilder::size_type CodePackBuilder::Emit(VM_CODE code, int param) {
+        instructions.push_back(Instruction(code, param));
+        return Here() - 1;
+    }
+
+    void CodePackBuilder::PatchJump(size_type index, size_type target) {
+        auto code = instructions[index].GetCode();
+        instructions[index] = Instruction(code, static_cast<int>(target) - static_cast<int>(index));
+    }
+
+    Function *CodePackBuilder::Build() {
+        auto gc = Context::GetGC();
+        auto cp = gc->New<CodePack>();
+        cp->name = nullptr;
+        cp->param_size = param_size;
+
+        cp->_instructions = new Instruction[instructions.size()];
+        cp->_instructions_size = 0;
+        for (auto i = instructions.begin(); i != instructions.end(); ++i)
+            cp->_instructions[cp->_instructions_size++] = *i;
+        cp->PrepareInlineCaches();
+        cp->PrepareFeedback();
+
+        cp->_constants = new Value[constants.size()]();
+        cp->_const_size = 0;
+        for (auto i = constants.begin(); i != constants.end(); ++i)
+            cp->_constants[cp->_const_size++] = *i;
+
+        cp->GenerateVarNamesArray(static_cast<size_type>(var_names.size()));
+        for (size_type i = 0; i < var_names.size(); ++i)
+            cp->SetVarName(i, String::FromStdString(var_names[i]));
+
+        // GC::New does not collect, so nothing has moved the pack
+        // to the old generation before it holds the function
+        auto fun = gc->New<Function>(cp);
+        for (auto i = selves.begin(); i != selves.end(); ++i)
+            cp->_constants[*i] = fun->toValue();
+        return fun;
+    }
+
+}
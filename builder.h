@@ -0,0 +1,59 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "object.h"
+#include "svm_codes.h"
+
+namespace halang {
+
+    class Function;
+
+    /// <summary>
+    /// Puts a function of the stack format together by hand, for
+    /// the tests and the benchmarks that leave the front end out.
+    ///
+    /// The instructions are emitted as CodeGen emits them, the
+    /// parameters are the first variables, and Build numbers the
+    /// DOT and operator sites as GenerateCodePack does.
+    /// </summary>
+    class CodePackBuilder {
+    public:
+
+        typedef unsigned int size_type;
+
+        CodePackBuilder() : param_size(0) {}
+
+        size_type AddVariable(const std::string &name);
+
+        // a parameter is a variable the caller gives
+        size_type AddParameter(const std::string &name);
+
+        size_type AddConstant(Value);
+
+        // a constant that will be the built function itself
+        size_type AddSelf();
+
+        // the index of the instruction
+        size_type Emit(VM_CODE, int param = 0);
+
+        inline size_type Here() const {
+            return static_cast<size_type>(instructions.size());
+        }
+
+        // point the jump at "index" to "target"
+        void PatchJump(size_type index, size_type target);
+
+        Function *Build();
+
+    private:
+
+        size_type param_size;
+        std::vector<std::string> var_names;
+        std::vector<Value> constants;
+        std::vector<size_type> selves;
+        std::vector<Instruction> instructions;
+
+    };
+
+}
@@ -3,6 +3,7 @@
 #include "String.h"
 #include "context.h"
 #include <string>
+#include <algorithm>
 #include "util.h"
 
 #define TEXT(T) String::FromCharArray(T)->toValue()
@@ -21,12 +22,18 @@ namespace halang {
         result->_var_names_size = state->_var_names_size;
         result->_max_entries_size = state->_max_entries_size;
 
+        result->format = state->format;
+        result->_register_top = state->_register_top;
+        result->_register_size = state->_register_size;
+        result->_generator = state->_generator;
+
         result->constant = state->constant;
         result->instructions = state->instructions;
+        result->rinstructions = state->rinstructions;
         return result;
     }
 
-    CodeGen::GenState *CodeGen::GenState::CreateNewState(GenState *state) {
+    CodeGen::GenState *CodeGen::GenState::CreateNewState(GenState *state, CodeFormat format) {
         auto result = new GenState();
         result->isNew = true;
         result->prev = state;
@@ -41,8 +48,14 @@ namespace halang {
         result->_max_entries_size = new unsigned int(0);
         result->_var_names_size = 0;
 
+        result->format = state != nullptr ? state->format : format;
+        result->_register_top = new unsigned int(0);
+        result->_register_size = new unsigned int(0);
+        result->_generator = new bool(false);
+
         result->constant = new std::vector<Value>();
         result->instructions = new std::vector<Instruction>();
+        result->rinstructions = new std::vector<RInstruction>();
         return result;
     }
 
@@ -85,6 +98,14 @@ namespace halang {
         return (*_max_entries_size)++;
     }
 
+    CodeGen::GenState::size_type
+    CodeGen::GenState::AllocRegister() {
+        auto reg = std::max(*_register_top, *_max_entries_size);
+        *_register_top = reg + 1;
+        *_register_size = std::max(*_register_size, reg + 1);
+        return reg;
+    }
+
     CodeGen::GenState::size_type
     CodeGen::GenState::size() {
         return _var_names_size;
@@ -113,8 +134,12 @@ namespace halang {
             delete upvalue_names;
             delete require_upvalues;
             delete _max_entries_size;
+            delete _register_top;
+            delete _register_size;
+            delete _generator;
             delete constant;
             delete instructions;
+            delete rinstructions;
         }
     }
 
@@ -123,6 +148,8 @@ namespace halang {
             throw std::logic_error("You can only generate new code pack");
 
         auto cp = Context::GetGC()->New<CodePack>();
+        cp->format = gs->GetFormat();
+        cp->is_generator = gs->IsGenerator();
 
         // copy instructions
         auto needed_size = gs->GetInstructionVector()->size();
@@ -131,6 +158,19 @@ namespace halang {
         for (auto i = gs->GetInstructionVector()->begin();
              i != gs->GetInstructionVector()->end(); ++i)
             cp->_instructions[cp->_instructions_size++] = *i;
+        cp->PrepareInlineCaches();
+        cp->PrepareFeedback();
+
+        // copy register instructions
+        needed_size = gs->GetRInstructionVector()->size();
+        if (needed_size > 0) {
+            cp->_rinstructions = new RInstruction[needed_size];
+            cp->_rinstructions_size = 0;
+            for (auto i = gs->GetRInstructionVector()->begin();
+                 i != gs->GetRInstructionVector()->end(); ++i)
+                cp->_rinstructions[cp->_rinstructions_size++] = *i;
+        }
+        cp->_register_size = gs->RegisterSize();
 
         // copy require_upvalues;
         needed_size = gs->GetRequireUpvaluesVector()->size();
@@ -207,8 +247,9 @@ namespace halang {
         return VarType(VarType::TYPE::NONE);
     }
 
-    CodeGen::CodeGen(StackVM *_vm) :
-            vm(_vm), parser(nullptr), name(nullptr) {
+    CodeGen::CodeGen(StackVM *_vm, CodeFormat _format) :
+            vm(_vm), parser(nullptr), name(nullptr),
+            format(_format), _target(-1) {
         auto new_state = GenerateDefaultState();
         state = new_state;
 
@@ -216,25 +257,129 @@ namespace halang {
     }
 
     CodeGen::GenState *CodeGen::GenerateDefaultState() {
-        auto state = GenState::CreateNewState();
-        auto _print_fun_ = Context::GetGC()->New<Function>(Context::_print_);
-        auto _fun_id = state->AddConstant(_print_fun_->toValue());
-
-        auto var_id = state->AddVariable(u"print");
-        state->AddInstruction(VM_CODE::LOAD_C, _fun_id);
-        state->AddInstruction(VM_CODE::STORE_V, var_id);
+        auto state = GenState::CreateNewState(nullptr, format);
+        static const struct {
+            const char16_t *name;
+            Value (*fun)(Value, FunctionArgs &);
+        } _builtins_[] = {
+            {u"print", Context::_print_},
+            {u"bigint", Context::_bigint_},
+        };
+
+        for (auto &builtin : _builtins_) {
+            auto _fun_ = Context::GetGC()->New<Function>(builtin.fun);
+            auto _fun_id = state->AddConstant(_fun_->toValue());
+
+            auto var_id = state->AddVariable(builtin.name);
+            if (format == CodeFormat::Register)
+                state->AddRInstruction(RInstruction::ABx(RVM_CODE::LOADK, var_id, _fun_id));
+            else {
+                state->AddInstruction(VM_CODE::LOAD_C, _fun_id);
+                state->AddInstruction(VM_CODE::STORE_V, var_id);
+            }
+        }
         return state;
     }
 
-    void CodeGen::AddInst(Instruction inst) {
-        state->AddInstruction(inst);
+    void CodeGen::AddInst(VM_CODE code, long long param) {
+        state->AddInstruction(code, param);
+    }
+
+    void CodeGen::AddRInst(RInstruction inst) {
+        state->AddRInstruction(inst);
+    }
+
+    int CodeGen::NewRegister() {
+        int reg = state->AllocRegister();
+        if (reg > RInstruction::MAX_REGISTER)
+            ReportError("<CodeGen>Too many registers in one function.");
+        return reg;
+    }
+
+    /// <summary>
+    /// The register to put the value of current expression.
+    /// A temporary is allocated if the value is unused.
+    /// </summary>
+    int CodeGen::Target() {
+        return _target >= 0 ? _target : NewRegister();
+    }
+
+    /// <summary>
+    /// Generate the expression in register format and return
+    /// the register contains its value.
+    ///
+    /// A local variable is used in place when no target is given.
+    /// </summary>
+    int CodeGen::ToRegister(Node *_node, int target) {
+        if (target < 0) {
+            auto _id_node = dynamic_cast<IdentifierNode *>(_node);
+            if (_id_node != nullptr) {
+                auto _var = FindVar(state, _id_node->name);
+                if (_var.type() == VarType::TYPE::LOCAL)
+                    return _var.id();
+            }
+            target = NewRegister();
+        }
+
+        auto _prev_target = _target;
+        _target = target;
+        Visit(_node);
+        _target = _prev_target;
+        return target;
+    }
+
+    /// <summary>
+    /// Literals are encoded in the instruction as constants,
+    /// the others are generated to registers.
+    /// </summary>
+    int CodeGen::ToRK(Node *_node) {
+        auto _num_node = dynamic_cast<NumberNode *>(_node);
+        if (_num_node != nullptr) {
+            if (_num_node->maybeInt)
+                return ConstantToRK(state->AddConstant(
+                        Value(static_cast<TSmallInt>(_num_node->number))));
+            return ConstantToRK(state->AddConstant(Value(_num_node->number)));
+        }
+
+        auto _str_node = dynamic_cast<StringNode *>(_node);
+        if (_str_node != nullptr)
+            return ConstantToRK(state->AddConstant(
+                    Value(String::FromU16String(_str_node->content), TypeId::String)));
+
+        int reg = ToRegister(_node);
+        if (reg > RInstruction::MAX_REGISTER)
+            ReportError("<CodeGen>Too many registers in one function.");
+        return reg;
+    }
+
+    int CodeGen::ConstantToRK(int const_id) {
+        if (const_id <= RInstruction::MAX_REGISTER)
+            return const_id | RInstruction::RK_CONSTANT;
+
+        int reg = NewRegister();
+        AddRInst(RInstruction::ABx(RVM_CODE::LOADK, reg, const_id));
+        return reg;
+    }
+
+    /// <summary>
+    /// Make the jump instruction at "loc" jump to "dest".
+    /// </summary>
+    void CodeGen::PatchRJump(unsigned int loc, unsigned int dest) {
+        auto &inst = (*state->GetRInstructionVector())[loc];
+        int offset = static_cast<int>(dest) - static_cast<int>(loc);
+        if (offset > RInstruction::MAX_SBX || offset < -RInstruction::MAX_SBX)
+            ReportError("<CodeGen>Jump is too long.");
+        inst = RInstruction::ABx(inst.GetCode(), inst.GetA(), offset);
     }
 
     Function *CodeGen::generate(Parser *p) {
         parser = p;
 
         Visit(parser->getRoot());
-        AddInst(Instruction(VM_CODE::STOP, 0));
+        if (format == CodeFormat::Register)
+            AddRInst(RInstruction(RVM_CODE::RETURN, 0, 0));
+        else
+            AddInst(VM_CODE::STOP, 0);
 
         return Context::GetGC()->New<Function>(GenState::GenerateCodePack(state));
     }
@@ -244,6 +389,18 @@ namespace halang {
     }
 
     void CodeGen::Visit(BlockExprNode *_node) {
+        if (format == CodeFormat::Register) {
+            auto _prev_target = _target;
+            for (auto i = _node->children.begin(); i != _node->children.end(); ++i) {
+                auto _top = state->RegisterTop();
+                _target = -1;
+                (*i)->Visit(this);
+                state->FreeRegisters(_top);
+            }
+            _target = _prev_target;
+            return;
+        }
+
         for (auto i = _node->children.begin(); i != _node->children.end(); ++i) {
             (*i)->Visit(this);
 
@@ -252,7 +409,7 @@ namespace halang {
                 (*i)->asBinaryExpression() ||
                 (*i)->asIdentifier() ||
                 (*i)->asNumber())
-                AddInst(Instruction(VM_CODE::OUT, 0));
+                AddInst(VM_CODE::OUT, 0);
         }
     }
 
@@ -261,119 +418,148 @@ namespace halang {
     }
 
     void CodeGen::Visit(InvokeExprNode *_node) {
+        if (format == CodeFormat::Register) {
+            int t = Target();
+            auto _top = state->RegisterTop();
+            int src = ToRK(_node->source);
+            int key = ConstantToRK(state->AddConstant(
+                    String::FromU16String(_node->id->name)->toValue()));
+            AddRInst(RInstruction(RVM_CODE::GETPROP, t, src, key));
+            state->FreeRegisters(_top);
+            return;
+        }
+
         Visit(_node->source);
         auto _name_id = state->AddConstant(
                 String::FromU16String(_node->id->name)->toValue());
-        AddInst(Instruction(VM_CODE::LOAD_C, _name_id));
-        AddInst(Instruction(VM_CODE::DOT, 0));
+        AddInst(VM_CODE::LOAD_C, _name_id);
+        AddInst(VM_CODE::DOT, 0);
     }
 
     void CodeGen::Visit(UnaryExprNode *_node) {
+        if (format == CodeFormat::Register) {
+            int t = Target();
+            auto _top = state->RegisterTop();
+            int b = ToRK(_node->child);
+            switch (_node->op) {
+                case OperatorType::SUB:
+                    AddRInst(RInstruction(RVM_CODE::NEG, t, b));
+                    break;
+                case OperatorType::NOT:
+                    AddRInst(RInstruction(RVM_CODE::NOT, t, b));
+                    break;
+                default:
+                    AddRInst(RInstruction(RVM_CODE::LOADNIL, t));
+            }
+            state->FreeRegisters(_top);
+            return;
+        }
+
         Visit(_node->child);
         unsigned int id;
         switch (_node->op) {
             case OperatorType::SUB:
                 id = state->AddConstant(Context::StringBuffer::__REVERSE__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 0));
+                AddInst(VM_CODE::LOAD_C, id);
+                AddInst(VM_CODE::DOT, 0);
+                AddInst(VM_CODE::CALL, 0);
                 break;
             case OperatorType::NOT:
                 id = state->AddConstant(Context::StringBuffer::__NOT__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 0));
+                AddInst(VM_CODE::LOAD_C, id);
+                AddInst(VM_CODE::DOT, 0);
+                AddInst(VM_CODE::CALL, 0);
                 break;
         }
     }
 
     void CodeGen::Visit(BinaryExprNode *_node) {
+        if (format == CodeFormat::Register) {
+            int t = Target();
+            auto _top = state->RegisterTop();
+            int c = ToRK(_node->right);
+            int b = ToRK(_node->left);
+
+            RVM_CODE code;
+            switch (_node->op) {
+                case OperatorType::ADD: code = RVM_CODE::ADD; break;
+                case OperatorType::SUB: code = RVM_CODE::SUB; break;
+                case OperatorType::MUL: code = RVM_CODE::MUL; break;
+                case OperatorType::DIV: code = RVM_CODE::DIV; break;
+                case OperatorType::MOD: code = RVM_CODE::MOD; break;
+                case OperatorType::POW: code = RVM_CODE::POW; break;
+                case OperatorType::GT: code = RVM_CODE::GT; break;
+                case OperatorType::LT: code = RVM_CODE::LT; break;
+                case OperatorType::GTEQ: code = RVM_CODE::GTEQ; break;
+                case OperatorType::LTEQ: code = RVM_CODE::LTEQ; break;
+                case OperatorType::EQ: code = RVM_CODE::EQ; break;
+                case OperatorType::AND: code = RVM_CODE::AND; break;
+                case OperatorType::OR: code = RVM_CODE::OR; break;
+                default:
+                    // runtime error
+                    code = RVM_CODE::LOADNIL;
+            }
+            AddRInst(RInstruction(code, t, b, c));
+            state->FreeRegisters(_top);
+            return;
+        }
+
         Visit(_node->right);
         Visit(_node->left);
 
         unsigned int id;
         switch (_node->op) {
             case OperatorType::ADD:
-                id = state->AddConstant(Context::StringBuffer::__ADD__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::ADD, 0);
                 break;
             case OperatorType::SUB:
-                id = state->AddConstant(Context::StringBuffer::__SUB__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::SUB, 0);
                 break;
             case OperatorType::MUL:
-                id = state->AddConstant(Context::StringBuffer::__MUL__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::MUL, 0);
                 break;
             case OperatorType::DIV:
-                id = state->AddConstant(Context::StringBuffer::__DIV__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::DIV, 0);
                 break;
             case OperatorType::MOD:
-                id = state->AddConstant(Context::StringBuffer::__MOD__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::MOD, 0);
                 break;
             case OperatorType::POW:
-                id = state->AddConstant(TEXT("__pow__"));
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                id = state->AddConstant(Context::StringBuffer::__POW__->toValue());
+                AddInst(VM_CODE::LOAD_C, id);
+                AddInst(VM_CODE::DOT, 0);
+                AddInst(VM_CODE::CALL, 1);
                 break;
             case OperatorType::GT:
-                id = state->AddConstant(Context::StringBuffer::__GT__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::GT, 0);
                 break;
             case OperatorType::LT:
-                id = state->AddConstant(Context::StringBuffer::__LT__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::LT, 0);
                 break;
             case OperatorType::GTEQ:
-                id = state->AddConstant(Context::StringBuffer::__GTEQ__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::GTEQ, 0);
                 break;
             case OperatorType::LTEQ:
-                id = state->AddConstant(Context::StringBuffer::__LTEQ__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::LTEQ, 0);
                 break;
             case OperatorType::EQ:
-                id = state->AddConstant(Context::StringBuffer::__EQ__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::EQ, 0);
                 break;
             case OperatorType::AND:
                 id = state->AddConstant(Context::StringBuffer::__AND__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::LOAD_C, id);
+                AddInst(VM_CODE::DOT, 0);
+                AddInst(VM_CODE::CALL, 1);
                 break;
             case OperatorType::OR:
                 id = state->AddConstant(Context::StringBuffer::__OR__->toValue());
-                AddInst(Instruction(VM_CODE::LOAD_C, id));
-                AddInst(Instruction(VM_CODE::DOT, 0));
-                AddInst(Instruction(VM_CODE::CALL, 1));
+                AddInst(VM_CODE::LOAD_C, id);
+                AddInst(VM_CODE::DOT, 0);
+                AddInst(VM_CODE::CALL, 1);
                 break;
             default:
                 // runtime error
-                AddInst(Instruction(VM_CODE::POP, 0));
+                AddInst(VM_CODE::POP, 0);
                 // pack.instructions.push_back(Instruction(VM_CODE::POP, 0));
         }
     }
@@ -381,33 +567,64 @@ namespace halang {
     void CodeGen::Visit(NumberNode *_node) {
         unsigned int index;
 
-        if (_node->maybeInt)
+        // an integer out of the range of small int stays a number
+        if (_node->maybeInt && _node->number >= -9223372036854775808.0 &&
+            _node->number < 9223372036854775808.0)
             index = state->AddConstant(Value(static_cast<TSmallInt>(_node->number)));
         else
             index = state->AddConstant(Value(_node->number));
 
-        AddInst(Instruction(VM_CODE::LOAD_C, index));
+        if (format == CodeFormat::Register) {
+            if (_target >= 0)
+                AddRInst(RInstruction::ABx(RVM_CODE::LOADK, _target, index));
+            return;
+        }
+
+        AddInst(VM_CODE::LOAD_C, index);
     }
 
     void CodeGen::Visit(StringNode *_node) {
         auto index = state->AddConstant(
                 Value(String::FromU16String(_node->content), TypeId::String));
 
-        AddInst(Instruction(VM_CODE::LOAD_C, index));
+        if (format == CodeFormat::Register) {
+            if (_target >= 0)
+                AddRInst(RInstruction::ABx(RVM_CODE::LOADK, _target, index));
+            return;
+        }
+
+        AddInst(VM_CODE::LOAD_C, index);
     }
 
     void CodeGen::Visit(IdentifierNode *_node) {
         auto _var = FindVar(state, _node->name);
 
+        if (format == CodeFormat::Register) {
+            if (_target < 0)
+                return;
+            switch (_var.type()) {
+                case VarType::TYPE::LOCAL:
+                    if (_var.id() != _target)
+                        AddRInst(RInstruction(RVM_CODE::MOVE, _target, _var.id()));
+                    break;
+                case VarType::TYPE::UPVAL:
+                    AddRInst(RInstruction(RVM_CODE::GETUPVAL, _target, _var.id()));
+                    break;
+                default:
+                    AddRInst(RInstruction(RVM_CODE::LOADNIL, _target));
+            }
+            return;
+        }
+
         switch (_var.type()) {
             case VarType::TYPE::GLOBAL:
-                AddInst(Instruction(VM_CODE::LOAD_G, _var.id()));
+                AddInst(VM_CODE::LOAD_G, _var.id());
                 break;
             case VarType::TYPE::LOCAL:
-                AddInst(Instruction(VM_CODE::LOAD_V, _var.id()));
+                AddInst(VM_CODE::LOAD_V, _var.id());
                 break;
             case VarType::TYPE::UPVAL:
-                AddInst(Instruction(VM_CODE::LOAD_UPVAL, _var.id()));
+                AddInst(VM_CODE::LOAD_UPVAL, _var.id());
                 break;
             case VarType::TYPE::NONE:
                 // ReportError(std::u16string(u"<Identifier>Variables not found: ") + utils::utf8_to_utf16(_node->name));
@@ -423,21 +640,46 @@ namespace halang {
         auto _var = FindVar(state, _id_node->name);
 
         int _id;
+        if (format == CodeFormat::Register) {
+            int reg = -1;
+            switch (_var.type()) {
+                case VarType::TYPE::LOCAL:
+                    reg = ToRegister(_node->expression, _var.id());
+                    break;
+                case VarType::TYPE::UPVAL:
+                    reg = ToRegister(_node->expression);
+                    AddRInst(RInstruction(RVM_CODE::SETUPVAL, reg, _var.id()));
+                    break;
+                case VarType::TYPE::GLOBAL:
+                    reg = ToRegister(_node->expression, Target());
+                    break;
+                case VarType::TYPE::NONE:
+                    if (_var_statement) {
+                        _id = state->AddVariable(_id_node->name);
+                        reg = ToRegister(_node->expression, _id);
+                    }
+                    break;
+            }
+            if (reg >= 0 && _target >= 0 && _target != reg)
+                AddRInst(RInstruction(RVM_CODE::MOVE, _target, reg));
+            return;
+        }
+
         switch (_var.type()) {
             case VarType::TYPE::GLOBAL:
                 Visit(_node->expression);
-                AddInst(Instruction(VM_CODE::STORE_G, _var.id()));
-                AddInst(Instruction(VM_CODE::LOAD_G, _var.id()));
+                AddInst(VM_CODE::STORE_G, _var.id());
+                AddInst(VM_CODE::LOAD_G, _var.id());
                 break;
             case VarType::TYPE::LOCAL:
                 Visit(_node->expression);
-                AddInst(Instruction(VM_CODE::STORE_V, _var.id()));
-                AddInst(Instruction(VM_CODE::LOAD_V, _var.id()));
+                AddInst(VM_CODE::STORE_V, _var.id());
+                AddInst(VM_CODE::LOAD_V, _var.id());
                 break;
             case VarType::TYPE::UPVAL:
                 Visit(_node->expression);
-                AddInst(Instruction(VM_CODE::STORE_UPVAL, _var.id()));
-                AddInst(Instruction(VM_CODE::LOAD_UPVAL, _var.id()));
+                AddInst(VM_CODE::STORE_UPVAL, _var.id());
+                AddInst(VM_CODE::LOAD_UPVAL, _var.id());
                 break;
             case VarType::TYPE::NONE:
                 if (_var_statement) {
@@ -446,8 +688,8 @@ namespace halang {
                     // you must add the name first and then Visit the expression.
                     // to generate the next code
                     Visit(_node->expression);
-                    AddInst(Instruction(VM_CODE::STORE_V, _id));
-                    AddInst(Instruction(VM_CODE::LOAD_V, _id));
+                    AddInst(VM_CODE::STORE_V, _id);
+                    AddInst(VM_CODE::LOAD_V, _id);
                 } else {
                     // i don't know how to fix it, fuck you.
                     // ReportError(std::u16string(u"<Assignment>Identifier not found: ") + _id_node->name);
@@ -468,11 +710,17 @@ namespace halang {
         auto _id_node = _node->varName;
         int _id = state->AddVariable(_id_node->name);
 
+        if (format == CodeFormat::Register) {
+            if (_node->expression)
+                ToRegister(_node->expression, _id);
+            return;
+        }
+
         // you must add the name first and then Visit the expression.
         // to generate the next code
         if (_node->expression) {
             Visit(_node->expression);
-            AddInst(Instruction(VM_CODE::STORE_V, _id));
+            AddInst(VM_CODE::STORE_V, _id);
         }
 
     }
@@ -481,19 +729,41 @@ namespace halang {
         auto new_state = GenState::CreateEqualState(state);
         state = new_state;
 
-        int jmp_val;
+        if (format == CodeFormat::Register) {
+            auto _prev_target = _target;
+            auto _top = state->RegisterTop();
+            int cond = ToRegister(_node->condition);
+            state->FreeRegisters(_top);
+
+            auto jmp_loc = state->AddRInstruction(RInstruction::ABx(RVM_CODE::TEST, cond, 1));
+            _target = -1;
+            Visit(_node->true_branch);
+            auto true_finish_loc = state->AddRInstruction(RInstruction::ABx(RVM_CODE::JMP, 0, 1));
+            // if condition not ture, jmp to the right location
+            PatchRJump(jmp_loc, state->GetRInstructionVector()->size());
+            if (_node->false_branch) {
+                Visit(_node->false_branch);
+                PatchRJump(true_finish_loc, state->GetRInstructionVector()->size());
+            }
+            _target = _prev_target;
+
+            state = state->GetPrevState();
+            delete new_state;
+            return;
+        }
+
+        long long jmp_val;
         Visit(_node->condition);
         auto jmp_loc = state->AddInstruction(VM_CODE::IFNO, 1);
         Visit(_node->true_branch);
         auto true_finish_loc = state->AddInstruction(VM_CODE::JMP, 1);
         // if condition not ture, jmp to the right location
-        jmp_val = state->GetInstructionVector()->size() - jmp_loc;
-        (*state->GetInstructionVector())[jmp_loc] = Instruction(VM_CODE::IFNO, jmp_val);
+        jmp_val = static_cast<long long>(state->GetInstructionVector()->size()) - jmp_loc;
+        state->SetInstruction(jmp_loc, VM_CODE::IFNO, jmp_val);
         if (_node->false_branch) {
             Visit(_node->false_branch);
-            jmp_val = state->GetInstructionVector()->size() - true_finish_loc;
-            (*state->GetInstructionVector())[true_finish_loc] =
-                    Instruction(VM_CODE::JMP, jmp_val);
+            jmp_val = static_cast<long long>(state->GetInstructionVector()->size()) - true_finish_loc;
+            state->SetInstruction(true_finish_loc, VM_CODE::JMP, jmp_val);
         }
 
         state = state->GetPrevState();
@@ -511,25 +781,42 @@ namespace halang {
         _break_loc = -1;
         this->_continue_loc = -1;
 
-        auto _begin_loc = state->GetInstructionVector()->size();
-        Visit(_node->condition);
-        auto _condition_loc = state->GetInstructionVector()->size();
-        state->AddInstruction(VM_CODE::IFNO, 0);
-        Visit(_node->child);
-        state->AddInstruction(VM_CODE::JMP, -1 *
-                                            (state->GetInstructionVector()->size() - _begin_loc));
-        (*state->GetInstructionVector())[_condition_loc] =
-                Instruction(VM_CODE::IFNO,
-                            state->GetInstructionVector()->size() - _condition_loc);
-
-        if (_break_loc >= 0)
-            (*state->GetInstructionVector())[_break_loc] =
-                    Instruction(VM_CODE::JMP,
-                                state->GetInstructionVector()->size() - _break_loc);
-        if (this->_continue_loc >= 0)
-            (*state->GetInstructionVector())[this->_continue_loc] =
-                    Instruction(VM_CODE::JMP,
-                                _begin_loc - this->_continue_loc);
+        if (format == CodeFormat::Register) {
+            auto _prev_target = _target;
+            auto _begin_loc = state->GetRInstructionVector()->size();
+            auto _top = state->RegisterTop();
+            int cond = ToRegister(_node->condition);
+            state->FreeRegisters(_top);
+
+            auto _condition_loc = state->AddRInstruction(RInstruction::ABx(RVM_CODE::TEST, cond, 0));
+            _target = -1;
+            Visit(_node->child);
+            auto _back_loc = state->AddRInstruction(RInstruction::ABx(RVM_CODE::JMP, 0, 0));
+            PatchRJump(_back_loc, _begin_loc);
+            PatchRJump(_condition_loc, state->GetRInstructionVector()->size());
+
+            if (_break_loc >= 0)
+                PatchRJump(_break_loc, state->GetRInstructionVector()->size());
+            if (this->_continue_loc >= 0)
+                PatchRJump(this->_continue_loc, _begin_loc);
+            _target = _prev_target;
+        } else {
+            long long _begin_loc = state->GetInstructionVector()->size();
+            Visit(_node->condition);
+            auto _condition_loc = state->AddInstruction(VM_CODE::IFNO, 0);
+            Visit(_node->child);
+            state->AddInstruction(VM_CODE::JMP, -1 *
+                                                (static_cast<long long>(state->GetInstructionVector()->size()) - _begin_loc));
+            state->SetInstruction(_condition_loc, VM_CODE::IFNO,
+                                  static_cast<long long>(state->GetInstructionVector()->size()) - _condition_loc);
+
+            if (_break_loc >= 0)
+                state->SetInstruction(_break_loc, VM_CODE::JMP,
+                                      static_cast<long long>(state->GetInstructionVector()->size()) - _break_loc);
+            if (this->_continue_loc >= 0)
+                state->SetInstruction(this->_continue_loc, VM_CODE::JMP,
+                                      _begin_loc - this->_continue_loc);
+        }
 
         _break_loc = _def_break_loc;
         _continue_loc = _def_continue_loc;
@@ -542,21 +829,58 @@ namespace halang {
     void CodeGen::Visit(BreakStmtNode *_node) {
         if (!_while_statement)
             throw std::logic_error("You should place \"break\" in while statment.");
-        _break_loc = state->AddInstruction(VM_CODE::JMP, 0);
+        if (format == CodeFormat::Register)
+            _break_loc = state->AddRInstruction(RInstruction::ABx(RVM_CODE::JMP, 0, 0));
+        else
+            _break_loc = state->AddInstruction(VM_CODE::JMP, 0);
     }
 
     void CodeGen::Visit(ContinueStmtNode *_node) {
         if (!_while_statement)
             throw std::logic_error("You should place \"continue\" in while statment.");
-        _continue_loc = state->AddInstruction(VM_CODE::JMP, 0);
+        if (format == CodeFormat::Register)
+            _continue_loc = state->AddRInstruction(RInstruction::ABx(RVM_CODE::JMP, 0, 0));
+        else
+            _continue_loc = state->AddInstruction(VM_CODE::JMP, 0);
     }
 
     void CodeGen::Visit(ReturnStmtNode *_node) {
+        if (format == CodeFormat::Register) {
+            if (_node->expression) {
+                int reg = ToRegister(_node->expression);
+                AddRInst(RInstruction(RVM_CODE::RETURN, reg, 1));
+            } else
+                AddRInst(RInstruction(RVM_CODE::RETURN, 0, 0));
+            return;
+        }
+
+        if (_node->expression) {
+            // "return f(...)" needs nothing of this frame after the
+            // call, so the callee takes the frame over
+            auto _call = dynamic_cast<CallExpressionNode *>(_node->expression);
+            if (_call != nullptr) {
+                GenerateCall(_call, VM_CODE::TAIL_CALL);
+                return;
+            }
+
+            Visit(_node->expression);
+            AddInst(VM_CODE::RETURN, 1);
+        } else
+            AddInst(VM_CODE::RETURN, 0);
+    }
+
+    void CodeGen::Visit(YieldStatementNode *_node) {
+        if (format == CodeFormat::Register)
+            throw std::logic_error("\"yield\" is only supported by the stack VM.");
+        if (state->GetFather() == nullptr)
+            throw std::logic_error("You should place \"yield\" in function.");
+
+        state->SetGenerator();
         if (_node->expression) {
             Visit(_node->expression);
-            AddInst(Instruction(VM_CODE::RETURN, 1));
+            AddInst(VM_CODE::YIELD, 1);
         } else
-            AddInst(Instruction(VM_CODE::RETURN, 0));
+            AddInst(VM_CODE::YIELD, 0);
     }
 
     void CodeGen::Visit(ClassDefNode *_node) {
@@ -577,8 +901,14 @@ namespace halang {
              i != _node->parameters.end(); ++i)
             Visit(*i);
 
+        auto _prev_target = _target;
+        _target = -1;
         Visit(_node->block);
-        AddInst(Instruction(VM_CODE::RETURN, 0));
+        _target = _prev_target;
+        if (format == CodeFormat::Register)
+            AddRInst(RInstruction(RVM_CODE::RETURN, 0, 0));
+        else
+            AddInst(VM_CODE::RETURN, 0);
 
         state = new_state->GetPrevState();
 
@@ -587,25 +917,74 @@ namespace halang {
         delete new_state;
 
         int const_id = state->AddConstant(new_fun->toValue());
-        AddInst(Instruction(VM_CODE::LOAD_C, const_id));
-        AddInst(Instruction(VM_CODE::CLOSURE, 0));
+        if (format == CodeFormat::Register) {
+            int t = var_id >= 0 ? var_id : Target();
+            AddRInst(RInstruction::ABx(RVM_CODE::CLOSURE, t, const_id));
+            if (_target >= 0 && _target != t)
+                AddRInst(RInstruction(RVM_CODE::MOVE, _target, t));
+            return;
+        }
+
+        AddInst(VM_CODE::LOAD_C, const_id);
+        AddInst(VM_CODE::CLOSURE, 0);
 
         if (var_id >= 0)
-            AddInst(Instruction(VM_CODE::STORE_V, var_id));
+            AddInst(VM_CODE::STORE_V, var_id);
     }
 
     void CodeGen::Visit(FuncDefParamNode *_node) {
         state->AddVariable(_node->name);
     }
 
-    void CodeGen::Visit(FuncCallNode *_node) {
-        for (auto i = _node->parameters.begin();
-             i != _node->parameters.end(); ++i)
+    void CodeGen::Visit(CallExpressionNode *_node) {
+        if (format == CodeFormat::Register) {
+            int t = _target;
+            auto _top = state->RegisterTop();
+
+            // R(base): function, R(base + 1): this, and then the arguments.
+            // a fresh temporary target can be the base itself.
+            int base;
+            if (t >= 0 && t == static_cast<int>(_top) - 1 &&
+                t >= static_cast<int>(state->MaxVarNamesSize()))
+                base = t;
+            else
+                base = NewRegister();
+            NewRegister();
+            for (unsigned int i = 0; i < _node->params.size(); ++i)
+                NewRegister();
+
+            for (unsigned int i = 0; i < _node->params.size(); ++i)
+                ToRegister(_node->params[i], base + 2 + i);
+
+            // a[k](...) passes a as this
+            auto _member = dynamic_cast<MemberExpressionNode *>(_node->callee);
+            if (_member != nullptr) {
+                int src = ToRegister(_member->left);
+                int key = ToRK(_member->right);
+                AddRInst(RInstruction(RVM_CODE::SELF, base, src, key));
+            } else {
+                ToRegister(_node->callee, base);
+                AddRInst(RInstruction(RVM_CODE::LOADNIL, base + 1));
+            }
+
+            AddRInst(RInstruction(RVM_CODE::CALL, base, _node->params.size()));
+            if (t >= 0 && t != base)
+                AddRInst(RInstruction(RVM_CODE::MOVE, t, base));
+            state->FreeRegisters(_top);
+            return;
+        }
+
+        GenerateCall(_node, VM_CODE::CALL);
+    }
+
+    void CodeGen::GenerateCall(CallExpressionNode *_node, VM_CODE code) {
+        for (auto i = _node->params.begin();
+             i != _node->params.end(); ++i)
             Visit(*i);
 
-        AddInst(Instruction(VM_CODE::PUSH_NULL, 0)); // Push This
-        Visit(_node->exp);
-        AddInst(Instruction(VM_CODE::CALL, _node->parameters.size()));
+        AddInst(VM_CODE::PUSH_NULL, 0); // Push This
+        Visit(_node->callee);
+        AddInst(code, _node->params.size());
     }
 
     CodeGen::~CodeGen() {
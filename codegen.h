@@ -8,6 +8,7 @@
 #include "util.h"
 #include "parser.h"
 #include "svm.h"
+#include "rvm_codes.h"
 #include "function.h"
 #include "object.h"
 #include "visitor.h"
@@ -22,7 +23,7 @@ namespace halang {
 
         class VarType;
 
-        CodeGen(StackVM *_vm);
+        CodeGen(StackVM *_vm, CodeFormat _format = CodeFormat::Stack);
 
         CodeGen(const CodeGen &) = delete;
 
@@ -60,9 +61,32 @@ namespace halang {
         Parser *parser;
         GenState *state;
 
+        CodeFormat format;
+
+        // register which receives the value of the expression being
+        // generated in register format, -1 if the value is unused
+        int _target;
+
         GenState *GenerateDefaultState();
 
-        void AddInst(Instruction i);
+        void AddInst(VM_CODE code, long long param);
+
+        void AddRInst(RInstruction i);
+
+        int NewRegister();
+
+        int Target();
+
+        int ToRegister(Node *, int target = -1);
+
+        int ToRK(Node *);
+
+        int ConstantToRK(int const_id);
+
+        void PatchRJump(unsigned int loc, unsigned int dest);
+
+        // stack format, "code" is CALL or TAIL_CALL
+        void GenerateCall(CallExpressionNode *, VM_CODE code);
 
     };
 
@@ -73,7 +97,8 @@ namespace halang {
 
         static GenState *CreateEqualState(GenState *);
 
-        static GenState *CreateNewState(GenState *prev = nullptr);
+        static GenState *CreateNewState(GenState *prev = nullptr,
+                                        CodeFormat format = CodeFormat::Stack);
 
         static CodePack *GenerateCodePack(GenState *);
 
@@ -110,6 +135,16 @@ namespace halang {
         unsigned int *_max_entries_size;
         bool isNew;
 
+        CodeFormat format;
+
+        // temporaries of register format are allocated like a stack
+        // above the variables.
+        unsigned int *_register_top;
+        unsigned int *_register_size;
+
+        // set by the first yield of the function
+        bool *_generator;
+
         GenState *prev, *father_state;
 
         size_type params_size;
@@ -121,6 +156,7 @@ namespace halang {
 
         std::vector<Value> *constant;
         std::vector<Instruction> *instructions;
+        std::vector<RInstruction> *rinstructions;
 
         bool ExistName(const std::u16string &_name) const;
 
@@ -150,6 +186,32 @@ namespace halang {
             return *_max_entries_size;
         }
 
+        inline CodeFormat GetFormat() const {
+            return format;
+        }
+
+        inline size_type RegisterTop() const {
+            return *_register_top;
+        }
+
+        inline size_type RegisterSize() const {
+            return *_register_size;
+        }
+
+        inline bool IsGenerator() const {
+            return *_generator;
+        }
+
+        inline void SetGenerator() {
+            *_generator = true;
+        }
+
+        size_type AllocRegister();
+
+        inline void FreeRegisters(size_type top) {
+            *_register_top = top;
+        }
+
         inline GenState *GetFather() const {
             return father_state;
         }
@@ -169,12 +231,24 @@ namespace halang {
         }
 
         std::vector<Instruction>::size_type
-        AddInstruction(VM_CODE code, int param) {
+        AddInstruction(VM_CODE code, long long param) {
+            if (!Instruction::ParamFits(param))
+                throw std::logic_error("Operand is out of the range of instruction.");
             auto _size = instructions->size();
-            instructions->push_back(Instruction(code, param));
+            instructions->push_back(Instruction(code, static_cast<int>(param)));
             return _size;
         }
 
+        /// <summary>
+        /// Rewrite the instruction at "loc", used to patch the jumps.
+        /// </summary>
+        void SetInstruction(std::vector<Instruction>::size_type loc,
+                            VM_CODE code, long long param) {
+            if (!Instruction::ParamFits(param))
+                throw std::logic_error("Jump is out of the range of instruction.");
+            (*instructions)[loc] = Instruction(code, static_cast<int>(param));
+        }
+
         std::vector<Instruction>::size_type
         AddInstruction(const Instruction &inst) {
             auto _size = instructions->size();
@@ -182,9 +256,23 @@ namespace halang {
             return _size;
         }
 
+        inline std::vector<RInstruction> *
+        GetRInstructionVector() const {
+            return rinstructions;
+        }
+
+        std::vector<RInstruction>::size_type
+        AddRInstruction(const RInstruction &inst) {
+            auto _size = rinstructions->size();
+            rinstructions->push_back(inst);
+            return _size;
+        }
+
         std::vector<Value>::size_type
         AddConstant(Value _value) {
             auto _size = constant->size();
+            if (_size > static_cast<std::vector<Value>::size_type>(Instruction::MAX_PARAM))
+                throw std::logic_error("Too many constants in one function.");
             constant->push_back(_value);
             return _size;
         }
@@ -4,10 +4,15 @@
 #include "string.h"
 #include "function.h"
 #include "ScriptContext.h"
+#include "Generator.h"
 #include "util.h"
 #include "svm.h"
+#include "arith.h"
+#include "BigInt.h"
 #include <sstream>
 #include <iostream>
+#include <iomanip>
+#include <cmath>
 
 #define TEXT(T) CreatePersistent(T)
 #define TOV(T) T->toValue()
@@ -34,6 +39,57 @@ namespace halang {
 
     Dict *Context::GetStringPrototype() { return _str_proto; }
 
+    Dict *Context::GetGeneratorPrototype() { return _gen_proto; }
+
+    Dict *Context::GetBigIntPrototype() { return _bigint_proto; }
+
+#define E(NAME, METHOD) + 1
+    static const int OPERATOR_COUNT = 0 ARITH_OPERATORS(E);
+#undef E
+
+    // the operator entries of the prototypes when initialized,
+    // in the order of ARITH_OPERATORS, null for a missing one
+    static Value _si_proto_ops[OPERATOR_COUNT];
+    static Value _num_proto_ops[OPERATOR_COUNT];
+
+    static void RecordOperators(Dict *proto, Value *ops) {
+        int i = 0;
+#define E(NAME, METHOD) \
+        if (!proto->TryGetValue(Context::StringBuffer::METHOD->toValue(), ops[i])) \
+            ops[i] = Value(); \
+        ++i;
+        ARITH_OPERATORS(E)
+#undef E
+    }
+
+    // the version of a prototype changes with any entry, only the
+    // operators matter, so the version is renewed when they are
+    // all still the recorded ones
+    static bool OperatorsIntact(Dict *proto, const Value *ops, unsigned long long &version) {
+        int i = 0;
+        Value v;
+#define E(NAME, METHOD) \
+        if (!proto->TryGetValue(Context::StringBuffer::METHOD->toValue(), v)) \
+            v = Value(); \
+        if (v.GetType() != ops[i].GetType() || (v.isGCObject() && v.AsGC() != ops[i].AsGC())) \
+            return false; \
+        ++i;
+        ARITH_OPERATORS(E)
+#undef E
+        version = proto->GetVersion();
+        return true;
+    }
+
+    bool Context::IsSmallIntPrototypeIntact() {
+        return _si_proto->GetVersion() == _si_proto_version ||
+               OperatorsIntact(_si_proto, _si_proto_ops, _si_proto_version);
+    }
+
+    bool Context::IsNumberPrototypeIntact() {
+        return _num_proto->GetVersion() == _num_proto_version ||
+               OperatorsIntact(_num_proto, _num_proto_ops, _num_proto_version);
+    }
+
     GC *Context::gc = nullptr;
     std::vector<ScriptContext *> *Context::runningContexts = nullptr;
     StackVM *Context::vm = nullptr;
@@ -43,6 +99,7 @@ namespace halang {
     String *Context::StringBuffer::__MUL__ = nullptr;
     String *Context::StringBuffer::__DIV__ = nullptr;
     String *Context::StringBuffer::__MOD__ = nullptr;
+    String *Context::StringBuffer::__POW__ = nullptr;
     String *Context::StringBuffer::__LT__ = nullptr;
     String *Context::StringBuffer::__GT__ = nullptr;
     String *Context::StringBuffer::__LTEQ__ = nullptr;
@@ -58,6 +115,9 @@ namespace halang {
     String *Context::StringBuffer::GET_LENGTH = nullptr;
     String *Context::StringBuffer::GET_HASH = nullptr;
 
+    String *Context::StringBuffer::TO_STRING = nullptr;
+    String *Context::StringBuffer::TO_HEX = nullptr;
+
     String *Context::StringBuffer::PUSH = nullptr;
     String *Context::StringBuffer::POP = nullptr;
     String *Context::StringBuffer::AT = nullptr;
@@ -65,6 +125,8 @@ namespace halang {
     String *Context::StringBuffer::SET = nullptr;
     String *Context::StringBuffer::EXIST = nullptr;
 
+    String *Context::StringBuffer::NEXT = nullptr;
+
     String *Context::StringBuffer::TRUE = nullptr;
     String *Context::StringBuffer::FALSE = nullptr;
 
@@ -75,10 +137,16 @@ namespace halang {
     Dict *Context::_str_proto = nullptr;
     Dict *Context::_array_proto = nullptr;
     Dict *Context::_dict_proto = nullptr;
+    Dict *Context::_gen_proto = nullptr;
+    Dict *Context::_bigint_proto = nullptr;
+    Function *Context::_gen_next_fun = nullptr;
+
+    unsigned long long Context::_si_proto_version = 0;
+    unsigned long long Context::_num_proto_version = 0;
 
     String *Context::CreatePersistent(const char *_s) {
         auto s = String::FromCharArray(_s);
-        s->persistent = true;
+        gc->MakePersistent(s);
         return s;
     }
 
@@ -108,6 +176,8 @@ namespace halang {
         _si_proto->SetValue(SBV(__GTEQ__), FUN(_si_gteq_));
         _si_proto->SetValue(SBV(__LTEQ__), FUN(_si_lteq_));
         _si_proto->SetValue(SBV(__STR__), FUN(_si_str_));
+        _si_proto->SetValue(SBV(TO_STRING), FUN(_int_to_string_));
+        _si_proto->SetValue(SBV(TO_HEX), FUN(_int_to_hex_));
 
         _num_proto = gc->NewPersistent<Dict>();
         _num_proto->SetValue(SBV(__ADD__), FUN(_num_add_));
@@ -122,6 +192,22 @@ namespace halang {
         _num_proto->SetValue(SBV(__LTEQ__), FUN(_num_lteq_));
         _num_proto->SetValue(SBV(__STR__), FUN(_num_str_));
 
+        _bigint_proto = gc->NewPersistent<Dict>();
+        _bigint_proto->SetValue(SBV(__ADD__), FUN(_bi_add_));
+        _bigint_proto->SetValue(SBV(__SUB__), FUN(_bi_sub_));
+        _bigint_proto->SetValue(SBV(__MUL__), FUN(_bi_mul_));
+        _bigint_proto->SetValue(SBV(__DIV__), FUN(_bi_div_));
+        _bigint_proto->SetValue(SBV(__MOD__), FUN(_bi_mod_));
+        _bigint_proto->SetValue(SBV(__REVERSE__), FUN(_bi_reverse_));
+        _bigint_proto->SetValue(SBV(__EQ__), FUN(_bi_eq_));
+        _bigint_proto->SetValue(SBV(__GT__), FUN(_bi_gt_));
+        _bigint_proto->SetValue(SBV(__LT__), FUN(_bi_lt_));
+        _bigint_proto->SetValue(SBV(__GTEQ__), FUN(_bi_gteq_));
+        _bigint_proto->SetValue(SBV(__LTEQ__), FUN(_bi_lteq_));
+        _bigint_proto->SetValue(SBV(__STR__), FUN(_bi_str_));
+        _bigint_proto->SetValue(SBV(TO_STRING), FUN(_int_to_string_));
+        _bigint_proto->SetValue(SBV(TO_HEX), FUN(_int_to_hex_));
+
         _str_proto = gc->NewPersistent<Dict>();
         _str_proto->SetValue(SBV(__STR__), FUN(_str_str_));
         _str_proto->SetValue(SBV(__ADD__), FUN(_str_add_));
@@ -139,6 +225,15 @@ namespace halang {
         _dict_proto->SetValue(SBV(GET), FUN(_dict_get_));
         _dict_proto->SetValue(SBV(SET), FUN(_dict_get_));
         _dict_proto->SetValue(SBV(EXIST), FUN(_dict_get_));
+
+        _gen_proto = gc->NewPersistent<Dict>();
+        _gen_next_fun = gc->NewPersistent<Function>(_gen_next_);
+        _gen_proto->SetValue(SBV(NEXT), TOV(_gen_next_fun));
+
+        RecordOperators(_si_proto, _si_proto_ops);
+        RecordOperators(_num_proto, _num_proto_ops);
+        _si_proto_version = _si_proto->GetVersion();
+        _num_proto_version = _num_proto->GetVersion();
     }
 
     void Context::InitializeStringBuffer() {
@@ -148,6 +243,7 @@ namespace halang {
         StringBuffer::__MUL__ = TEXT("__mul__");
         StringBuffer::__DIV__ = TEXT("__div__");
         StringBuffer::__MOD__ = TEXT("__mod__");
+        StringBuffer::__POW__ = TEXT("__pow__");
         StringBuffer::__LT__ = TEXT("__lt__");
         StringBuffer::__GT__ = TEXT("__gt__");
         StringBuffer::__LTEQ__ = TEXT("__lteq__");
@@ -163,6 +259,9 @@ namespace halang {
         StringBuffer::GET_LENGTH = TEXT("getLength");
         StringBuffer::GET_HASH = TEXT("getHash");
 
+        StringBuffer::TO_STRING = TEXT("toString");
+        StringBuffer::TO_HEX = TEXT("toHex");
+
         StringBuffer::PUSH = TEXT("push");
         StringBuffer::POP = TEXT("pop");
         StringBuffer::AT = TEXT("at");
@@ -170,6 +269,8 @@ namespace halang {
         StringBuffer::SET = TEXT("set");
         StringBuffer::EXIST = TEXT("exist");
 
+        StringBuffer::NEXT = TEXT("next");
+
         StringBuffer::TRUE = TEXT("true");
         StringBuffer::FALSE = TEXT("false");
 
@@ -180,23 +281,23 @@ namespace halang {
     }
 
     Value Context::_bl_and_(Value self, FunctionArgs &args) {
-        return Value(self.value.bl && args[0].value.bl);
+        return Value(self.AsBool() && args[0].AsBool());
     }
 
     Value Context::_bl_or_(Value self, FunctionArgs &args) {
-        return Value(self.value.bl || args[0].value.bl);
+        return Value(self.AsBool() || args[0].AsBool());
     }
 
     Value Context::_bl_not_(Value self, FunctionArgs &args) {
-        return Value(!self.value.bl);
+        return Value(!self.AsBool());
     }
 
     Value Context::_bl_eq_(Value self, FunctionArgs &args) {
-        return Value(self.value.bl == args[0].value.bl);
+        return Value(self.AsBool() == args[0].AsBool());
     }
 
     Value Context::_bl_str_(Value self, FunctionArgs &args) {
-        if (self.value.bl)
+        if (self.AsBool())
             return SBV(TRUE);
         else
             return SBV(FALSE);
@@ -204,120 +305,242 @@ namespace halang {
 
     Value Context::_si_add_(Value self, FunctionArgs &args) {
         // ASSERT(self.type == TypeID::SmallInt)
+        // a BigInt, or a number when the prototype has been changed
         auto arg = args.At(0);
-        return Value(self.value.si + arg.value.si);
+        if (!arg.isSmallInt())
+            return BigInt::Add(self, arg);
+        return arith::AddSmallInt(self.AsSmallInt(), arg.AsSmallInt());
     }
 
     Value Context::_si_sub_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si - arg.value.si);
+        if (!arg.isSmallInt())
+            return BigInt::Sub(self, arg);
+        return arith::SubSmallInt(self.AsSmallInt(), arg.AsSmallInt());
     }
 
     Value Context::_si_mul_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si * arg.value.si);
+        if (!arg.isSmallInt())
+            return BigInt::Mul(self, arg);
+        return arith::MulSmallInt(self.AsSmallInt(), arg.AsSmallInt());
     }
 
     Value Context::_si_div_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si / arg.value.si);
+        if (!arg.isSmallInt())
+            return BigInt::Div(self, arg);
+        return arith::DivSmallInt(self.AsSmallInt(), arg.AsSmallInt());
     }
 
     Value Context::_si_mod_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si % arg.value.si);
+        if (!arg.isSmallInt())
+            return BigInt::Mod(self, arg);
+        return arith::ModSmallInt(self.AsSmallInt(), arg.AsSmallInt());
     }
 
     Value Context::_si_reverse_(Value self, FunctionArgs &args) {
-        return Value(self.value.si * -1);
+        return arith::SubSmallInt(0, self.AsSmallInt());
     }
 
     Value Context::_si_eq_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si == arg.value.si);
+        if (!arg.isSmallInt()) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order == 0);
+        }
+        return Value(self.AsSmallInt() == arg.AsSmallInt());
     }
 
     Value Context::_si_gt_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si > arg.value.si);
+        if (!arg.isSmallInt()) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order > 0);
+        }
+        return Value(self.AsSmallInt() > arg.AsSmallInt());
     }
 
     Value Context::_si_lt_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si < arg.value.si);
+        if (!arg.isSmallInt()) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order < 0);
+        }
+        return Value(self.AsSmallInt() < arg.AsSmallInt());
     }
 
     Value Context::_si_gteq_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si >= arg.value.si);
+        if (!arg.isSmallInt()) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order >= 0);
+        }
+        return Value(self.AsSmallInt() >= arg.AsSmallInt());
     }
 
     Value Context::_si_lteq_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si <= arg.value.si);
+        if (!arg.isSmallInt()) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order <= 0);
+        }
+        return Value(self.AsSmallInt() <= arg.AsSmallInt());
     }
 
     Value Context::_si_str_(Value self, FunctionArgs &args) {
         std::stringstream ss;
-        ss << "<int: " << self.value.si << ">";
+        ss << "<int: " << self.AsSmallInt() << ">";
         return String::FromStdString(ss.str())->toValue();
     }
 
     Value Context::_num_add_(Value self, FunctionArgs &args) {
+        // a small int or a BigInt, when the inline path is
+        // not taken, is no number to read
         auto arg = args.At(0);
-        return Value(self.value.number + arg.value.number);
+        if (BigInt::IsInteger(arg))
+            return BigInt::Add(self, arg);
+        return Value(self.AsNumber() + arg.AsNumber());
     }
 
     Value Context::_num_sub_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.number - arg.value.number);
+        if (BigInt::IsInteger(arg))
+            return BigInt::Sub(self, arg);
+        return Value(self.AsNumber() - arg.AsNumber());
     }
 
     Value Context::_num_mul_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.number * arg.value.number);
+        if (BigInt::IsInteger(arg))
+            return BigInt::Mul(self, arg);
+        return Value(self.AsNumber() * arg.AsNumber());
     }
 
     Value Context::_num_div_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.number / arg.value.number);
+        if (BigInt::IsInteger(arg))
+            return BigInt::Div(self, arg);
+        return Value(self.AsNumber() / arg.AsNumber());
     }
 
     Value Context::_num_reverse_(Value self, FunctionArgs &args) {
-        return Value(self.value.number * -1.0);
+        return Value(self.AsNumber() * -1.0);
     }
 
     Value Context::_num_eq_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.si == arg.value.si);
+        if (BigInt::IsInteger(arg)) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order == 0);
+        }
+        return Value(arg.isNumber() && self.AsNumber() == arg.AsNumber());
     }
 
     Value Context::_num_gt_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.number > arg.value.number);
+        if (BigInt::IsInteger(arg)) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order > 0);
+        }
+        return Value(self.AsNumber() > arg.AsNumber());
     }
 
     Value Context::_num_lt_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.number < arg.value.number);
+        if (BigInt::IsInteger(arg)) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order < 0);
+        }
+        return Value(self.AsNumber() < arg.AsNumber());
     }
 
     Value Context::_num_gteq_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.number >= arg.value.number);
+        if (BigInt::IsInteger(arg)) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order >= 0);
+        }
+        return Value(self.AsNumber() >= arg.AsNumber());
     }
 
     Value Context::_num_lteq_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        return Value(self.value.number <= arg.value.number);
+        if (BigInt::IsInteger(arg)) {
+            int order;
+            return Value(BigInt::Compare(self, arg, order) && order <= 0);
+        }
+        return Value(self.AsNumber() <= arg.AsNumber());
     }
 
     Value Context::_num_str_(Value self, FunctionArgs &args) {
         std::stringstream ss;
-        ss << "<number: " << self.value.number << ">";
+        ss << "<number: " << self.AsNumber() << ">";
         return String::FromStdString(ss.str())->toValue();
     }
 
+    Value Context::_bi_add_(Value self, FunctionArgs &args) {
+        return BigInt::Add(self, args.At(0));
+    }
+
+    Value Context::_bi_sub_(Value self, FunctionArgs &args) {
+        return BigInt::Sub(self, args.At(0));
+    }
+
+    Value Context::_bi_mul_(Value self, FunctionArgs &args) {
+        return BigInt::Mul(self, args.At(0));
+    }
+
+    Value Context::_bi_div_(Value self, FunctionArgs &args) {
+        return BigInt::Div(self, args.At(0));
+    }
+
+    Value Context::_bi_mod_(Value self, FunctionArgs &args) {
+        return BigInt::Mod(self, args.At(0));
+    }
+
+    Value Context::_bi_reverse_(Value self, FunctionArgs &args) {
+        return BigInt::Neg(self);
+    }
+
+    Value Context::_bi_eq_(Value self, FunctionArgs &args) {
+        int order;
+        return Value(BigInt::Compare(self, args.At(0), order) && order == 0);
+    }
+
+    Value Context::_bi_gt_(Value self, FunctionArgs &args) {
+        int order;
+        return Value(BigInt::Compare(self, args.At(0), order) && order > 0);
+    }
+
+    Value Context::_bi_lt_(Value self, FunctionArgs &args) {
+        int order;
+        return Value(BigInt::Compare(self, args.At(0), order) && order < 0);
+    }
+
+    Value Context::_bi_gteq_(Value self, FunctionArgs &args) {
+        int order;
+        return Value(BigInt::Compare(self, args.At(0), order) && order >= 0);
+    }
+
+    Value Context::_bi_lteq_(Value self, FunctionArgs &args) {
+        int order;
+        return Value(BigInt::Compare(self, args.At(0), order) && order <= 0);
+    }
+
+    Value Context::_bi_str_(Value self, FunctionArgs &args) {
+        return String::FromStdString("<bigint: " + BigInt::Format(self, 10) + ">")->toValue();
+    }
+
+    Value Context::_int_to_string_(Value self, FunctionArgs &args) {
+        return String::FromStdString(BigInt::Format(self, 10))->toValue();
+    }
+
+    Value Context::_int_to_hex_(Value self, FunctionArgs &args) {
+        return String::FromStdString(BigInt::Format(self, 16))->toValue();
+    }
+
     Value Context::_str_str_(Value self, FunctionArgs &args) {
         return self;
     }
@@ -325,53 +548,79 @@ namespace halang {
     Value Context::_print_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
         String *_str = nullptr;
-        if (arg.type != TypeId::String) {
+        if (arg.GetType() != TypeId::String) {
             auto _proto_ = arg.GetPrototype();
             auto _fun_ = reinterpret_cast<Function *>(
-                    _proto_->GetValue(String::FromCharArray("__str__")->toValue()).value.gc);
-            auto _arg_ = Context::GetGC()->New<FunctionArgs>();
-            _str = reinterpret_cast<String *>(Context::GetVM()->CallFunction(_fun_, arg, _arg_).value.gc);
+                    _proto_->GetValue(String::FromCharArray("__str__")->toValue()).AsGC());
+            _str = reinterpret_cast<String *>(Context::GetVM()->CallFunction(_fun_, arg).AsGC());
         } else
-            _str = reinterpret_cast<String *>(arg.value.gc);
+            _str = reinterpret_cast<String *>(arg.AsGC());
         std::u16string utf16;
         _str->ToU16String(utf16);
         std::cout << utils::utf16_to_utf8(utf16) << std::endl;
         return Value();
     }
 
+    Value Context::_bigint_(Value self, FunctionArgs &args) {
+        if (args.GetLength() < 1)
+            throw std::runtime_error("arguments not enough");
+        auto arg = args[0];
+        if (BigInt::IsInteger(arg))
+            return arg;
+        if (arg.isNumber()) {
+            TNumber n = arg.AsNumber();
+            if (n != std::trunc(n) || std::isinf(n))
+                throw std::runtime_error("<BigInt>number is not an integer");
+            std::stringstream ss;
+            ss << std::fixed << std::setprecision(0) << n;
+            Value result;
+            BigInt::Parse(ss.str(), result);
+            return result;
+        }
+        if (arg.GetType() != TypeId::String)
+            throw std::runtime_error("<BigInt>cannot make an integer of it");
+
+        std::u16string utf16;
+        reinterpret_cast<String *>(arg.AsGC())->ToU16String(utf16);
+        Value result;
+        if (!BigInt::Parse(utils::utf16_to_utf8(utf16), result))
+            throw std::runtime_error("<BigInt>not an integer: " + utils::utf16_to_utf8(utf16));
+        return result;
+    }
+
     Value Context::_str_add_(Value self, FunctionArgs &args) {
         auto arg = args.At(0);
-        if (arg.type != TypeId::String)
+        if (arg.GetType() != TypeId::String)
             throw std::runtime_error("You can only and string to another string");
-        auto _self_str = reinterpret_cast<String *>(self.value.gc);
-        auto _that_str = reinterpret_cast<String *>(arg.value.gc);
+        auto _self_str = reinterpret_cast<String *>(self.AsGC());
+        auto _that_str = reinterpret_cast<String *>(arg.AsGC());
         return String::Concat(_self_str, _that_str)->toValue();
     }
 
     Value Context::_str_length_(Value self, FunctionArgs &args) {
-        if (self.type != TypeId::String)
+        if (self.GetType() != TypeId::String)
             throw std::runtime_error("Not a string");
         return Value(static_cast<TSmallInt>(
-                             reinterpret_cast<String *>(self.value.gc)->GetLength()));
+                             reinterpret_cast<String *>(self.AsGC())->GetLength()));
     }
 
     Value Context::_str_hash_(Value self, FunctionArgs &args) {
-        if (self.type != TypeId::String)
+        if (self.GetType() != TypeId::String)
             throw std::runtime_error("Not a string");
         return Value(static_cast<TSmallInt>(
-                             reinterpret_cast<String *>(self.value.gc)->GetHash()));
+                             reinterpret_cast<String *>(self.AsGC())->GetHash()));
     }
 
     Value Context::_array_push_(Value self, FunctionArgs &args) {
         if (args.GetLength() < 1)
             std::runtime_error("arguments not enough.");
-        auto arr = reinterpret_cast<Array *>(self.value.gc);
+        auto arr = reinterpret_cast<Array *>(self.AsGC());
         arr->Push(args[0]);
         return Value();
     }
 
     Value Context::_array_pop_(Value self, FunctionArgs &args) {
-        auto arr = reinterpret_cast<Array *>(self.value.gc);
+        auto arr = reinterpret_cast<Array *>(self.AsGC());
         return arr->Pop();
     }
 
@@ -379,21 +628,21 @@ namespace halang {
         if (args.GetLength() < 1)
             std::runtime_error("arguments not enough.");
         auto arg1 = args[0];
-        if (arg1.type != TypeId::SmallInt)
+        if (arg1.GetType() != TypeId::SmallInt)
             std::runtime_error("index must be int");
-        auto arr = reinterpret_cast<Array *>(self.value.gc);
-        return arr->At(arg1.value.si);
+        auto arr = reinterpret_cast<Array *>(self.AsGC());
+        return arr->At(arg1.AsSmallInt());
     }
 
     Value Context::_array_length_(Value self, FunctionArgs &args) {
-        auto arr = reinterpret_cast<Array *>(self.value.gc);
+        auto arr = reinterpret_cast<Array *>(self.AsGC());
         return Value(static_cast<TSmallInt>(arr->GetLength()));
     }
 
     Value Context::_dict_set_(Value self, FunctionArgs &args) {
         if (args.GetLength() < 2)
             throw std::runtime_error("arguments not enough");
-        auto _dict = reinterpret_cast<Dict *>(self.value.gc);
+        auto _dict = reinterpret_cast<Dict *>(self.AsGC());
         _dict->SetValue(args[0], args[1]);
         return Value();
     }
@@ -401,15 +650,20 @@ namespace halang {
     Value Context::_dict_get_(Value self, FunctionArgs &args) {
         if (args.GetLength() < 1)
             throw std::runtime_error("arguments not enough");
-        auto _dict = reinterpret_cast<Dict *>(self.value.gc);
+        auto _dict = reinterpret_cast<Dict *>(self.AsGC());
         return Value(_dict->GetValue(args[0]));
     }
 
     Value Context::_dict_exist_(Value self, FunctionArgs &args) {
         if (args.GetLength() < 1)
             throw std::runtime_error("arguments not enough");
-        auto _dict = reinterpret_cast<Dict *>(self.value.gc);
+        auto _dict = reinterpret_cast<Dict *>(self.AsGC());
         return Value(_dict->Exist(args[0]));
     }
 
+    Value Context::_gen_next_(Value self, FunctionArgs &args) {
+        auto _gen = reinterpret_cast<Generator *>(self.AsGC());
+        return Context::GetVM()->Resume(_gen);
+    }
+
 }
\ No newline at end of file
@@ -23,6 +23,7 @@ namespace halang {
             static String *__MUL__;
             static String *__DIV__;
             static String *__MOD__;
+            static String *__POW__;
             static String *__LT__;
             static String *__GT__;
             static String *__LTEQ__;
@@ -38,6 +39,9 @@ namespace halang {
             static String *GET_LENGTH;
             static String *GET_HASH;
 
+            static String *TO_STRING;
+            static String *TO_HEX;
+
             static String *PUSH;
             static String *POP;
             static String *AT;
@@ -45,6 +49,8 @@ namespace halang {
             static String *SET;
             static String *EXIST;
 
+            static String *NEXT;
+
             static String *TRUE;
             static String *FALSE;
 
@@ -56,6 +62,12 @@ namespace halang {
 
         friend class StackVM;
 
+        friend class RegisterVM;
+
+        friend class Jit;
+
+        friend class JitCompiler;
+
         static GC *GetGC();
 
         static std::vector<ScriptContext *> *GetRunningContexts();
@@ -72,6 +84,19 @@ namespace halang {
 
         static Dict *GetStringPrototype();
 
+        static Dict *GetGeneratorPrototype();
+
+        static Dict *GetBigIntPrototype();
+
+        /// <summary>
+        /// If the operator entries of the prototypes of small int and
+        /// number are the ones set when initialized, the operators
+        /// can be done inline. Other entries may come and go.
+        /// </summary>
+        static bool IsSmallIntPrototypeIntact();
+
+        static bool IsNumberPrototypeIntact();
+
     private:
 
         static std::vector<ScriptContext *> *runningContexts;
@@ -88,6 +113,14 @@ namespace halang {
         static Dict *_str_proto;
         static Dict *_array_proto;
         static Dict *_dict_proto;
+        static Dict *_gen_proto;
+        static Dict *_bigint_proto;
+
+        // StackVM resumes the generator inline when it calls this
+        static Function *_gen_next_fun;
+
+        static unsigned long long _si_proto_version;
+        static unsigned long long _num_proto_version;
 
         static void InitializeDefaultPrototype();
 
@@ -151,6 +184,35 @@ namespace halang {
 
         static Value _num_str_(Value self, FunctionArgs &args);
 
+        static Value _bi_add_(Value self, FunctionArgs &args);
+
+        static Value _bi_sub_(Value self, FunctionArgs &args);
+
+        static Value _bi_mul_(Value self, FunctionArgs &args);
+
+        static Value _bi_div_(Value self, FunctionArgs &args);
+
+        static Value _bi_mod_(Value self, FunctionArgs &args);
+
+        static Value _bi_reverse_(Value self, FunctionArgs &args);
+
+        static Value _bi_eq_(Value self, FunctionArgs &args);
+
+        static Value _bi_gt_(Value self, FunctionArgs &args);
+
+        static Value _bi_lt_(Value self, FunctionArgs &args);
+
+        static Value _bi_gteq_(Value self, FunctionArgs &args);
+
+        static Value _bi_lteq_(Value self, FunctionArgs &args);
+
+        static Value _bi_str_(Value self, FunctionArgs &args);
+
+        // toString and toHex of both small int and BigInt
+        static Value _int_to_string_(Value self, FunctionArgs &args);
+
+        static Value _int_to_hex_(Value self, FunctionArgs &args);
+
         static Value _str_str_(Value self, FunctionArgs &args);
 
         static Value _str_add_(Value self, FunctionArgs &args);
@@ -173,8 +235,16 @@ namespace halang {
 
         static Value _dict_exist_(Value self, FunctionArgs &args);
 
+        static Value _gen_next_(Value self, FunctionArgs &args);
+
         static Value _print_(Value self, FunctionArgs &args);
 
+        /// <summary>
+        /// bigint(x): the integer of a string of decimal or "0x" hex
+        /// digits, an int, or a number without a fraction.
+        /// </summary>
+        static Value _bigint_(Value self, FunctionArgs &args);
+
     };
 
 }
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include "object.h"
+#include "GC.h"
+
+namespace halang {
+
+    class Dict;
+
+    class Function;
+
+    /// <summary>
+    /// Type feedback of one DOT, CALL or operator site in a CodePack,
+    /// collected by the interpreter for the tiers that specialize.
+    ///
+    /// The types are sets of TypeId bits: "types" of the receiver of
+    /// DOT and CALL or of the left operand, "other_types" of the right
+    /// operand. Up to MAX_ENTRIES prototypes of the receiver and
+    /// Functions called are kept; one more makes the list megamorphic,
+    /// which keeps none. The prototypes are only recorded on the slow
+    /// paths: a miss of the inline cache of DOT, which a new
+    /// prototype always is, and an operator falling back to it.
+    /// A site quickened by the interpreter stops counting until it
+    /// goes back to its generic code, as the code it was rewritten
+    /// to already tells what it has seen.
+    /// </summary>
+    struct TypeFeedback {
+
+        enum class State {
+            Unexecuted,
+            Monomorphic,
+            Polymorphic,
+            Megamorphic,
+        };
+
+        static const unsigned int MAX_ENTRIES = 4;
+
+        template<typename T>
+        struct List {
+            T *entries[MAX_ENTRIES];
+            unsigned int size;
+            bool megamorphic;
+
+            List() : size(0), megamorphic(false) {}
+
+            inline void Add(T *entry) {
+                if (megamorphic)
+                    return;
+                for (unsigned int i = 0; i < size; ++i)
+                    if (entries[i] == entry)
+                        return;
+                GC::Mutation m;
+                if (size == MAX_ENTRIES) {
+                    for (unsigned int i = 0; i < size; ++i)
+                        GC::SnapshotBarrier(entries[i]);
+                    megamorphic = true;
+                    size = 0;
+                    return;
+                }
+                entries[size++] = entry;
+                GC::WriteBarrier(entry);
+            }
+        };
+
+        unsigned long long count;
+        std::uint32_t types;
+        std::uint32_t other_types;
+        List<Dict> protos;
+        List<Function> callees;
+
+        TypeFeedback() :
+                count(0), types(0), other_types(0) {}
+
+        static inline std::uint32_t Bit(TypeId t) {
+            return 1u << static_cast<int>(t);
+        }
+
+        inline void RecordReceiver(const Value &self) {
+            ++count;
+            types |= Bit(self.GetType());
+        }
+
+        inline void RecordPrototype(Dict *proto) {
+            if (proto != nullptr)
+                protos.Add(proto);
+        }
+
+        inline void RecordCall(const Value &self, Function *callee) {
+            ++count;
+            types |= Bit(self.GetType());
+            callees.Add(callee);
+        }
+
+        inline void RecordOperands(const Value &left, const Value &right) {
+            types |= Bit(left.GetType());
+            other_types |= Bit(right.GetType());
+        }
+
+        // out of line, the operators call it on their slow path only
+        void RecordFallback(Value self);
+
+        static unsigned int CountTypes(std::uint32_t set) {
+            unsigned int n = 0;
+            for (; set != 0; set &= set - 1)
+                ++n;
+            return n;
+        }
+
+        State GetState() const {
+            if (count == 0)
+                return State::Unexecuted;
+            if (protos.megamorphic || callees.megamorphic)
+                return State::Megamorphic;
+            if (CountTypes(types) > 1 || CountTypes(other_types) > 1 ||
+                protos.size > 1 || callees.size > 1)
+                return State::Polymorphic;
+            return State::Monomorphic;
+        }
+
+        /// <summary>
+        /// The only type seen, or false if there has been another
+        /// one or none.
+        /// </summary>
+        static bool OnlyType(std::uint32_t set, TypeId &type) {
+            if (CountTypes(set) != 1)
+                return false;
+            int i = 0;
+            while ((set & 1u) == 0) {
+                set >>= 1;
+                ++i;
+            }
+            type = static_cast<TypeId>(i);
+            return true;
+        }
+
+        static const char *StateToString(State st) {
+            switch (st) {
+                case State::Unexecuted:
+                    return "unexecuted";
+                case State::Monomorphic:
+                    return "monomorphic";
+                case State::Polymorphic:
+                    return "polymorphic";
+                case State::Megamorphic:
+                    return "megamorphic";
+                default:
+                    return "";
+            }
+        }
+
+        static const char *TypeToString(TypeId t) {
+            switch (t) {
+                case TypeId::Null:
+                    return "null";
+                case TypeId::Bool:
+                    return "bool";
+                case TypeId::SmallInt:
+                    return "int";
+                case TypeId::Number:
+                    return "number";
+                case TypeId::GCObject:
+                    return "object";
+                case TypeId::ScriptContext:
+                    return "context";
+                case TypeId::CodePack:
+                    return "codepack";
+                case TypeId::Function:
+                    return "function";
+                case TypeId::UpValue:
+                    return "upvalue";
+                case TypeId::String:
+                    return "string";
+                case TypeId::Array:
+                    return "array";
+                case TypeId::Dict:
+                    return "dict";
+                case TypeId::Generator:
+                    return "generator";
+                case TypeId::BigInt:
+                    return "bigint";
+                default:
+                    return "";
+            }
+        }
+
+        static std::string TypesToString(std::uint32_t set) {
+            std::stringstream ss;
+            bool first = true;
+            for (int i = 0; i <= static_cast<int>(TypeId::BigInt); ++i)
+                if (set & (1u << i)) {
+                    if (!first)
+                        ss << "|";
+                    ss << TypeToString(static_cast<TypeId>(i));
+                    first = false;
+                }
+            if (first)
+                ss << "-";
+            return ss.str();
+        }
+
+    };
+
+}
@@ -1,6 +1,10 @@
 #include "function.h"
 #include "ScriptContext.h"
 #include "upvalue.h"
+#include "jit.h"
+#include "trace.h"
+#include "Dict.h"
+#include "arith.h"
 #include <sstream>
 
 namespace halang {
@@ -13,52 +17,193 @@ namespace halang {
         } else {
             ss << "CodePack" << std::endl;
             CodePack *cp = fun->codepack;
-            for (unsigned int i = 0; i < cp->_instructions_size; ++i)
-                ss << Instruction::ToString(cp->_instructions[i]) << std::endl;
+            if (cp->format == CodeFormat::Register) {
+                for (unsigned int i = 0; i < cp->_rinstructions_size; ++i)
+                    ss << RInstruction::ToString(cp->_rinstructions[i]) << std::endl;
+            } else {
+                for (unsigned int i = 0; i < cp->_instructions_size; ++i)
+                    ss << Instruction::ToString(cp->_instructions[i]) << std::endl;
+            }
         }
         return ss.str();
     }
 
-    void CodePack::Mark() {
-        if (!marked) {
-            marked = true;
-            if (prev != nullptr)
-                prev->Mark();
+    void CodePack::PrepareInlineCaches() {
+        delete[] _inline_caches;
+        _inline_caches = nullptr;
+        _inline_caches_size = 0;
 
-            for (size_type i = 0; i < _const_size; ++i)
-                if (_constants[i].isGCObject())
-                    _constants[i].value.gc->Mark();
+        for (size_type i = 0; i < _instructions_size; ++i)
+            if (_instructions[i].GetCode() == VM_CODE::DOT)
+                _instructions[i] = Instruction(VM_CODE::DOT, _inline_caches_size++);
 
-            for (size_type i = 0; i < _var_names_size; ++i)
-                _var_names[i]->Mark();
+        if (_inline_caches_size > 0)
+            _inline_caches = new InlineCache[_inline_caches_size];
+    }
 
-            for (size_type i = 0; i < _upval_names_size; ++i)
-                _upval_names[i]->Mark();
+    static bool HasFeedback(VM_CODE code) {
+        switch (code) {
+            case VM_CODE::DOT:
+            case VM_CODE::CALL:
+            case VM_CODE::TAIL_CALL:
+#define ARITH_CASE(NAME, STR) case VM_CODE::NAME:
+            ARITH_OPERATORS(ARITH_CASE)
+#undef ARITH_CASE
+                return true;
+            default:
+                return false;
         }
     }
 
-    void FunctionArgs::Mark() {
-        if (!marked) {
-            marked = true;
-            Array::Mark();
+    void TypeFeedback::RecordFallback(Value self) {
+        // a dict, an array or a function has none, which
+        // InvokeOperator is left to report
+        if (self.HasPrototype())
+            RecordPrototype(self.GetPrototype());
+    }
+
+    void CodePack::PrepareFeedback() {
+        delete[] _feedback;
+        delete[] _feedback_sites;
+        _feedback = nullptr;
+        _feedback_sites = nullptr;
+        _feedback_size = 0;
+
+        for (size_type i = 0; i < _instructions_size; ++i)
+            if (HasFeedback(_instructions[i].GetCode()))
+                ++_feedback_size;
+
+        _feedback_sites = new TypeFeedback *[_instructions_size]();
+        if (_feedback_size == 0)
+            return;
+
+        // an operator has no param, so it carries the index of
+        // its slot as DOT carries the index of its inline cache
+        _feedback = new TypeFeedback[_feedback_size];
+        size_type slot = 0;
+        for (size_type i = 0; i < _instructions_size; ++i) {
+            auto code = _instructions[i].GetCode();
+            if (!HasFeedback(code))
+                continue;
+            if (code != VM_CODE::DOT && code != VM_CODE::CALL && code != VM_CODE::TAIL_CALL)
+                _instructions[i] = Instruction(code, slot);
+            _feedback_sites[i] = &_feedback[slot++];
         }
     }
 
-    void Function::Mark() {
-        if (!marked) {
-            marked = true;
-            if (!isExtern)
-                codepack->Mark();
+    void CodePack::DumpFeedback(CodePack *cp, std::ostream &os) {
+        os << "<CodePack " << static_cast<const void *>(cp) << ">" << std::endl;
+        for (size_type i = 0; i < cp->_instructions_size; ++i) {
+            const TypeFeedback *fb = cp->GetFeedback(i);
+            if (fb == nullptr)
+                continue;
+
+            auto code = cp->_instructions[i].GetGenericCode();
+            os << i << "\t" << Instruction::ToString(cp->_instructions[i])
+               << "\tcount: " << fb->count
+               << "\ttypes: " << TypeFeedback::TypesToString(fb->types);
+            if (code != VM_CODE::DOT && code != VM_CODE::CALL && code != VM_CODE::TAIL_CALL)
+                os << " " << TypeFeedback::TypesToString(fb->other_types);
 
-            if (name != nullptr)
-                name->Mark();
+            if (fb->protos.megamorphic)
+                os << "\tprotos: many";
+            else if (fb->protos.size > 0)
+                os << "\tprotos: " << fb->protos.size;
 
-            if (thisOne.isGCObject())
-                thisOne.value.gc->Mark();
+            if (fb->callees.megamorphic)
+                os << "\tcallees: many";
+            else if (fb->callees.size > 0) {
+                os << "\tcallees:";
+                for (unsigned int j = 0; j < fb->callees.size; ++j) {
+                    CodePack *callee = fb->callees.entries[j]->GetCodePack();
+                    if (callee == nullptr)
+                        os << " extern";
+                    else
+                        os << " " << static_cast<const void *>(callee);
+                }
+            }
+            os << "\t" << TypeFeedback::StateToString(fb->GetState()) << std::endl;
+        }
+
+        for (size_type i = 0; i < cp->_const_size; ++i)
+            if (cp->_constants[i].isFunction()) {
+                auto fun = reinterpret_cast<Function *>(cp->_constants[i].AsGC());
+                if (fun->GetCodePack() != nullptr)
+                    DumpFeedback(fun->GetCodePack(), os);
+            }
+    }
+
+    void CodePack::DumpInlineCaches(CodePack *cp, std::ostream &os) {
+        os << "<CodePack>" << std::endl;
+        for (size_type i = 0; i < cp->_instructions_size; ++i)
+            if (cp->_instructions[i].GetGenericCode() == VM_CODE::DOT) {
+                auto &ic = cp->_inline_caches[cp->_instructions[i].GetParam()];
+                os << i << "\tDOT\t" << InlineCache::ToString(ic) << std::endl;
+            }
+
+        for (size_type i = 0; i < cp->_const_size; ++i)
+            if (cp->_constants[i].isFunction()) {
+                auto fun = reinterpret_cast<Function *>(cp->_constants[i].AsGC());
+                if (fun->GetCodePack() != nullptr)
+                    DumpInlineCaches(fun->GetCodePack(), os);
+            }
+    }
 
-            for (auto i = upvalues.begin(); i != upvalues.end(); ++i)
-                (*i)->Mark();
+    CodePack::~CodePack() {
+        if (_var_names != nullptr)
+            delete[] _var_names;
+        if (_upval_names != nullptr)
+            delete[] _upval_names;
+        delete[] _constants;
+        delete[] _instructions;
+        delete[] _rinstructions;
+        delete[] _require_upvalues;
+        delete[] _inline_caches;
+        delete[] _feedback;
+        delete[] _feedback_sites;
+        delete _jit;
+        if (_traces != nullptr) {
+            for (size_type i = 0; i < _instructions_size; ++i)
+                delete _traces[i];
+            delete[] _traces;
         }
     }
 
+    void CodePack::Scan() {
+        if (prev != nullptr)
+            GC::Shade(prev);
+
+        for (size_type i = 0; i < _const_size; ++i)
+            GC::Shade(_constants[i]);
+
+        for (size_type i = 0; i < _var_names_size; ++i)
+            GC::Shade(_var_names[i]);
+
+        for (size_type i = 0; i < _upval_names_size; ++i)
+            GC::Shade(_upval_names[i]);
+
+        // the feedback keeps what it names alive, so a later
+        // tier can trust it
+        for (size_type i = 0; i < _feedback_size; ++i) {
+            auto &fb = _feedback[i];
+            for (unsigned int j = 0; j < fb.protos.size; ++j)
+                GC::Shade(fb.protos.entries[j]);
+            for (unsigned int j = 0; j < fb.callees.size; ++j)
+                GC::Shade(fb.callees.entries[j]);
+        }
+    }
+
+    void Function::Scan() {
+        if (!isExtern)
+            GC::Shade(codepack);
+
+        if (name != nullptr)
+            GC::Shade(name);
+
+        GC::Shade(thisOne);
+
+        for (auto i = upvalues.begin(); i != upvalues.end(); ++i)
+            GC::Shade(*i);
+    }
+
 }
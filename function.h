@@ -4,14 +4,22 @@
 #include <map>
 #include <functional>
 #include <memory>
+#include <ostream>
 #include "String.h"
 #include "Array.h"
 #include "object.h"
 #include "upvalue.h"
 #include "svm_codes.h"
+#include "rvm_codes.h"
+#include "inline_cache.h"
+#include "feedback.h"
 
 namespace halang {
 
+    class JitCode;
+
+    class Trace;
+
     class ConstantTable : public GCObject {
     private:
 
@@ -37,19 +45,34 @@ namespace halang {
 
         friend class StackVM;
 
+        friend class RegisterVM;
+
         friend class Function;
 
         friend class ScriptContext;
 
+        friend class Jit;
+
+        friend class JitCompiler;
+
+        friend class Tracer;
+
+        friend class CodePackBuilder;
+
         typedef unsigned int size_type;
 
     protected:
 
         CodePack() :
-                prev(nullptr), param_size(0),
+                GCObject(TypeId::CodePack), prev(nullptr), param_size(0), format(CodeFormat::Stack), is_generator(false),
+                _instructions(nullptr), _instructions_size(0),
+                _rinstructions(nullptr), _rinstructions_size(0), _register_size(0),
                 _var_names(nullptr), _upval_names(nullptr),
                 _var_names_size(0), _upval_names_size(0),
-                _require_upvalues(nullptr), _require_upvalues_size(0) {}
+                _require_upvalues(nullptr), _require_upvalues_size(0),
+                _inline_caches(nullptr), _inline_caches_size(0),
+                _feedback(nullptr), _feedback_size(0), _feedback_sites(nullptr),
+                _call_count(0), _jit(nullptr), _traces(nullptr) {}
 
     private:
 
@@ -60,12 +83,40 @@ namespace halang {
         Value *_constants;
         size_type _const_size;
 
+        CodeFormat format;
+
+        // contains yield, a call gives a Generator
+        bool is_generator;
+
         Instruction *_instructions;
         size_type _instructions_size;
 
+        // register format, run by RegisterVM
+        RInstruction *_rinstructions;
+        size_type _rinstructions_size;
+        size_type _register_size;
+
         int *_require_upvalues;
         size_type _require_upvalues_size;
 
+        // one for each DOT, which carries the index as its param
+        InlineCache *_inline_caches;
+        size_type _inline_caches_size;
+
+        // one for each DOT, CALL, TAIL_CALL and operator, found
+        // by the index of the instruction in "_feedback_sites"
+        TypeFeedback *_feedback;
+        size_type _feedback_size;
+        TypeFeedback **_feedback_sites;
+
+        // the JIT compiles the pack when the count reaches its threshold
+        size_type _call_count;
+        JitCode *_jit;
+
+        // the hot loops, by the index of their backward jump,
+        // allocated with the first one
+        Trace **_traces;
+
         // GC Object
 
         String **_var_names;
@@ -76,6 +127,45 @@ namespace halang {
 
     public:
 
+        /// <summary>
+        /// Number the DOT sites of the instructions and
+        /// give each of them an empty inline cache.
+        /// </summary>
+        void PrepareInlineCaches();
+
+        /// <summary>
+        /// Write the state and the hit rate of every inline cache,
+        /// including the ones of the functions in the constants.
+        /// </summary>
+        static void DumpInlineCaches(CodePack *, std::ostream &);
+
+        /// <summary>
+        /// Give each DOT, CALL, TAIL_CALL and operator site an empty
+        /// type feedback slot.
+        /// </summary>
+        void PrepareFeedback();
+
+        /// <summary>
+        /// Write what every site has seen, including the sites of
+        /// the functions in the constants.
+        /// </summary>
+        static void DumpFeedback(CodePack *, std::ostream &);
+
+        inline InlineCache *GetInlineCache(size_type index) const {
+            return _inline_caches == nullptr ? nullptr : &_inline_caches[index];
+        }
+
+        inline TypeFeedback *GetFeedback(size_type index) const {
+            return _feedback_sites == nullptr ? nullptr : _feedback_sites[index];
+        }
+
+        inline Trace *GetTrace(size_type index) const {
+            return _traces == nullptr ? nullptr : _traces[index];
+        }
+
+        // the JIT has given it native code
+        inline bool IsCompiled() const { return _jit != nullptr; }
+
         inline void GenerateVarNamesArray(size_type _size) {
             _var_names_size = _size;
             _var_names = _size > 0 ? new String *[_size] : nullptr;
@@ -98,47 +188,57 @@ namespace halang {
             _upval_names[index] = name;
         }
 
-        virtual void Mark() override;
+        virtual void Scan() override;
 
         virtual Dict *GetPrototype() override {
             return nullptr;
         }
 
-        virtual Value toValue() override {
-            return Value(this, TypeId::CodePack);
-        }
-
-        virtual ~CodePack() {
-            if (_var_names != nullptr)
-                delete[] _var_names;
-            if (_upval_names != nullptr)
-                delete[] _upval_names;
-            delete[] _constants;
-            delete[] _instructions;
-            delete[] _require_upvalues;
-        }
+        virtual ~CodePack();
 
     };
 
-    class FunctionArgs : public Array {
+    /// <summary>
+    /// The arguments of a call, a view of the values where the
+    /// caller has put them: the value stack of the StackVM or the
+    /// registers of the RegisterVM. Nothing is allocated or copied
+    /// for a call of an extern function.
+    ///
+    /// The view holds the pointer to the values by reference and
+    /// an index from it, since the value stack moves when it grows,
+    /// as it may while an extern function calls back into the VM.
+    /// </summary>
+    class FunctionArgs final {
     public:
 
-        friend class GC;
+        typedef unsigned int size_type;
 
-        friend class StackVM;
+        FunctionArgs() :
+                values(nullptr), first(0), length(0) {}
 
-    protected:
+        FunctionArgs(Value *const &_values, size_type _first, size_type _length) :
+                values(&_values), first(_first), length(_length) {}
+
+        // the pointer must outlive the view
+        FunctionArgs(Value *const &&, size_type, size_type) = delete;
 
-        FunctionArgs() {
+        inline Value At(size_type index) const {
+            if (index >= length)
+                throw std::runtime_error("<FunctionArgs>index out of range");
+            return (*values)[first + index];
         }
 
-        FunctionArgs(unsigned int i) :
-                Array(i) {
+        inline Value operator[](size_type index) const {
+            return At(index);
         }
 
-    public:
+        inline size_type GetLength() const { return length; }
+
+    private:
 
-        virtual void Mark() override;
+        Value *const *values;
+        size_type first;
+        size_type length;
 
     };
 
@@ -151,10 +251,14 @@ namespace halang {
 
         friend class StackVM;
 
+        friend class RegisterVM;
+
         friend class CodeGen;
 
         friend class ScriptContext;
 
+        friend class Jit;
+
         typedef unsigned int size_type;
 
         static std::string ToString(Function *);
@@ -162,10 +266,10 @@ namespace halang {
     protected:
 
         Function(ExternFunction fun) :
-                externFunction(fun), isExtern(true) {}
+                GCObject(TypeId::Function), externFunction(fun), isExtern(true), name(nullptr) {}
 
         Function(CodePack *cp) :
-                codepack(cp), isExtern(false) {}
+                GCObject(TypeId::Function), codepack(cp), isExtern(false), name(nullptr) {}
 
         void Close() {
             for (auto i = upvalues.begin(); i != upvalues.end(); ++i)
@@ -192,12 +296,12 @@ namespace halang {
 
     public:
 
-        virtual void Mark() override;
-
-        virtual Value toValue() override { return Value(this, TypeId::Function); }
+        virtual void Scan() override;
 
         inline Value GetThis() const { return thisOne; }
 
+        inline CodePack *GetCodePack() const { return isExtern ? nullptr : codepack; }
+
         virtual ~Function() {
         }
 
@@ -5,6 +5,7 @@
 #include <fstream>
 #include <utility>
 #include <memory>
+#include <sstream>
 #include "lex.h"
 #include "scanner.h"
 #include "ast.h"
@@ -13,12 +14,24 @@
 #include "svm_codes.h"
 #include "svm.h"
 #include "codegen.h"
+#include "function.h"
 #include "util.h"
+#include "jit.h"
+#include "trace.h"
+#include "context.h"
 
 const char *VERSION_INFO =
         "Halang interpreter developint version\n"
         "v - 0.0.2\n";
 
+const char *USAGE_INFO =
+        "usage: halang [-v] [--engine=stack|register] [--ic-stats] [--dump-feedback]\n"
+        "              [--no-jit] [--jit-threshold=N] [--jit-diff]\n"
+        "              [--no-trace] [--trace-threshold=N]\n"
+        "              [--gc-growth=F] [--gc-min-heap=BYTES] [--gc-nursery=BYTES]\n"
+        "              [--gc-pause-budget=MS] [--gc-concurrent] [--gc-threads=N]\n"
+        "              [--gc-stats] <source>\n";
+
 const char *DEFAULT_FILENAME = "source.txt";
 
 #define CHECK_ERROR(MC) do { \
@@ -52,34 +65,23 @@ const char *DEFAULT_FILENAME = "source.txt";
     }
 
 
-int main(int argc, char **argv) {
-    using namespace halang;
+using namespace halang;
+
+/// <summary>
+/// Lex, parse and generate the main function of a source file,
+/// nullptr after the errors are printed.
+/// </summary>
+static Function *CompileSource(StackVM *nvm, const string &filename, CodeFormat format) {
     Lexer *lexer = nullptr;
     Parser *parser = nullptr;
     CodeGen *cg = nullptr;
-    StackVM *nvm = nullptr;
     Function *main_fun = nullptr;
 
-    nvm = new StackVM();
-
-    string filename;
-    if (argc > 1) {
-        std::string arg1(argv[1]);
-        if (arg1 == "-v") {
-            std::cout << VERSION_INFO;
-            return 0;
-        } else
-            filename = arg1;
-    } else {
-        std::cout << VERSION_INFO;
-        return 0;
-    }
-
     fstream fs;
     fs.open(filename, fstream::in);
     if (fs.fail()) {
         std::cout << "input source not found." << std::endl;
-        return 0;
+        return nullptr;
     }
     lexer = new Lexer(fs);
 
@@ -91,28 +93,156 @@ int main(int argc, char **argv) {
 
     CHECK_ERROR(parser);
 
-    cg = new CodeGen(nvm);
+    cg = new CodeGen(nvm, format);
     main_fun = cg->generate(parser);
     if (cg->hasError()) {
         for (auto i = cg->getMessages().begin();
              i != cg->getMessages().end(); ++i) {
             std::cout << i->msg << std::endl;
         }
+        main_fun = nullptr;
         goto CLEAR_AND_EXIT;
     }
 
-    CLEAR_PTR(lexer);
-    CLEAR_PTR(parser);
-    CLEAR_PTR(cg);
-
     nvm->InitializeFunction(main_fun);
-    nvm->CallFunction(main_fun, Value());
 
     CLEAR_AND_EXIT:
 
     CLEAR_PTR(lexer);
     CLEAR_PTR(parser);
     CLEAR_PTR(cg);
+
+    return main_fun;
+}
+
+/// <summary>
+/// Run the main function with what it prints kept in a string,
+/// an error ends the output.
+/// </summary>
+static std::string RunCaptured(StackVM *nvm, Function *main_fun) {
+    std::ostringstream out;
+    auto old = std::cout.rdbuf(out.rdbuf());
+    try {
+        nvm->CallFunction(main_fun, Value());
+    } catch (std::exception &e) {
+        std::cout << "error: " << e.what() << std::endl;
+    }
+    std::cout.rdbuf(old);
+    return out.str();
+}
+
+/// <summary>
+/// Run the source in the interpreter, then again with every
+/// function compiled on its first call and every loop traced on
+/// its first iteration, and compare the output.
+/// </summary>
+static int JitDiff(const string &filename, CodeFormat format) {
+    if (!Jit::IsSupported()) {
+        std::cout << "jit is not supported on this platform." << std::endl;
+        return 0;
+    }
+
+    std::string outputs[2];
+    for (int tier = 0; tier < 2; ++tier) {
+        Jit::SetEnabled(tier == 1);
+        Jit::SetThreshold(1);
+        Tracer::SetThreshold(1);
+
+        StackVM *nvm = new StackVM();
+        Function *main_fun = CompileSource(nvm, filename, format);
+        if (main_fun == nullptr) {
+            // a fixture that does not compile says nothing about the tiers
+            delete nvm;
+            std::cout << filename << ": skipped" << std::endl;
+            return 0;
+        }
+        outputs[tier] = RunCaptured(nvm, main_fun);
+        delete nvm;
+    }
+
+    if (outputs[0] != outputs[1]) {
+        std::cout << filename << ": the tiers differ" << std::endl
+                  << "--- interpreter" << std::endl << outputs[0]
+                  << "--- jit" << std::endl << outputs[1];
+        return 1;
+    }
+    std::cout << filename << ": ok" << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    StackVM *nvm = nullptr;
+    Function *main_fun = nullptr;
+
+    string filename;
+    CodeFormat format = CodeFormat::Stack;
+    bool ic_stats = false;
+    bool dump_feedback = false;
+    bool jit_diff = false;
+    bool gc_stats = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg(argv[i]);
+        if (arg == "-v") {
+            std::cout << VERSION_INFO;
+            return 0;
+        } else if (arg == "--engine=stack")
+            format = CodeFormat::Stack;
+        else if (arg == "--engine=register")
+            format = CodeFormat::Register;
+        else if (arg == "--ic-stats")
+            ic_stats = true;
+        else if (arg == "--dump-feedback")
+            dump_feedback = true;
+        else if (arg == "--no-jit")
+            Jit::SetEnabled(false);
+        else if (arg.compare(0, 16, "--jit-threshold=") == 0)
+            Jit::SetThreshold(static_cast<unsigned int>(std::stoul(arg.substr(16))));
+        else if (arg == "--no-trace")
+            Tracer::SetEnabled(false);
+        else if (arg.compare(0, 18, "--trace-threshold=") == 0)
+            Tracer::SetThreshold(static_cast<unsigned int>(std::stoul(arg.substr(18))));
+        else if (arg.compare(0, 12, "--gc-growth=") == 0)
+            GC::SetGrowthFactor(std::stod(arg.substr(12)));
+        else if (arg.compare(0, 14, "--gc-min-heap=") == 0)
+            GC::SetMinHeapSize(static_cast<std::size_t>(std::stoull(arg.substr(14))));
+        else if (arg.compare(0, 13, "--gc-nursery=") == 0)
+            GC::SetNurserySize(static_cast<std::size_t>(std::stoull(arg.substr(13))));
+        else if (arg.compare(0, 18, "--gc-pause-budget=") == 0)
+            GC::SetPauseBudget(std::stod(arg.substr(18)));
+        else if (arg == "--gc-concurrent")
+            GC::SetConcurrentMarking(true);
+        else if (arg.compare(0, 13, "--gc-threads=") == 0)
+            GC::SetThreadCount(static_cast<unsigned int>(std::stoul(arg.substr(13))));
+        else if (arg == "--gc-stats")
+            gc_stats = true;
+        else if (arg == "--jit-diff")
+            jit_diff = true;
+        else
+            filename = arg;
+    }
+    if (filename.empty()) {
+        std::cout << VERSION_INFO << USAGE_INFO;
+        return 0;
+    }
+
+    if (jit_diff)
+        return JitDiff(filename, format);
+
+    nvm = new StackVM();
+    main_fun = CompileSource(nvm, filename, format);
+
+    if (main_fun != nullptr) {
+        nvm->CallFunction(main_fun, Value());
+
+        if (ic_stats)
+            CodePack::DumpInlineCaches(main_fun->GetCodePack(), std::cout);
+        if (dump_feedback)
+            CodePack::DumpFeedback(main_fun->GetCodePack(), std::cout);
+        if (gc_stats)
+            std::cerr << "gc: " << Context::GetGC()->GetPauseCount() << " pauses, max "
+                      << Context::GetGC()->GetMaxPause() << " ms" << std::endl;
+    }
+
     CLEAR_PTR(nvm);
 
     string ch;
@@ -10,7 +10,7 @@ namespace halang {
 
     // runtime definition
     typedef double TNumber;
-    typedef int TSmallInt;
+    typedef std::int64_t TSmallInt;
     typedef bool TBool;
 
 #define VM_STACK_SIZE 256
@@ -66,6 +66,7 @@ namespace halang {
     V(AND) \
     V(OR) \
     V(RETURN) \
+    V(YIELD) \
     V(DO) \
     V(END) \
     V(THEN) \
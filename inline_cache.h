@@ -0,0 +1,143 @@
+#pragma once
+
+#include <sstream>
+#include "object.h"
+#include "Dict.h"
+
+namespace halang {
+
+    /// <summary>
+    /// Inline cache of one DOT site in a CodePack.
+    ///
+    /// An own property of a dict in shape mode is cached as the
+    /// shape and the slot, which holds for every dict of that shape.
+    /// Otherwise an entry remembers the dict where the property
+    /// was found, the dict itself in dictionary mode or the
+    /// prototype for the other types, with the version it had then.
+    /// Any change of that dict renews its version, so the entry misses.
+    ///
+    ///   Uninitialized -> Monomorphic -> Polymorphic (up to
+    ///   MAX_ENTRIES) -> Megamorphic, which always does the full
+    ///   lookup and stops caching.
+    /// </summary>
+    struct InlineCache {
+
+        enum class State {
+            Uninitialized,
+            Monomorphic,
+            Polymorphic,
+            Megamorphic,
+        };
+
+        static const unsigned int MAX_ENTRIES = 4;
+
+        struct Entry {
+            const void *holder;         // Shape or Dict
+            Dict::version_type version; // 0 for a shape
+            Value key;
+            Value result;
+            Dict::size_type slot;
+            bool own;
+            bool slotted;
+        };
+
+        State state;
+        unsigned int size;
+        Entry entries[MAX_ENTRIES];
+
+        unsigned long long hits;
+        unsigned long long misses;
+
+        InlineCache() :
+                state(State::Uninitialized), size(0), hits(0), misses(0) {}
+
+        // the keys are the interned names in the constants,
+        // so the same site always passes the same object
+        static inline bool SameKey(const Value &a, const Value &b) {
+            return a.GetType() == b.GetType() && a.AsGC() == b.AsGC();
+        }
+
+        inline const Entry *Lookup(const void *holder, Dict::version_type version, Value key) {
+            for (unsigned int i = 0; i < size; ++i) {
+                Entry &en = entries[i];
+                if (en.holder == holder && en.version == version &&
+                    SameKey(en.key, key)) {
+                    ++hits;
+                    return &en;
+                }
+            }
+            ++misses;
+            return nullptr;
+        }
+
+        inline const Entry *Lookup(Dict *holder, Value key) {
+            return Lookup(holder, holder->GetVersion(), key);
+        }
+
+        inline const Entry *Lookup(Shape *shape, Value key) {
+            return Lookup(shape, 0, key);
+        }
+
+        void Update(Dict *holder, Value key, Value result, bool own) {
+            Add(Entry{holder, holder->GetVersion(), key, result, 0, own, false});
+        }
+
+        void UpdateSlot(Shape *shape, Value key, Dict::size_type slot) {
+            Add(Entry{shape, 0, key, Value(), slot, true, true});
+        }
+
+    private:
+
+        void Add(const Entry &entry) {
+            if (state == State::Megamorphic || !entry.key.isString())
+                return;
+
+            // a stale entry of the same holder is replaced in place
+            unsigned int i = 0;
+            while (i < size && entries[i].holder != entry.holder)
+                ++i;
+
+            if (i == MAX_ENTRIES) {
+                state = State::Megamorphic;
+                size = 0;
+                return;
+            }
+
+            entries[i] = entry;
+            if (i == size)
+                ++size;
+            state = size == 1 ? State::Monomorphic : State::Polymorphic;
+        }
+
+    public:
+
+        static const char *StateToString(State st) {
+            switch (st) {
+                case State::Uninitialized:
+                    return "uninitialized";
+                case State::Monomorphic:
+                    return "monomorphic";
+                case State::Polymorphic:
+                    return "polymorphic";
+                case State::Megamorphic:
+                    return "megamorphic";
+                default:
+                    return "";
+            }
+        }
+
+        static std::string ToString(const InlineCache &ic) {
+            std::stringstream ss;
+            auto total = ic.hits + ic.misses;
+            ss << StateToString(ic.state) << "\thits: " << ic.hits
+               << "\tmisses: " << ic.misses << "\thit rate: ";
+            if (total > 0)
+                ss << (100.0 * ic.hits / total) << "%";
+            else
+                ss << "-";
+            return ss.str();
+        }
+
+    };
+
+}
@@ -0,0 +1,1196 @@
+#include "jit.h"
+#include "svm.h"
+#include "function.h"
+#include "Dict.h"
+#include "Generator.h"
+#include "context.h"
+#include "inline_cache.h"
+#include "trace.h"
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <vector>
+
+#ifdef HALANG_JIT
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// a helper is called from native code without unwind information,
+// so the exception is kept until StackVM::Run throws it again
+#define HELPER_BEGIN try {
+#define HELPER_END \
+    } catch (...) { \
+        pending = std::current_exception(); \
+        return JitCode::Thrown; \
+    } \
+    return JitCode::Returned;
+
+namespace halang {
+
+    bool Jit::enabled = true;
+    unsigned int Jit::threshold = Jit::DEFAULT_THRESHOLD;
+    std::exception_ptr Jit::pending;
+
+    JitCode::JitCode(void *_memory, std::size_t _size) :
+            memory(_memory), size(_size) {}
+
+    JitCode::~JitCode() {
+#ifdef HALANG_JIT
+        munmap(memory, size);
+#endif
+    }
+
+    bool Jit::IsSupported() {
+#ifdef HALANG_JIT
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool Jit::IsEnabled() { return enabled && IsSupported(); }
+
+    void Jit::SetEnabled(bool _enabled) { enabled = _enabled; }
+
+    unsigned int Jit::GetThreshold() { return threshold; }
+
+    void Jit::SetThreshold(unsigned int _threshold) { threshold = _threshold; }
+
+    std::exception_ptr Jit::TakePending() {
+        auto e = pending;
+        pending = nullptr;
+        return e;
+    }
+
+    int Jit::Safepoint(StackVM *vm) {
+        HELPER_BEGIN
+            Context::GetGC()->CheckAndGC();
+        HELPER_END
+    }
+
+    bool Jit::IsFalse(const Value *v) {
+        return !*v;
+    }
+
+    int Jit::LoadUpVal(StackVM *vm, int index) {
+        HELPER_BEGIN
+            vm->Push(vm->frames.back().function->upvalues[index]->GetVal());
+        HELPER_END
+    }
+
+    int Jit::StoreUpVal(StackVM *vm, int index) {
+        HELPER_BEGIN
+            vm->frames.back().function->upvalues[index]->SetVal(vm->Pop());
+        HELPER_END
+    }
+
+    int Jit::SetVal(StackVM *vm) {
+        HELPER_BEGIN
+            auto value = vm->Pop();
+            auto key = vm->Pop();
+            auto _dict = reinterpret_cast<Dict *>((vm->Pop()).AsGC());
+            _dict->SetValue(key, value);
+            vm->Push(_dict->toValue());
+        HELPER_END
+    }
+
+    int Jit::GetVal(StackVM *vm) {
+        HELPER_BEGIN
+            auto key = vm->Pop();
+            auto dict = reinterpret_cast<Dict *>((vm->Pop()).AsGC());
+            vm->Push(dict->GetValue(key));
+        HELPER_END
+    }
+
+    int Jit::Closure(StackVM *vm) {
+        HELPER_BEGIN
+            Value v1 = vm->Pop();
+            Function *func = reinterpret_cast<Function *>(v1.AsGC());
+            vm->Capture(func);
+            vm->Push(func->toValue());
+            Context::GetGC()->CheckAndGC();
+        HELPER_END
+    }
+
+    int Jit::Dot(StackVM *vm, InlineCache *ic) {
+        HELPER_BEGIN
+            Value vs2 = vm->Pop();
+            Value vo1 = vm->Pop();
+            bool own;
+            Value result = vm->GetProperty(vo1, vs2, *ic, own);
+            if (!own)
+                vm->Push(vo1); // this
+            vm->Push(result);
+        HELPER_END
+    }
+
+    int Jit::Call(StackVM *vm, int nargs) {
+        HELPER_BEGIN
+            Value t1 = vm->Pop();
+            Value This = vm->Pop();
+            Function *func = reinterpret_cast<Function *>(t1.AsGC());
+            Value result;
+
+            if (This.isGenerator() && func == Context::_gen_next_fun) {
+                vm->sp -= nargs;
+                result = vm->Resume(reinterpret_cast<Generator *>(This.AsGC()));
+            } else if (!func->isExtern && func->codepack->format == CodeFormat::Stack &&
+                       !func->codepack->is_generator) {
+                vm->PushFrame(func, This, static_cast<StackVM::size_type>(vm->sp - vm->stack) - nargs,
+                              nargs);
+                auto entry = static_cast<StackVM::size_type>(vm->frames.size()) - 1;
+                try {
+                    result = vm->Run(entry);
+                } catch (...) {
+                    while (vm->frames.size() > entry)
+                        vm->PopFrame();
+                    throw;
+                }
+            } else {
+                FunctionArgs args(vm->stack, static_cast<StackVM::size_type>(vm->sp - vm->stack) - nargs,
+                                  nargs);
+                result = vm->CallFunction(func, This, args);
+                vm->sp -= nargs;
+            }
+
+            vm->Push(result);
+            Context::GetGC()->CheckAndGC();
+        HELPER_END
+    }
+
+    int Jit::TailCall(StackVM *vm, int nargs) {
+        HELPER_BEGIN
+            Value t1 = vm->Pop();
+            Value This = vm->Pop();
+            Function *func = reinterpret_cast<Function *>(t1.AsGC());
+
+            if (!func->isExtern && func->codepack->format == CodeFormat::Stack &&
+                !func->codepack->is_generator && vm->frames.back().generator == nullptr) {
+                vm->ReplaceFrame(func, This, nargs);
+                return JitCode::TailCalled;
+            }
+
+            // the code after it returns what is pushed
+            FunctionArgs args(vm->stack, static_cast<StackVM::size_type>(vm->sp - vm->stack) - nargs,
+                              nargs);
+            Value result = vm->CallFunction(func, This, args);
+            vm->sp -= nargs;
+            vm->Push(result);
+        HELPER_END
+    }
+
+    // left operand on the top, right one under it
+#define ARITH_HELPER(NAME, STR) \
+    int Jit::NAME(StackVM *vm) { \
+        HELPER_BEGIN \
+            Value left = *(vm->sp - 1); \
+            Value right = *(vm->sp - 2); \
+            Value result; \
+            if (arith::NAME(left, right, result)) { \
+                vm->sp -= 2; \
+                vm->Push(result); \
+                return JitCode::Returned; \
+            } \
+            FunctionArgs _args(vm->stack, static_cast<StackVM::size_type>(vm->sp - vm->stack) - 2, 1); \
+            result = StackVM::InvokeOperator(left, Context::StringBuffer::STR, _args); \
+            vm->sp -= 2; \
+            vm->Push(result); \
+            Context::GetGC()->CheckAndGC(); \
+        HELPER_END \
+    }
+
+    ARITH_OPERATORS(ARITH_HELPER)
+
+#undef ARITH_HELPER
+
+#ifdef HALANG_JIT
+
+    static_assert(sizeof(Value) == 16, "the templates move a Value as two quadwords");
+    static_assert(offsetof(Value, type) == 8, "the templates find the type at offset 8");
+
+    namespace {
+
+        enum Reg {
+            RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+            R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15,
+        };
+
+        enum Cond {
+            CC_O = 0x0, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7, CC_NP = 0xb,
+            CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf,
+        };
+
+        enum XmmReg {
+            XMM0 = 0, XMM1 = 1,
+        };
+
+        /// <summary>
+        /// Just the x86-64 encodings the templates use, every memory
+        /// operand is [base + disp32].
+        /// </summary>
+        class Assembler {
+        public:
+
+            std::vector<unsigned char> code;
+
+            inline std::size_t Offset() const { return code.size(); }
+
+            void Byte(int b) {
+                code.push_back(static_cast<unsigned char>(b));
+            }
+
+            void Int32(std::int32_t v) {
+                for (int i = 0; i < 4; ++i)
+                    Byte((static_cast<std::uint32_t>(v) >> (8 * i)) & 0xff);
+            }
+
+            void Int64(std::uint64_t v) {
+                for (int i = 0; i < 8; ++i)
+                    Byte((v >> (8 * i)) & 0xff);
+            }
+
+            void Rex(bool w, int reg, int base) {
+                int rex = 0x40 | (w ? 8 : 0) | ((reg >> 3) << 2) | (base >> 3);
+                if (rex != 0x40)
+                    Byte(rex);
+            }
+
+            void Mem(int reg, int base, std::int32_t disp) {
+                Byte(0x80 | ((reg & 7) << 3) | (base & 7));
+                if ((base & 7) == RSP)
+                    Byte(0x24);
+                Int32(disp);
+            }
+
+            void Push(int r) {
+                Rex(false, 0, r);
+                Byte(0x50 + (r & 7));
+            }
+
+            void Pop(int r) {
+                Rex(false, 0, r);
+                Byte(0x58 + (r & 7));
+            }
+
+            void MovRR(int dst, int src) {
+                Rex(true, src, dst);
+                Byte(0x89);
+                Byte(0xc0 | ((src & 7) << 3) | (dst & 7));
+            }
+
+            void AddRR(int dst, int src) {
+                Rex(true, src, dst);
+                Byte(0x01);
+                Byte(0xc0 | ((src & 7) << 3) | (dst & 7));
+            }
+
+            void MovImm64(int dst, std::uint64_t imm) {
+                Rex(true, 0, dst);
+                Byte(0xb8 + (dst & 7));
+                Int64(imm);
+            }
+
+            // zero extended to 64 bits
+            void MovImm32(int dst, std::int32_t imm) {
+                Rex(false, 0, dst);
+                Byte(0xb8 + (dst & 7));
+                Int32(imm);
+            }
+
+            void Load64(int dst, int base, std::int32_t disp) {
+                Rex(true, dst, base);
+                Byte(0x8b);
+                Mem(dst, base, disp);
+            }
+
+            void Store64(int base, std::int32_t disp, int src) {
+                Rex(true, src, base);
+                Byte(0x89);
+                Mem(src, base, disp);
+            }
+
+            void Load32(int dst, int base, std::int32_t disp) {
+                Rex(false, dst, base);
+                Byte(0x8b);
+                Mem(dst, base, disp);
+            }
+
+            void Store32(int base, std::int32_t disp, int src) {
+                Rex(false, src, base);
+                Byte(0x89);
+                Mem(src, base, disp);
+            }
+
+            void Store32Imm(int base, std::int32_t disp, std::int32_t imm) {
+                Rex(false, 0, base);
+                Byte(0xc7);
+                Mem(0, base, disp);
+                Int32(imm);
+            }
+
+            void AddImm(int dst, std::int32_t imm) {
+                Rex(true, 0, dst);
+                Byte(0x81);
+                Byte(0xc0 | (dst & 7));
+                Int32(imm);
+            }
+
+            void SubImm(int dst, std::int32_t imm) {
+                Rex(true, 0, dst);
+                Byte(0x81);
+                Byte(0xe8 | (dst & 7));
+                Int32(imm);
+            }
+
+            // add 0x03, sub 0x2b, cmp 0x3b: reg64 op= [base + disp]
+            void Op64Mem(int opcode, int reg, int base, std::int32_t disp) {
+                Rex(true, reg, base);
+                Byte(opcode);
+                Mem(reg, base, disp);
+            }
+
+            void Imul64Mem(int reg, int base, std::int32_t disp) {
+                Rex(true, reg, base);
+                Byte(0x0f);
+                Byte(0xaf);
+                Mem(reg, base, disp);
+            }
+
+            void Cmp64Mem(int reg, int base, std::int32_t disp) {
+                Rex(true, reg, base);
+                Byte(0x3b);
+                Mem(reg, base, disp);
+            }
+
+            void Cmp32MemImm(int base, std::int32_t disp, std::int32_t imm) {
+                Rex(false, 0, base);
+                Byte(0x81);
+                Mem(7, base, disp);
+                Int32(imm);
+            }
+
+            void Cmp8MemImm(int base, std::int32_t disp, int imm) {
+                Rex(false, 0, base);
+                Byte(0x80);
+                Mem(7, base, disp);
+                Byte(imm);
+            }
+
+            // movsd 0x10 and 0x11, cvtsi2sd 0x2a: xmm and [base + disp],
+            // which cvtsi2sd reads as 64 bits if "wide"
+            void SseMem(int prefix, int opcode, int xmm, int base, std::int32_t disp, bool wide = false) {
+                Byte(prefix);
+                Rex(wide, xmm, base);
+                Byte(0x0f);
+                Byte(opcode);
+                Mem(xmm, base, disp);
+            }
+
+            // addsd 0x58, subsd 0x5c, mulsd 0x59, divsd 0x5e with
+            // the 0xf2 prefix, ucomisd 0x2e with 0x66
+            void SseRR(int prefix, int opcode, int dst, int src) {
+                Byte(prefix);
+                Byte(0x0f);
+                Byte(opcode);
+                Byte(0xc0 | (dst << 3) | src);
+            }
+
+            void Cmp32Imm(int reg, std::int32_t imm) {
+                Rex(false, 0, reg);
+                Byte(0x81);
+                Byte(0xf8 | (reg & 7));
+                Int32(imm);
+            }
+
+            // al = cc, then eax = al
+            void SetccEax(int cc) {
+                Byte(0x0f);
+                Byte(0x90 | cc);
+                Byte(0xc0);
+                Byte(0x0f);
+                Byte(0xb6);
+                Byte(0xc0);
+            }
+
+            // cl = cc
+            void SetccCl(int cc) {
+                Byte(0x0f);
+                Byte(0x90 | cc);
+                Byte(0xc1);
+            }
+
+            // eax = al & cl
+            void AndClEax() {
+                Byte(0x20);
+                Byte(0xc8);
+                Byte(0x0f);
+                Byte(0xb6);
+                Byte(0xc0);
+            }
+
+            void TestEax() {
+                Byte(0x85);
+                Byte(0xc0);
+            }
+
+            void TestAl() {
+                Byte(0x84);
+                Byte(0xc0);
+            }
+
+            void CallAbs(const void *fn) {
+                MovImm64(RAX, reinterpret_cast<std::uintptr_t>(fn));
+                Byte(0xff);
+                Byte(0xd0);
+            }
+
+            void Ret() {
+                Byte(0xc3);
+            }
+
+            // the jumps return where their rel32 goes, for Patch
+            std::size_t Jmp() {
+                Byte(0xe9);
+                Int32(0);
+                return Offset() - 4;
+            }
+
+            std::size_t Jcc(int cc) {
+                Byte(0x0f);
+                Byte(0x80 | cc);
+                Int32(0);
+                return Offset() - 4;
+            }
+
+            void Patch(std::size_t pos, std::size_t target) {
+                auto rel = static_cast<std::int32_t>(
+                        static_cast<std::int64_t>(target) - static_cast<std::int64_t>(pos + 4));
+                std::memcpy(&code[pos], &rel, 4);
+            }
+
+        };
+
+    }
+
+    /// <summary>
+    /// Emit the templates of one CodePack, or the path of one of
+    /// its traces.
+    ///
+    /// While the code runs, rbx holds the StackVM, rbp where the
+    /// result goes, r12 the variables, r13 the top of the value
+    /// stack, r14 the constants and r15 the offset of the frame.
+    /// r13 is written back to the StackVM before a helper, and r12
+    /// and r13 are loaded again after it, as the helper may have
+    /// moved the value stack.
+    /// </summary>
+    class JitCompiler {
+    public:
+
+        JitCompiler(CodePack *_cp) :
+                cp(_cp), si_intact(false), num_intact(false) {
+            StackVM *vm = Context::GetVM();
+            auto base = reinterpret_cast<char *>(vm);
+            off_stack = static_cast<std::int32_t>(reinterpret_cast<char *>(&vm->stack) - base);
+            off_sp = static_cast<std::int32_t>(reinterpret_cast<char *>(&vm->sp) - base);
+        }
+
+        JitCode *Compile() {
+            auto size = cp->_instructions_size;
+            labels.resize(size + 1);
+
+            Prologue();
+            for (CodePack::size_type i = 0; i < size; ++i) {
+                labels[i] = a.Offset();
+                if (!Template(i, cp->_instructions[i].Generic()))
+                    return nullptr;
+            }
+
+            // the end is only reached by a jump past the last code
+            labels[size] = a.Offset();
+            Return(false);
+
+            auto epilogue = a.Offset();
+            Epilogue();
+
+            for (auto i = fixups.begin(); i != fixups.end(); ++i)
+                a.Patch(i->first, labels[i->second]);
+            for (auto i = exits.begin(); i != exits.end(); ++i)
+                a.Patch(*i, epilogue);
+
+            return Install();
+        }
+
+        /// <summary>
+        /// The steps of the trace one after the other, each guarded
+        /// by what it saw when recorded, then back to the first.
+        /// Every side exit writes r13 back and gives its index.
+        /// </summary>
+        JitCode *CompileTrace(const Trace *trace) {
+            bool helpers = false;
+
+            Prologue();
+            auto loop = a.Offset();
+            for (auto i = trace->steps.begin(); i + 1 < trace->steps.end(); ++i)
+                if (!TraceTemplate(*i, helpers))
+                    return nullptr;
+
+            // nothing inline allocates, the helpers might have
+            if (helpers)
+                CallHelper(&Jit::Safepoint);
+            a.Patch(a.Jmp(), loop);
+
+            auto side_exit = a.Offset();
+            a.Store64(RBX, off_sp, R13);
+            auto to_epilogue = a.Jmp();
+
+            auto thrown = a.Offset();
+            a.MovImm32(RAX, -1);
+            auto thrown_to_epilogue = a.Jmp();
+
+            for (auto i = side_exits.begin(); i != side_exits.end(); ++i) {
+                a.Patch(i->first, a.Offset());
+                a.MovImm32(RAX, static_cast<std::int32_t>(i->second));
+                a.Patch(a.Jmp(), side_exit);
+            }
+
+            auto epilogue = a.Offset();
+            Epilogue();
+
+            a.Patch(to_epilogue, epilogue);
+            a.Patch(thrown_to_epilogue, epilogue);
+            for (auto i = exits.begin(); i != exits.end(); ++i)
+                a.Patch(*i, thrown);
+
+            return Install();
+        }
+
+    private:
+
+        CodePack *cp;
+        Assembler a;
+
+        std::int32_t off_stack;
+        std::int32_t off_sp;
+
+        std::vector<std::size_t> labels;                          // of each instruction
+        std::vector<std::pair<std::size_t, std::size_t> > fixups;  // rel32, instruction
+        std::vector<std::size_t> exits;                           // rel32 of a failed helper
+
+        // what a trace knows at the step it is at, -1 for nothing:
+        // the types of the operands, the top one last, and of the
+        // variables, and whether the prototypes are checked
+        std::vector<int> types;
+        std::vector<int> var_types;
+        bool si_intact;
+        bool num_intact;
+        std::vector<std::pair<std::size_t, std::size_t> > side_exits;  // rel32, instruction
+
+        static const std::int32_t VALUE = static_cast<std::int32_t>(sizeof(Value));
+
+        static std::int32_t Type(TypeId t) {
+            return static_cast<std::int32_t>(t);
+        }
+
+        typedef int (*ArithFn)(StackVM *);
+
+        static ArithFn ArithHelper(VM_CODE code) {
+            switch (code) {
+#define ARITH_CASE(NAME, STR) \
+                case VM_CODE::NAME: \
+                    return &Jit::NAME;
+                ARITH_OPERATORS(ARITH_CASE)
+#undef ARITH_CASE
+                default:
+                    return nullptr;
+            }
+        }
+
+        void Prologue() {
+            a.Push(RBX);
+            a.Push(RBP);
+            a.Push(R12);
+            a.Push(R13);
+            a.Push(R14);
+            a.Push(R15);
+            a.SubImm(RSP, 8);  // align the calls to 16 bytes
+
+            a.MovRR(RBX, RDI);
+            a.MovRR(RBP, RSI);
+            a.MovRR(R15, RDX);
+            a.MovImm64(R14, reinterpret_cast<std::uintptr_t>(cp->_constants));
+            Reload();
+        }
+
+        // the status is in eax
+        void Epilogue() {
+            a.AddImm(RSP, 8);
+            a.Pop(R15);
+            a.Pop(R14);
+            a.Pop(R13);
+            a.Pop(R12);
+            a.Pop(RBP);
+            a.Pop(RBX);
+            a.Ret();
+        }
+
+        void Spill() {
+            a.Store64(RBX, off_sp, R13);
+        }
+
+        void Reload() {
+            a.Load64(R12, RBX, off_stack);
+            a.AddRR(R12, R15);
+            a.Load64(R13, RBX, off_sp);
+        }
+
+        template<typename Fn>
+        void CallHelper(Fn fn, std::int64_t arg = 0) {
+            Spill();
+            a.MovRR(RDI, RBX);
+            a.MovImm64(RSI, static_cast<std::uint64_t>(arg));
+            a.CallAbs(reinterpret_cast<const void *>(fn));
+            a.TestEax();
+            exits.push_back(a.Jcc(CC_NE));
+            Reload();
+        }
+
+        /// <summary>
+        /// The codes done by a helper alone, in both kinds of code.
+        /// </summary>
+        bool HelperTemplate(Instruction inst) {
+            auto param = inst.GetParam();
+            switch (inst.GetCode()) {
+                case VM_CODE::LOAD_UPVAL:
+                    CallHelper(&Jit::LoadUpVal, param);
+                    return true;
+                case VM_CODE::STORE_UPVAL:
+                    CallHelper(&Jit::StoreUpVal, param);
+                    return true;
+                case VM_CODE::SET_VAL:
+                    CallHelper(&Jit::SetVal);
+                    return true;
+                case VM_CODE::GET_VAL:
+                    CallHelper(&Jit::GetVal);
+                    return true;
+                case VM_CODE::CLOSURE:
+                    CallHelper(&Jit::Closure);
+                    return true;
+                case VM_CODE::DOT:
+                    CallHelper(&Jit::Dot, static_cast<std::int64_t>(
+                            reinterpret_cast<std::uintptr_t>(&cp->_inline_caches[param])));
+                    return true;
+                case VM_CODE::CALL:
+                    CallHelper(&Jit::Call, param);
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        void Jump(int cc, CodePack::size_type target) {
+            fixups.push_back(std::make_pair(cc < 0 ? a.Jmp() : a.Jcc(cc), target));
+        }
+
+        void PushValue(int base, std::int32_t disp) {
+            a.Load64(RAX, base, disp);
+            a.Load64(RDX, base, disp + 8);
+            a.Store64(R13, 0, RAX);
+            a.Store64(R13, 8, RDX);
+            a.AddImm(R13, VALUE);
+        }
+
+        void PushImmediate(TypeId type, std::int32_t v) {
+            a.MovImm64(RAX, static_cast<std::uint64_t>(static_cast<std::int64_t>(v)));
+            a.Store64(R13, 0, RAX);
+            a.MovImm32(RAX, Type(type));
+            a.Store64(R13, 8, RAX);
+            a.AddImm(R13, VALUE);
+        }
+
+        void StoreVar(std::int32_t index) {
+            a.SubImm(R13, VALUE);
+            a.Load64(RAX, R13, 0);
+            a.Load64(RDX, R13, 8);
+            a.Store64(R12, index * VALUE, RAX);
+            a.Store64(R12, index * VALUE + 8, RDX);
+        }
+
+        void Return(bool has_value) {
+            if (has_value) {
+                a.SubImm(R13, VALUE);
+                a.Load64(RAX, R13, 0);
+                a.Load64(RDX, R13, 8);
+                a.Store64(RBP, 0, RAX);
+                a.Store64(RBP, 8, RDX);
+            } else {
+                a.MovImm32(RAX, 0);
+                a.Store64(RBP, 0, RAX);
+                a.Store64(RBP, 8, RAX);
+            }
+            a.MovImm32(RAX, JitCode::Returned);
+            exits.push_back(a.Jmp());
+        }
+
+        static int Condition(VM_CODE code) {
+            switch (code) {
+                case VM_CODE::LT:
+                    return CC_L;
+                case VM_CODE::GT:
+                    return CC_G;
+                case VM_CODE::LTEQ:
+                    return CC_LE;
+                case VM_CODE::GTEQ:
+                    return CC_GE;
+                case VM_CODE::EQ:
+                    return CC_E;
+                default:
+                    return -1;
+            }
+        }
+
+        // eax and ecx are free, flags say if it is changed
+        void CheckIntact(Dict *proto, const unsigned long long *version) {
+            a.MovImm64(RAX, reinterpret_cast<std::uintptr_t>(&proto->version));
+            a.Load64(RAX, RAX, 0);
+            a.MovImm64(RCX, reinterpret_cast<std::uintptr_t>(version));
+            a.Cmp64Mem(RAX, RCX, 0);
+        }
+
+        /// <summary>
+        /// The small ints at -16 and -32 from r13 replaced by the
+        /// result, which is a small int or a bool. An add, sub or mul
+        /// that overflows leaves both alone and takes one of the
+        /// jumps put in "overflow", for the caller to patch.
+        /// </summary>
+        void SmallIntOperator(VM_CODE code, std::vector<std::size_t> &overflow) {
+            int cc = Condition(code);
+            a.Load64(RAX, R13, -VALUE);
+            if (cc < 0) {
+                if (code == VM_CODE::MUL)
+                    a.Imul64Mem(RAX, R13, -2 * VALUE);
+                else
+                    a.Op64Mem(code == VM_CODE::ADD ? 0x03 : 0x2b, RAX, R13, -2 * VALUE);
+                overflow.push_back(a.Jcc(CC_O));
+                a.Store64(R13, -2 * VALUE, RAX);
+            } else {
+                a.Op64Mem(0x3b, RAX, R13, -2 * VALUE);
+                a.SetccEax(cc);
+                a.Store32(R13, -2 * VALUE, RAX);
+                a.Store32Imm(R13, -2 * VALUE + 8, Type(TypeId::Bool));
+            }
+            a.SubImm(R13, VALUE);
+        }
+
+        /// <summary>
+        /// Same as SmallIntOperator for any mix of small ints and
+        /// numbers, in doubles as arith::ToNumbers does; only numbers
+        /// are compared here.
+        /// </summary>
+        void NumberOperator(VM_CODE code, TypeId left, TypeId right) {
+            a.SseMem(0xf2, left == TypeId::Number ? 0x10 : 0x2a, XMM0, R13, -VALUE, true);
+            a.SseMem(0xf2, right == TypeId::Number ? 0x10 : 0x2a, XMM1, R13, -2 * VALUE, true);
+
+            switch (code) {
+                case VM_CODE::ADD:
+                case VM_CODE::SUB:
+                case VM_CODE::MUL:
+                case VM_CODE::DIV: {
+                    int op = code == VM_CODE::ADD ? 0x58 : code == VM_CODE::SUB ? 0x5c :
+                                                           code == VM_CODE::MUL ? 0x59 : 0x5e;
+                    a.SseRR(0xf2, op, XMM0, XMM1);
+                    a.SseMem(0xf2, 0x11, XMM0, R13, -2 * VALUE);
+                    a.Store32Imm(R13, -2 * VALUE + 8, Type(TypeId::Number));
+                    a.SubImm(R13, VALUE);
+                    return;
+                }
+                // unordered sets every flag that "above" looks at,
+                // so a NaN compares false
+                case VM_CODE::LT:
+                    a.SseRR(0x66, 0x2e, XMM1, XMM0);
+                    a.SetccEax(CC_A);
+                    break;
+                case VM_CODE::LTEQ:
+                    a.SseRR(0x66, 0x2e, XMM1, XMM0);
+                    a.SetccEax(CC_AE);
+                    break;
+                case VM_CODE::GT:
+                    a.SseRR(0x66, 0x2e, XMM0, XMM1);
+                    a.SetccEax(CC_A);
+                    break;
+                case VM_CODE::GTEQ:
+                    a.SseRR(0x66, 0x2e, XMM0, XMM1);
+                    a.SetccEax(CC_AE);
+                    break;
+                default:
+                    a.SseRR(0x66, 0x2e, XMM0, XMM1);
+                    a.SetccCl(CC_NP);
+                    a.SetccEax(CC_E);
+                    a.AndClEax();
+                    break;
+            }
+            a.Store32(R13, -2 * VALUE, RAX);
+            a.Store32Imm(R13, -2 * VALUE + 8, Type(TypeId::Bool));
+            a.SubImm(R13, VALUE);
+        }
+
+        /// <summary>
+        /// Two small ints with the prototype intact are done inline:
+        /// left at -16 and right at -32 from r13, as the interpreter
+        /// pops them. A site whose feedback has never seen a small
+        /// int on both sides only calls the helper.
+        /// </summary>
+        void Arith(CodePack::size_type index, VM_CODE code) {
+            const TypeFeedback *fb = cp->GetFeedback(index);
+            auto si = TypeFeedback::Bit(TypeId::SmallInt);
+            if (fb != nullptr && fb->types != 0 &&
+                ((fb->types & si) == 0 || (fb->other_types & si) == 0)) {
+                CallHelper(ArithHelper(code));
+                return;
+            }
+
+            std::vector<std::size_t> slow;
+
+            a.Load32(RAX, R13, -VALUE + 8);
+            a.Cmp32Imm(RAX, Type(TypeId::SmallInt));
+            slow.push_back(a.Jcc(CC_NE));
+            a.Load32(RAX, R13, -2 * VALUE + 8);
+            a.Cmp32Imm(RAX, Type(TypeId::SmallInt));
+            slow.push_back(a.Jcc(CC_NE));
+            CheckIntact(Context::_si_proto, &Context::_si_proto_version);
+            slow.push_back(a.Jcc(CC_NE));
+
+            SmallIntOperator(code, slow);
+            auto done = a.Jmp();
+
+            for (auto i = slow.begin(); i != slow.end(); ++i)
+                a.Patch(*i, a.Offset());
+            CallHelper(ArithHelper(code));
+            a.Patch(done, a.Offset());
+        }
+
+        bool Template(CodePack::size_type index, Instruction inst) {
+            auto param = inst.GetParam();
+            auto target = static_cast<std::int64_t>(index) + param;
+
+            if (HelperTemplate(inst))
+                return true;
+
+            switch (inst.GetCode()) {
+                case VM_CODE::LOAD_V:
+                    PushValue(R12, param * VALUE);
+                    break;
+                case VM_CODE::LOAD_C:
+                    PushValue(R14, param * VALUE);
+                    break;
+                case VM_CODE::STORE_V:
+                    StoreVar(param);
+                    break;
+                case VM_CODE::LOAD_G:
+                case VM_CODE::STORE_G:
+                case VM_CODE::OUT:
+                    break;
+                case VM_CODE::PUSH_NULL:
+                    PushImmediate(TypeId::Null, 0);
+                    break;
+                case VM_CODE::PUSH_INT:
+                    PushImmediate(TypeId::SmallInt, param);
+                    break;
+                case VM_CODE::PUSH_BOOL:
+                    PushImmediate(TypeId::Bool, param != 0);
+                    break;
+                case VM_CODE::POP:
+                    a.SubImm(R13, VALUE);
+                    break;
+                case VM_CODE::JMP:
+                    if (target < 0 || target > cp->_instructions_size)
+                        return false;
+                    if (param < 0)
+                        CallHelper(&Jit::Safepoint);
+                    Jump(-1, static_cast<CodePack::size_type>(target));
+                    break;
+                case VM_CODE::IFNO: {
+                    if (target < 0 || target > cp->_instructions_size)
+                        return false;
+                    a.SubImm(R13, VALUE);
+                    a.MovRR(RDI, R13);
+                    a.CallAbs(reinterpret_cast<const void *>(&Jit::IsFalse));
+                    a.TestAl();
+                    if (param >= 0) {
+                        Jump(CC_NE, static_cast<CodePack::size_type>(target));
+                        break;
+                    }
+                    auto skip = a.Jcc(CC_E);
+                    CallHelper(&Jit::Safepoint);
+                    Jump(-1, static_cast<CodePack::size_type>(target));
+                    a.Patch(skip, a.Offset());
+                    break;
+                }
+                case VM_CODE::TAIL_CALL:
+                    CallHelper(&Jit::TailCall, param);
+                    Return(true);
+                    break;
+                case VM_CODE::RETURN:
+                    Return(param != 0);
+                    break;
+                case VM_CODE::STOP:
+                    Return(false);
+                    break;
+                case VM_CODE::ADD:
+                case VM_CODE::SUB:
+                case VM_CODE::MUL:
+                case VM_CODE::LT:
+                case VM_CODE::GT:
+                case VM_CODE::LTEQ:
+                case VM_CODE::GTEQ:
+                case VM_CODE::EQ:
+                    Arith(index, inst.GetCode());
+                    break;
+                case VM_CODE::DIV:
+                case VM_CODE::MOD:
+                    CallHelper(ArithHelper(inst.GetCode()));
+                    break;
+                default:
+                    // YIELD, generators stay in the interpreter
+                    return false;
+            }
+            return true;
+        }
+
+        void SideExit(int cc, std::size_t index) {
+            side_exits.push_back(std::make_pair(a.Jcc(cc), index));
+        }
+
+        // "depth" 0 is the top operand
+        int &TypeAt(std::size_t depth) {
+            while (types.size() <= depth)
+                types.insert(types.begin(), -1);
+            return types[types.size() - 1 - depth];
+        }
+
+        int &VarType(std::size_t index) {
+            if (var_types.size() <= index)
+                var_types.resize(index + 1, -1);
+            return var_types[index];
+        }
+
+        int PopType() {
+            int t = TypeAt(0);
+            types.pop_back();
+            return t;
+        }
+
+        // a helper may run any code, which may change the
+        // variables through upvalues or the prototypes
+        void Forget() {
+            types.clear();
+            var_types.clear();
+            si_intact = false;
+            num_intact = false;
+        }
+
+        /// <summary>
+        /// Make sure of the type of the operand at "depth" by a guard
+        /// if the trace does not know it yet.
+        /// </summary>
+        void GuardType(std::size_t depth, TypeId type, std::size_t index) {
+            int &known = TypeAt(depth);
+            if (known == Type(type))
+                return;
+            a.Cmp32MemImm(R13, -VALUE * static_cast<std::int32_t>(depth + 1) + 8, Type(type));
+            SideExit(CC_NE, index);
+            known = Type(type);
+        }
+
+        void GuardIntact(TypeId type, std::size_t index) {
+            if (type == TypeId::SmallInt && !si_intact) {
+                CheckIntact(Context::_si_proto, &Context::_si_proto_version);
+                SideExit(CC_NE, index);
+                si_intact = true;
+            } else if (type == TypeId::Number && !num_intact) {
+                CheckIntact(Context::_num_proto, &Context::_num_proto_version);
+                SideExit(CC_NE, index);
+                num_intact = true;
+            }
+        }
+
+        static bool IsNumeric(TypeId t) {
+            return t == TypeId::SmallInt || t == TypeId::Number;
+        }
+
+        /// <summary>
+        /// The operands are of the recorded types unless the trace
+        /// knows otherwise, and the ones it does not know are guarded.
+        /// </summary>
+        void TraceArith(const TraceStep &step, bool &helpers) {
+            VM_CODE code = cp->_instructions[step.index].GetCode();
+            TypeId left = TypeAt(0) >= 0 ? static_cast<TypeId>(TypeAt(0)) : step.top;
+            TypeId right = TypeAt(1) >= 0 ? static_cast<TypeId>(TypeAt(1)) : step.under;
+
+            bool both_si = left == TypeId::SmallInt && right == TypeId::SmallInt;
+            bool inline_si = both_si && code != VM_CODE::DIV && code != VM_CODE::MOD;
+            // a small int compared with a number is exact in the
+            // helper only, the cast to a double rounds above 2^53
+            bool inline_num = !both_si && IsNumeric(left) && IsNumeric(right) && code != VM_CODE::MOD &&
+                              (left == right || Condition(code) < 0);
+
+            if (!inline_si && !inline_num) {
+                CallHelper(ArithHelper(code));
+                helpers = true;
+                Forget();
+                return;
+            }
+
+            GuardType(0, left, step.index);
+            GuardType(1, right, step.index);
+            GuardIntact(left, step.index);
+            GuardIntact(right, step.index);
+
+            if (inline_si) {
+                // an overflow leaves the trace, the interpreter
+                // makes the result a BigInt
+                std::vector<std::size_t> overflow;
+                SmallIntOperator(code, overflow);
+                for (auto i = overflow.begin(); i != overflow.end(); ++i)
+                    side_exits.push_back(std::make_pair(*i, step.index));
+            } else
+                NumberOperator(code, left, right);
+
+            PopType();
+            PopType();
+            if (Condition(code) >= 0)
+                types.push_back(Type(TypeId::Bool));
+            else
+                types.push_back(Type(inline_si ? TypeId::SmallInt : TypeId::Number));
+        }
+
+        bool TraceTemplate(const TraceStep &step, bool &helpers) {
+            Instruction inst = cp->_instructions[step.index].Generic();
+            auto param = inst.GetParam();
+
+            if (HelperTemplate(inst)) {
+                helpers = true;
+                Forget();
+                return true;
+            }
+
+            switch (inst.GetCode()) {
+                case VM_CODE::LOAD_V:
+                    PushValue(R12, param * VALUE);
+                    types.push_back(VarType(param));
+                    break;
+                case VM_CODE::LOAD_C:
+                    PushValue(R14, param * VALUE);
+                    types.push_back(Type(cp->_constants[param].GetType()));
+                    break;
+                case VM_CODE::STORE_V:
+                    StoreVar(param);
+                    VarType(param) = PopType();
+                    break;
+                case VM_CODE::LOAD_G:
+                case VM_CODE::STORE_G:
+                case VM_CODE::OUT:
+                case VM_CODE::JMP:
+                    break;
+                case VM_CODE::PUSH_NULL:
+                    PushImmediate(TypeId::Null, 0);
+                    types.push_back(Type(TypeId::Null));
+                    break;
+                case VM_CODE::PUSH_INT:
+                    PushImmediate(TypeId::SmallInt, param);
+                    types.push_back(Type(TypeId::SmallInt));
+                    break;
+                case VM_CODE::PUSH_BOOL:
+                    PushImmediate(TypeId::Bool, param != 0);
+                    types.push_back(Type(TypeId::Bool));
+                    break;
+                case VM_CODE::POP:
+                    a.SubImm(R13, VALUE);
+                    PopType();
+                    break;
+                case VM_CODE::IFNO:
+                    // leave before the pop, so the interpreter
+                    // takes the other way itself
+                    if (TypeAt(0) == Type(TypeId::Bool) || step.top == TypeId::Bool) {
+                        GuardType(0, TypeId::Bool, step.index);
+                        a.Cmp8MemImm(R13, -VALUE, 0);
+                        SideExit(step.taken ? CC_NE : CC_E, step.index);
+                    } else {
+                        a.MovRR(RDI, R13);
+                        a.SubImm(RDI, VALUE);
+                        a.CallAbs(reinterpret_cast<const void *>(&Jit::IsFalse));
+                        a.TestAl();
+                        SideExit(step.taken ? CC_E : CC_NE, step.index);
+                    }
+                    a.SubImm(R13, VALUE);
+                    PopType();
+                    break;
+                case VM_CODE::ADD:
+                case VM_CODE::SUB:
+                case VM_CODE::MUL:
+                case VM_CODE::DIV:
+                case VM_CODE::MOD:
+                case VM_CODE::LT:
+                case VM_CODE::GT:
+                case VM_CODE::LTEQ:
+                case VM_CODE::GTEQ:
+                case VM_CODE::EQ:
+                    TraceArith(step, helpers);
+                    break;
+                default:
+                    return false;
+            }
+            return true;
+        }
+
+        // W^X: written through a writable mapping, then made executable
+        JitCode *Install() {
+            auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+            auto size = (a.code.size() + page - 1) / page * page;
+
+            void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+                return nullptr;
+
+            std::memcpy(memory, a.code.data(), a.code.size());
+            if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(memory, size);
+                return nullptr;
+            }
+            return new JitCode(memory, size);
+        }
+
+    };
+
+#endif
+
+    bool Jit::Compile(CodePack *cp) {
+#ifdef HALANG_JIT
+        if (cp->_jit != nullptr)
+            return true;
+        if (cp->format != CodeFormat::Stack || cp->is_generator)
+            return false;
+
+        JitCompiler compiler(cp);
+        cp->_jit = compiler.Compile();
+        return cp->_jit != nullptr;
+#else
+        return false;
+#endif
+    }
+
+    bool Jit::CompileTrace(CodePack *cp, Trace *trace) {
+#ifdef HALANG_JIT
+        if (trace->steps.empty())
+            return false;
+
+        JitCompiler compiler(cp);
+        trace->code = compiler.CompileTrace(trace);
+        return trace->code != nullptr;
+#else
+        return false;
+#endif
+    }
+
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include "object.h"
+#include "arith.h"
+
+// native code is only emitted for x86-64 on systems with mmap,
+// define HALANG_NO_JIT to leave every function to the interpreter.
+// The templates know the 16-byte Value only, so a NaN-boxed build
+// has no JIT either.
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) && \
+    !defined(HALANG_NO_JIT) && !defined(HALANG_NAN_BOXING)
+#define HALANG_JIT
+#endif
+
+namespace halang {
+
+    class CodePack;
+
+    class StackVM;
+
+    struct InlineCache;
+
+    class Trace;
+
+    /// <summary>
+    /// Native code of a CodePack, in its own executable mapping.
+    ///
+    /// The entry runs the top frame of the StackVM, whose variables
+    /// are at "base_offset" bytes into the value stack, and returns
+    /// a Status. The result goes to "result" when it returns.
+    /// The code of a Trace returns the index of the instruction the
+    /// interpreter goes on with instead, or -1 when it has thrown.
+    /// </summary>
+    class JitCode {
+    public:
+
+        enum Status {
+            Returned = 0,
+            Thrown = 1,         // the exception waits in Jit::TakePending
+            TailCalled = 2,     // the frame is replaced, run the new one
+        };
+
+        typedef int (*Entry)(StackVM *vm, Value *result, std::size_t base_offset);
+
+        JitCode(void *_memory, std::size_t _size);
+
+        JitCode(const JitCode &) = delete;
+
+        JitCode &operator=(const JitCode &) = delete;
+
+        ~JitCode();
+
+        inline Entry GetEntry() const {
+            return reinterpret_cast<Entry>(memory);
+        }
+
+        inline std::size_t GetSize() const { return size; }
+
+    private:
+
+        void *memory;
+        std::size_t size;
+
+    };
+
+    /// <summary>
+    /// Baseline template JIT of the stack format.
+    ///
+    /// Every code of SVM_CODES has a template. The moves between the
+    /// variables, the constants and the value stack and the operators
+    /// on two small ints are emitted inline, anything else is a call
+    /// to a helper below, which does what the interpreter would do.
+    /// The code has no unwind information, so a helper never lets an
+    /// exception through but keeps it for StackVM to throw again.
+    ///
+    /// A CodePack is compiled on the call that makes its call count
+    /// reach the threshold; the interpreter stays the reference.
+    /// </summary>
+    class Jit {
+    public:
+
+        static const unsigned int DEFAULT_THRESHOLD = 1000;
+
+        // native frames nested at most, deeper calls are interpreted
+        static const unsigned int MAX_DEPTH = 1000;
+
+        static bool IsSupported();
+
+        static bool IsEnabled();
+
+        static void SetEnabled(bool);
+
+        static unsigned int GetThreshold();
+
+        static void SetThreshold(unsigned int);
+
+        /// <summary>
+        /// Give the CodePack its native code, false if it contains
+        /// something the JIT leaves to the interpreter, like yield.
+        /// </summary>
+        static bool Compile(CodePack *);
+
+        /// <summary>
+        /// Give the recorded Trace of a loop in the CodePack its
+        /// native code, false if nothing came of it.
+        /// </summary>
+        static bool CompileTrace(CodePack *, Trace *);
+
+        static std::exception_ptr TakePending();
+
+    private:
+
+        static bool enabled;
+        static unsigned int threshold;
+        static std::exception_ptr pending;
+
+        static int Safepoint(StackVM *);
+
+        static bool IsFalse(const Value *);
+
+        static int LoadUpVal(StackVM *, int index);
+
+        static int StoreUpVal(StackVM *, int index);
+
+        static int SetVal(StackVM *);
+
+        static int GetVal(StackVM *);
+
+        static int Closure(StackVM *);
+
+        static int Dot(StackVM *, InlineCache *);
+
+        static int Call(StackVM *, int nargs);
+
+        static int TailCall(StackVM *, int nargs);
+
+#define ARITH_HELPER(NAME, STR) static int NAME(StackVM *);
+
+        ARITH_OPERATORS(ARITH_HELPER)
+
+#undef ARITH_HELPER
+
+        friend class JitCompiler;
+
+    };
+
+}
@@ -216,6 +216,8 @@ namespace halang {
             return MakeToken(Token::TYPE::THEN);
         } else if (buffer == u"return") {
             return MakeToken(Token::TYPE::RETURN);
+        } else if (buffer == u"yield") {
+            return MakeToken(Token::TYPE::YIELD);
         } else {
             return MakeToken(Token::TYPE::IDENTIFIER, buffer);
         }
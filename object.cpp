@@ -2,15 +2,12 @@
 #include "object.h"
 #include "string.h"
 #include "svm.h"
+#include "BigInt.h"
 
 
 namespace halang {
-    Value GCObject::toValue() {
-        return Value();
-    }
-
     Dict *Value::GetPrototype() {
-        switch (type) {
+        switch (GetType()) {
             case halang::TypeId::Null:
                 return Context::GetNullPrototype();
             case halang::TypeId::Bool:
@@ -21,28 +18,58 @@ namespace halang {
                 return Context::GetNumberPrototype();
             case halang::TypeId::GCObject:
             case halang::TypeId::String:
-                return value.gc->GetPrototype();
+            case halang::TypeId::Generator:
+            case halang::TypeId::BigInt:
+                return AsGC()->GetPrototype();
             default:
                 throw std::runtime_error("<Value>Prototype not found.");
         }
     }
 
+    bool Value::HasPrototype() const {
+        switch (GetType()) {
+            case halang::TypeId::Null:
+            case halang::TypeId::Bool:
+            case halang::TypeId::SmallInt:
+            case halang::TypeId::Number:
+            case halang::TypeId::GCObject:
+            case halang::TypeId::String:
+            case halang::TypeId::Generator:
+            case halang::TypeId::BigInt:
+                return true;
+            default:
+                return false;
+        }
+    }
+
     bool Value::operator==(const Value &that) const {
-        switch (type) {
+        switch (GetType()) {
             case halang::TypeId::Null:
                 return true;
             case halang::TypeId::Bool:
-                return value.bl == that.value.bl;
+                return AsBool() == that.AsBool();
             case halang::TypeId::SmallInt:
-                return value.si == that.value.si;
+                return that.isSmallInt() && AsSmallInt() == that.AsSmallInt();
             case halang::TypeId::Number:
-                return value.si == that.value.number;
+                return that.isNumber() && AsNumber() == that.AsNumber();
             case halang::TypeId::String: {
-                auto s1 = reinterpret_cast<String *>(value.gc);
-                auto s2 = reinterpret_cast<String *>(that.value.gc);
+                if (!that.isString())
+                    return false;
+                auto s1 = reinterpret_cast<String *>(AsGC());
+                auto s2 = reinterpret_cast<String *>(that.AsGC());
 
-                return s1->GetHash() == s1->GetHash();
+                if (s1 == s2)
+                    return true;
+                if (s1->GetHash() != s2->GetHash() || s1->GetLength() != s2->GetLength())
+                    return false;
+                for (unsigned int i = 0; i < s1->GetLength(); ++i)
+                    if (s1->CharAt(i) != s2->CharAt(i))
+                        return false;
+                return true;
             }
+            case halang::TypeId::BigInt:
+                return that.isBigInt() && reinterpret_cast<BigInt *>(AsGC())->Equals(
+                        reinterpret_cast<BigInt *>(that.AsGC()));
             default:
                 throw std::runtime_error("wrong type");
         }
@@ -3,6 +3,9 @@
 #include <string>
 #include <vector>
 #include <utility>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
 #include "halang.h"
 
 namespace halang {
@@ -19,6 +22,7 @@ namespace halang {
             - Array
             - CodePack
             - Function
+            - Generator
             - Dict // an hash map
                 - General Object
                     - Class				// to generate general object
@@ -40,51 +44,227 @@ namespace halang {
 
     class Function;
 
+    class BigInt;
+
     struct Value;
 
+    enum class TypeId {
+        Null,
+        Bool,
+        SmallInt,
+        Number,
+        GCObject,
+        ScriptContext,
+        CodePack,
+        Function,
+        UpValue,
+        String,
+        Array,
+        Dict,
+        Generator,
+        BigInt,
+    };
+
     class GCObject {
     public:
 
         friend class GC;
 
+        friend class Heap;
+
         friend class Context;
 
         friend class ScriptContextPool;
 
         virtual Dict *GetPrototype() { return nullptr; }
 
-        virtual Value toValue();
+        // null for the objects the scripts never see
+        inline Value toValue();
+
+        /// <summary>
+        /// Shade every object this one refers to, which the GC
+        /// calls once it takes this one off the gray worklist.
+        /// </summary>
+        virtual void Scan() {}
 
-        virtual void Mark() {}
+        /// <summary>
+        /// If the marking thread may scan it while the scripts run,
+        /// not so for what the VMs change without the write barrier,
+        /// which is scanned in the last pause instead.
+        /// </summary>
+        virtual bool IsScannedConcurrently() const { return true; }
+
+        /// <summary>
+        /// The bytes it holds outside the heap, as it has told the
+        /// GC of them by AddExternal and RemoveExternal.
+        /// </summary>
+        virtual std::size_t GetExternalSize() const { return 0; }
 
         virtual ~GCObject() {}
 
+        GCObject(const GCObject &) = delete;
+
+        GCObject &operator=(const GCObject &) = delete;
+
     protected:
 
-        GCObject() :
-                next(nullptr), marked(false), persistent(false) {}
+        GCObject(TypeId _type = TypeId::Null) :
+                type(_type), persistent(false), old(false), remembered(false), external(false) {}
 
-        GCObject *next;
-        bool marked: 2;
-        bool persistent: 2;
+        // the header after the vtable, one word the scripts alone
+        // write: the mark bits and the size are kept by the page
+        TypeId type;
+        bool persistent;
+
+        // promoted out of the nursery, in the remembered set, and
+        // with bytes outside the heap counted in the heap size
+        bool old: 1;
+        bool remembered: 1;
+        bool external: 1;
 
     };
 
-    enum class TypeId {
-        Null,
-        Bool,
-        SmallInt,
-        Number,
-        GCObject,
-        ScriptContext,
-        CodePack,
-        Function,
-        UpValue,
-        String,
-        Array,
-        Dict,
+#ifdef HALANG_NAN_BOXING
+
+    /// <summary>
+    /// A value in one 64-bit word.
+    ///
+    /// A double is itself, every other type lives in the space of
+    /// the negative quiet NaNs, which no arithmetic produces once
+    /// the constructor has made each NaN the positive one:
+    ///
+    ///   | 0x1fff : 13 | type : 4 | payload : 47 |
+    ///
+    /// The payload is the small int, the bool or the pointer, which
+    /// a user space address of x86-64 and arm64 fits in. A small
+    /// int has 47 bits here instead of 64, the operators make a
+    /// BigInt of what is beyond them.
+    /// </summary>
+    struct Value {
+    public:
+
+        static const int TAG_SHIFT = 47;
+        static const std::uint64_t TAG_BASE = 0x1fff0;
+        static const std::uint64_t PAYLOAD_MASK = (static_cast<std::uint64_t>(1) << TAG_SHIFT) - 1;
+        static const std::uint64_t CANONICAL_NAN = 0x7ff8000000000000ull;
+        static const TSmallInt MAX_SMALL_INT = (static_cast<TSmallInt>(1) << (TAG_SHIFT - 1)) - 1;
+        static const TSmallInt MIN_SMALL_INT = -MAX_SMALL_INT - 1;
+
+        std::uint64_t bits;
+
+        static inline std::uint64_t Tag(TypeId t) {
+            return TAG_BASE | static_cast<std::uint64_t>(t);
+        }
+
+        Dict *GetPrototype();
+
+        // false where GetPrototype throws
+        bool HasPrototype() const;
+
+        explicit Value() : bits(Tag(TypeId::Null) << TAG_SHIFT) {}
+
+        // one that does not fit the payload is a number instead
+        explicit Value(TSmallInt i) {
+            if (!FitsSmallInt(i))
+                *this = Value(static_cast<TNumber>(i));
+            else
+                bits = (Tag(TypeId::SmallInt) << TAG_SHIFT) | (static_cast<std::uint64_t>(i) & PAYLOAD_MASK);
+        }
+
+        explicit Value(int i) : Value(static_cast<TSmallInt>(i)) {}
+
+        explicit Value(TNumber n) {
+            if (n != n)
+                bits = CANONICAL_NAN;
+            else
+                std::memcpy(&bits, &n, sizeof(bits));
+        }
+
+        explicit Value(bool n) :
+                bits((Tag(TypeId::Bool) << TAG_SHIFT) | (n ? 1u : 0u)) {}
+
+        explicit Value(GCObject *gc, TypeId t) :
+                bits((Tag(t) << TAG_SHIFT) | reinterpret_cast<std::uintptr_t>(gc)) {}
+
+        inline TypeId GetType() const {
+            auto tag = bits >> TAG_SHIFT;
+            return tag < TAG_BASE ? TypeId::Number : static_cast<TypeId>(tag & 0xf);
+        }
+
+        inline GCObject *AsGC() const {
+            return reinterpret_cast<GCObject *>(bits & PAYLOAD_MASK);
+        }
+
+        // the payload sign extended
+        inline TSmallInt AsSmallInt() const {
+            return static_cast<TSmallInt>(bits << (64 - TAG_SHIFT)) >> (64 - TAG_SHIFT);
+        }
+
+        inline TNumber AsNumber() const {
+            TNumber n;
+            std::memcpy(&n, &bits, sizeof(n));
+            return n;
+        }
+
+        inline TBool AsBool() const { return (bits & 1) != 0; }
+
+        inline bool Is(TypeId t) const { return bits >> TAG_SHIFT == Tag(t); }
+
+        inline bool isNull() const { return Is(TypeId::Null); }
+
+        inline bool isBool() const { return Is(TypeId::Bool); }
+
+        inline bool isSmallInt() const { return Is(TypeId::SmallInt); }
+
+        inline bool isNumber() const { return bits >> TAG_SHIFT < TAG_BASE; }
+
+        inline bool isGCObject() const { return bits >> TAG_SHIFT >= Tag(TypeId::GCObject); }
+
+        inline bool isString() const { return Is(TypeId::String); }
+
+        inline bool isScriptContext() const { return Is(TypeId::ScriptContext); }
+
+        inline bool isCodePack() const { return Is(TypeId::CodePack); }
+
+        inline bool isFunction() const { return Is(TypeId::Function); }
+
+        inline bool isUpValue() const { return Is(TypeId::UpValue); }
+
+        inline bool isArray() const { return Is(TypeId::Array); }
+
+        inline bool isDict() const { return Is(TypeId::Dict); }
+
+        inline bool isGenerator() const { return Is(TypeId::Generator); }
+
+        inline bool isBigInt() const { return Is(TypeId::BigInt); }
+
+        static inline bool FitsSmallInt(TSmallInt i) {
+            return i >= MIN_SMALL_INT && i <= MAX_SMALL_INT;
+        }
+
+        // the bool and the small int are at the bottom of the
+        // payload, the tag of a number is anything below TAG_BASE
+        inline operator bool() const {
+            switch (GetType()) {
+                case halang::TypeId::Bool:
+                    return AsBool();
+                case halang::TypeId::SmallInt:
+                    return AsSmallInt() == 0;
+                case halang::TypeId::Number:
+                    return AsNumber() == 0;
+                default:
+                    return false;
+            }
+        }
+
+        bool operator==(const Value &that) const;
+
     };
 
+    static_assert(sizeof(Value) == 8, "a NaN-boxed Value is one word");
+
+#else
+
     struct Value {
     public:
 
@@ -98,6 +278,9 @@ namespace halang {
 
         Dict *GetPrototype();
 
+        // false where GetPrototype throws
+        bool HasPrototype() const;
+
         explicit Value() : type(TypeId::Null) {
             value.gc = nullptr;
         }
@@ -106,6 +289,8 @@ namespace halang {
             value.si = i;
         }
 
+        explicit Value(int i) : Value(static_cast<TSmallInt>(i)) {}
+
         explicit Value(TNumber n) : type(TypeId::Number) {
             value.number = n;
         }
@@ -118,6 +303,16 @@ namespace halang {
             value.gc = gc;
         }
 
+        inline TypeId GetType() const { return type; }
+
+        inline GCObject *AsGC() const { return value.gc; }
+
+        inline TSmallInt AsSmallInt() const { return value.si; }
+
+        inline TNumber AsNumber() const { return value.number; }
+
+        inline TBool AsBool() const { return value.bl; }
+
         inline bool isNull() const { return type == TypeId::Null; }
 
         inline bool isBool() const { return type == TypeId::Bool; }
@@ -142,6 +337,12 @@ namespace halang {
 
         inline bool isDict() const { return type == TypeId::Dict; }
 
+        inline bool isGenerator() const { return type == TypeId::Generator; }
+
+        inline bool isBigInt() const { return type == TypeId::BigInt; }
+
+        static inline bool FitsSmallInt(TSmallInt) { return true; }
+
         inline operator bool() const {
             switch (type) {
                 case halang::TypeId::Null:
@@ -160,6 +361,8 @@ namespace halang {
                 case halang::TypeId::String:
                 case halang::TypeId::Array:
                 case halang::TypeId::Dict:
+                case halang::TypeId::Generator:
+                case halang::TypeId::BigInt:
                 default:
                     return false;
             }
@@ -169,4 +372,10 @@ namespace halang {
 
     };
 
+#endif
+
+    Value GCObject::toValue() {
+        return type == TypeId::Null ? Value() : Value(this, type);
+    }
+
 }
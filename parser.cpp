@@ -70,6 +70,8 @@ namespace halang {
                 );
             case Token::TYPE::RETURN:
                 return ParseReturnStatement();
+            case Token::TYPE::YIELD:
+                return ParseYieldStatement();
             case Token::TYPE::DEF:
                 return ParseDefStatement();
             case Token::TYPE::IDENTIFIER:
@@ -228,6 +230,29 @@ namespace halang {
         return FinishNode(_node);
     }
 
+    Node *Parser::ParseYieldStatement() {
+        Expect(Token::TYPE::YIELD);
+        CHECK_OK
+        StartNode();
+
+        auto _node = MakeObject<YieldStatementNode>();
+        NextToken();
+
+        if (
+                Token::IsOperator(*current_tok) ||
+                Match(Token::TYPE::NUMBER) ||
+                Match(Token::TYPE::IDENTIFIER) ||
+                Match(Token::TYPE::STRING) ||
+                Match(Token::TYPE::DO) ||
+                Match(Token::TYPE::FUN)
+                ) {
+            _node->expression = ParseExpression();
+        }
+        CHECK_OK
+
+        return FinishNode(_node);
+    }
+
     Node *Parser::ParseDefStatement() {
         Expect(Token::TYPE::DEF);
         CHECK_OK
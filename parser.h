@@ -54,6 +54,8 @@ namespace halang {
 
         Node *ParseReturnStatement();
 
+        Node *ParseYieldStatement();
+
         Node *ParseDefStatement();
 
         Node *ParseExpressionStatement();
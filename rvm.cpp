@@ -0,0 +1,244 @@
+#include "rvm.h"
+#include "function.h"
+#include "upvalue.h"
+#include "String.h"
+#include "GC.h"
+#include "Dict.h"
+#include "context.h"
+#include "arith.h"
+
+#define R(INDEX) reg[INDEX]
+#define K(INDEX) constants[INDEX]
+#define RK(X) (RInstruction::IsConstant(X) ? K(RInstruction::RKIndex(X)) : R(X))
+// RK(X) as the only argument of a call, viewed where it is
+#define RK_ARG(X) (RInstruction::IsConstant(X) ? \
+    FunctionArgs(constants, RInstruction::RKIndex(X), 1) : FunctionArgs(reg, X, 1))
+
+// GC may only run at safepoints: backward jumps, calls and allocations
+#define SAFEPOINT() Context::GetGC()->CheckAndGC()
+
+#ifdef HALANG_THREADED_CODE
+#define HANDLER(NAME) LABEL_##NAME:
+#define DISPATCH() do { \
+    current = inst++; \
+    goto *dispatch_table[static_cast<int>(current->GetCode())]; \
+} while(0)
+#define NEXT() DISPATCH()
+#else
+#define HANDLER(NAME) case RVM_CODE::NAME:
+#define NEXT() continue
+#endif
+
+#define ARITH_OPERATOR(NAME, STR) \
+HANDLER(NAME) { \
+    if (arith::NAME(RK(current->GetB()), RK(current->GetC()), R(current->GetA()))) \
+        NEXT(); \
+    R(current->GetA()) = StackVM::InvokeOperator(RK(current->GetB()), \
+        Context::StringBuffer::STR, RK_ARG(current->GetC())); \
+    SAFEPOINT(); \
+    NEXT(); \
+}
+
+#define BINARY_OPERATOR(NAME, STR) \
+HANDLER(NAME) { \
+    R(current->GetA()) = StackVM::InvokeOperator(RK(current->GetB()), \
+        Context::StringBuffer::STR, RK_ARG(current->GetC())); \
+    SAFEPOINT(); \
+    NEXT(); \
+}
+
+#define UNARY_OPERATOR(NAME, STR) \
+HANDLER(NAME) { \
+    R(current->GetA()) = StackVM::InvokeOperator(RK(current->GetB()), \
+        Context::StringBuffer::STR, FunctionArgs()); \
+    SAFEPOINT(); \
+    NEXT(); \
+}
+
+namespace halang {
+
+    Value RegisterVM::CallFunction(Function *_fun, Value _self, FunctionArgs args) {
+        Executor executor(_self, _fun, args);
+        executor.Execute();
+
+        return executor.ReturnValue();
+    }
+
+    RegisterVM::Executor::Executor(Value _self, Function *_fn,
+                                   FunctionArgs _args) :
+            self(_self), fun(_fn), args(_args) {
+        sc = Context::GetGC()->New<ScriptContext>(_fn);
+        Context::GetRunningContexts()->push_back(sc);
+    }
+
+    RegisterVM::Executor::~Executor() {
+        Context::GetRunningContexts()->pop_back();
+    }
+
+    void RegisterVM::Executor::Execute() {
+        if (fun->isExtern) {
+            returnValue = fun->externFunction(self, args);
+            return;
+        }
+
+        CodePack *cp = fun->codepack;
+        Value *reg = sc->variables;
+        Value *constants = cp->_constants;
+
+        // load args
+        for (unsigned int i = 0; i < args.GetLength(); ++i)
+            reg[i] = args.At(i);
+
+        inst = cp->_rinstructions;
+
+        RInstIter current;
+
+#ifdef HALANG_THREADED_CODE
+#define LABEL_ADDR(NAME, CODE) &&LABEL_##NAME,
+        static void *dispatch_table[] = {
+            RVM_CODES(LABEL_ADDR)
+        };
+#undef LABEL_ADDR
+
+        DISPATCH();
+#else
+        for (;;) {
+            current = inst++;
+            switch (current->GetCode()) {
+#endif
+                HANDLER(MOVE) {
+                    R(current->GetA()) = R(current->GetB());
+                    NEXT();
+                }
+                HANDLER(LOADK) {
+                    R(current->GetA()) = K(current->GetBx());
+                    NEXT();
+                }
+                HANDLER(LOADNIL) {
+                    R(current->GetA()) = Value();
+                    NEXT();
+                }
+                HANDLER(LOADBOOL) {
+                    R(current->GetA()) = Value(current->GetB() != 0);
+                    NEXT();
+                }
+                HANDLER(GETUPVAL) {
+                    R(current->GetA()) = sc->GetUpValue(current->GetB())->GetVal();
+                    NEXT();
+                }
+                HANDLER(SETUPVAL) {
+                    sc->GetUpValue(current->GetB())->SetVal(R(current->GetA()));
+                    NEXT();
+                }
+                HANDLER(GETPROP) {
+                    Value obj = RK(current->GetB());
+                    Value key = RK(current->GetC());
+                    Value result;
+
+                    bool ok = false;
+                    if (obj.isDict())
+                        ok = reinterpret_cast<Dict *>(obj.AsGC())->TryGetValue(key, result);
+                    if (!ok)
+                        ok = obj.GetPrototype()->TryGetValue(key, result);
+                    if (!ok)
+                        throw std::runtime_error("This object does not contain that property.");
+
+                    R(current->GetA()) = result;
+                    NEXT();
+                }
+                HANDLER(SELF) {
+                    int a = current->GetA();
+                    Value obj = R(current->GetB());
+                    Value key = RK(current->GetC());
+                    Value method;
+
+                    bool ok = false;
+                    if (obj.isDict())
+                        ok = reinterpret_cast<Dict *>(obj.AsGC())->TryGetValue(key, method);
+                    if (!ok)
+                        ok = obj.GetPrototype()->TryGetValue(key, method);
+                    if (!ok)
+                        throw std::runtime_error("This object does not contain that property.");
+
+                    R(a + 1) = obj;
+                    R(a) = method;
+                    NEXT();
+                }
+                ARITH_OPERATORS(ARITH_OPERATOR)
+                BINARY_OPERATOR(POW, __POW__)
+                BINARY_OPERATOR(AND, __AND__)
+                BINARY_OPERATOR(OR, __OR__)
+                UNARY_OPERATOR(NEG, __REVERSE__)
+                UNARY_OPERATOR(NOT, __NOT__)
+                HANDLER(CLOSURE) {
+                    auto proto = reinterpret_cast<Function *>(K(current->GetBx()).AsGC());
+
+                    // every closure owns its upvalues, the function in
+                    // the constants is only the prototype of it.
+                    CodePack *_cp = proto->codepack;
+                    Function *func = Context::GetGC()->New<Function>(_cp);
+                    UpValue *_upval = nullptr;
+                    for (unsigned int i = 0; i < _cp->_require_upvalues_size; ++i) {
+
+                        if (_cp->_require_upvalues[i] >= 0) {
+                            _upval = Context::GetGC()->New<UpValue>(reg + _cp->_require_upvalues[i]);
+                            sc->host_upvals.push_back(_upval);
+                        } else
+                            _upval = sc->function->upvalues[(-1 - _cp->_require_upvalues[i])];
+
+                        func->upvalues.push_back(_upval);
+                        GC::WriteBarrier(func, _upval);
+
+                    }
+                    R(current->GetA()) = func->toValue();
+                    SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(CALL) {
+                    int a = current->GetA();
+                    int params_size = current->GetB();
+
+                    Function *func = reinterpret_cast<Function *>(R(a).AsGC());
+
+                    // the arguments are the registers after the function and this
+                    FunctionArgs _args(reg, a + 2, params_size);
+                    R(a) = Context::GetVM()->CallFunction(func, R(a + 1), _args);
+
+                    SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(RETURN) {
+                    if (current->GetB() != 0)
+                        returnValue = R(current->GetA());
+
+                    sc->CloseAllUpValue();
+
+                    goto OUT_LOOP;
+                }
+                HANDLER(JMP) {
+                    inst += current->GetSBx() - 1;
+                    // a backward jump closes a loop
+                    if (current->GetSBx() < 0)
+                        SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(TEST) {
+                    if (!R(current->GetA())) {
+                        inst += current->GetSBx() - 1;
+                        if (current->GetSBx() < 0)
+                            SAFEPOINT();
+                    }
+                    NEXT();
+                }
+#ifndef HALANG_THREADED_CODE
+            }
+        }
+#endif
+        OUT_LOOP:;
+    }
+
+    Value RegisterVM::Executor::ReturnValue() {
+        return returnValue;
+    }
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "svm.h"
+#include "rvm_codes.h"
+#include "ScriptContext.h"
+
+namespace halang {
+
+    class String;
+
+    typedef RInstruction *RInstIter;
+
+    /// <summary>
+    /// RegisterVM runs the CodePacks generated in register format.
+    ///
+    /// Locals and temporaries live in the registers of the
+    /// ScriptContext and the operands are encoded in the
+    /// instruction, so nothing goes through Push/Pop.
+    ///
+    /// It shares the GC and the prototypes of the StackVM
+    /// which hosts it.
+    /// </summary>
+    class RegisterVM {
+    public:
+
+        class Executor;
+
+        static Value CallFunction(Function *function, Value self, FunctionArgs args);
+
+    };
+
+    class RegisterVM::Executor {
+    public:
+
+        Executor(Value _self, Function *, FunctionArgs args = FunctionArgs());
+
+        Executor(const Executor &) = delete;
+
+        Executor &operator=(const Executor &) = delete;
+
+        void Execute();
+
+        Value ReturnValue();
+
+        ~Executor();
+
+    private:
+
+        Value self;
+        ScriptContext *sc;
+        Function *fun;
+        FunctionArgs args;
+        RInstIter inst;
+        Value returnValue;
+
+    };
+
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cinttypes>
+#include <sstream>
+
+/// <summary>
+/// Codes of the register machine.
+///
+/// R(X)  : register X of the running ScriptContext
+/// K(X)  : constant X of the CodePack
+/// RK(X) : K(X & 0x7F) if X has RK_CONSTANT set, otherwise R(X)
+/// </summary>
+#define RVM_CODES(V) \
+    V(MOVE,              0x00)    /* A B      R(A) := R(B)                    */ \
+    V(LOADK,             0x01)    /* A Bx     R(A) := K(Bx)                   */ \
+    V(LOADNIL,           0x02)    /* A        R(A) := null                    */ \
+    V(LOADBOOL,          0x03)    /* A B      R(A) := (bool)B                 */ \
+    V(GETUPVAL,          0x04)    /* A B      R(A) := UpValue[B]              */ \
+    V(SETUPVAL,          0x05)    /* A B      UpValue[B] := R(A)              */ \
+    V(GETPROP,           0x06)    /* A B C    R(A) := RK(B).RK(C)             */ \
+    V(SELF,              0x07)    /* A B C    R(A+1) := R(B); R(A) := R(B).RK(C) */ \
+    V(ADD,               0x08)    /* A B C    R(A) := RK(B) + RK(C)           */ \
+    V(SUB,               0x09)    \
+    V(MUL,               0x0a)    \
+    V(DIV,               0x0b)    \
+    V(MOD,               0x0c)    \
+    V(POW,               0x0d)    \
+    V(EQ,                0x0e)    \
+    V(LT,                0x0f)    \
+    V(GT,                0x10)    \
+    V(LTEQ,              0x11)    \
+    V(GTEQ,              0x12)    \
+    V(AND,               0x13)    \
+    V(OR,                0x14)    \
+    V(NEG,               0x15)    /* A B      R(A) := -RK(B)                  */ \
+    V(NOT,               0x16)    /* A B      R(A) := !RK(B)                  */ \
+    V(CLOSURE,           0x17)    /* A Bx     R(A) := closure(K(Bx))          */ \
+    V(CALL,              0x18)    /* A B      R(A) := R(A)(this: R(A+1), R(A+2) ... R(A+B+1)) */ \
+    V(RETURN,            0x19)    /* A B      return B ? R(A) : null          */ \
+    V(JMP,               0x1a)    /* sBx      pc := pc + sBx                  */ \
+    V(TEST,              0x1b)    /* A sBx    if not R(A) then pc := pc + sBx */ \
+
+namespace halang {
+
+    /// <summary>
+    /// The format of the instructions in a CodePack,
+    /// which decides the engine to run it.
+    /// </summary>
+    enum class CodeFormat {
+        Stack,
+        Register,
+    };
+
+#define CC(NAME, CODE) NAME = CODE ,
+    enum class RVM_CODE {
+        RVM_CODES(CC)
+    };
+#undef CC
+
+    namespace detail {
+#define CC(NAME, CODE) CODE ,
+        constexpr int rvm_code_values[] = { RVM_CODES(CC) };
+#undef CC
+
+        constexpr bool RCodesAreDense(unsigned int i = 0) {
+            return i == sizeof(rvm_code_values) / sizeof(int) ||
+                   (rvm_code_values[i] == static_cast<int>(i) && RCodesAreDense(i + 1));
+        }
+    }
+
+    static_assert(detail::RCodesAreDense(), "RVM_CODES must be numbered densely from 0x00");
+
+    /// <summary>
+    /// 32-bit register instruction
+    ///
+    ///   | C : 8 | B : 8 | A : 8 | code : 8 |
+    ///   |     Bx : 16   | A : 8 | code : 8 |
+    /// </summary>
+    struct RInstruction {
+        std::uint32_t _content_;
+
+        static const int MAX_REGISTER = 0x7F;
+        static const int RK_CONSTANT = 0x80;
+        static const int MAX_BX = 0xFFFF;
+        static const int MAX_SBX = 0x7FFF;
+
+        RInstruction() {
+            _content_ = 0;
+        }
+
+        RInstruction(RVM_CODE _code, int a, int b = 0, int c = 0) {
+            _content_ = static_cast<std::uint32_t>(_code) & 0xFF;
+            _content_ |= static_cast<std::uint32_t>(a & 0xFF) << 8;
+            _content_ |= static_cast<std::uint32_t>(b & 0xFF) << 16;
+            _content_ |= static_cast<std::uint32_t>(c & 0xFF) << 24;
+        }
+
+        static RInstruction ABx(RVM_CODE _code, int a, int bx) {
+            RInstruction inst(_code, a);
+            inst._content_ |= static_cast<std::uint32_t>(bx & 0xFFFF) << 16;
+            return inst;
+        }
+
+        inline static bool IsConstant(int rk) {
+            return (rk & RK_CONSTANT) != 0;
+        }
+
+        inline static int RKIndex(int rk) {
+            return rk & MAX_REGISTER;
+        }
+
+        inline RVM_CODE GetCode() const {
+            return static_cast<RVM_CODE>(_content_ & 0xFF);
+        }
+
+        inline int GetA() const {
+            return (_content_ >> 8) & 0xFF;
+        }
+
+        inline int GetB() const {
+            return (_content_ >> 16) & 0xFF;
+        }
+
+        inline int GetC() const {
+            return (_content_ >> 24) & 0xFF;
+        }
+
+        inline int GetBx() const {
+            return (_content_ >> 16) & 0xFFFF;
+        }
+
+        inline int GetSBx() const {
+            return static_cast<std::int16_t>((_content_ >> 16) & 0xFFFF);
+        }
+
+    private:
+
+        static const char *CodeToString(RVM_CODE vc) {
+#define CC(NAME, CODE) \
+case RVM_CODE::NAME: \
+            return #NAME ;
+
+            switch (vc) {
+                RVM_CODES(CC)
+                default:
+                    return "";
+            }
+        }
+
+#undef CC
+
+    public:
+
+        static std::string ToString(const RInstruction &inst) {
+            std::stringstream ss;
+            ss << CodeToString(inst.GetCode()) << "\t" << inst.GetA()
+               << "\t" << inst.GetB() << "\t" << inst.GetC();
+            return ss.str();
+        }
+
+    };
+
+};
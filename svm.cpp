@@ -1,224 +1,787 @@
 #include "svm.h"
+#include "rvm.h"
 #include "function.h"
 #include "upvalue.h"
 #include "string.h"
 #include "GC.h"
 #include "Dict.h"
+#include "Generator.h"
 #include "context.h"
-
-#define TOP(INDEX) sc->Top(INDEX)
-#define POP() sc->Pop()
-#define PUSH(VAL) sc->Push(VAL)
-#define GET_VAR(INDEX) sc->GetVariable(INDEX)
-#define GET_UPVAL(INDEX) sc->GetUpValue(INDEX)
-#define SET_VAR(INDEX, VAL) sc->SetVariable(INDEX, VAL)
-#define SET_UPVAL(INDEX, VAL) sc->SetUpValue(INDEX, VAL)
+#include "arith.h"
+#include "inline_cache.h"
+#include "jit.h"
+#include "trace.h"
+#include <algorithm>
+
+#define TOP(INDEX) (*(sp - 1 - (INDEX)))
+#define POP() Pop()
+#define PUSH(VAL) Push(VAL)
+#define GET_VAR(INDEX) vars[INDEX]
+#define GET_UPVAL(INDEX) frame->function->upvalues[INDEX]
+#define SET_VAR(INDEX, VAL) (vars[INDEX] = (VAL))
+
+// GC may only run at safepoints: backward jumps, calls and allocations
+#define SAFEPOINT() Context::GetGC()->CheckAndGC()
+
+// anything that runs other code may push frames, which
+// moves the frames and maybe the value stack
+#define RELOAD() do { \
+    frame = &frames.back(); \
+    vars = stack + frame->base; \
+} while(0)
+
+// the code of the top frame
+#define LOAD_FRAME() do { \
+    RELOAD(); \
+    constants = frame->function->codepack->_constants; \
+    feedback = frame->function->codepack->_feedback; \
+    inst = frame->pc; \
+} while(0)
+
+// the type feedback slot of the current operator, which
+// carries its index as the param
+#define OPERATOR_FEEDBACK() feedback[current->GetParam()]
+
+// the type feedback slot of the current instruction
+#define FEEDBACK() (frame->function->codepack->_feedback_sites[ \
+    current - frame->function->codepack->_instructions])
+
+#ifdef HALANG_THREADED_CODE
+#define HANDLER(NAME) LABEL_##NAME:
+#define DISPATCH() do { \
+    current = inst++; \
+    goto *table[static_cast<int>(current->GetCode())]; \
+} while(0)
+#define NEXT() DISPATCH()
+// every code goes through the recorder first while a loop is recorded
+#define RECORDING(ON) (table = (ON) ? record_table : dispatch_table)
+#else
+#define HANDLER(NAME) case VM_CODE::NAME:
+#define NEXT() continue
+#define RECORDING(ON) (recording_loop = (ON))
+#endif
+
+// a quickened code meeting what it was not specialized to is
+// rewritten back to the generic one, which goes on with it at once
+#define DEOPTIMIZE(NAME) do { \
+    *current = Instruction(VM_CODE::NAME, current->GetParam()); \
+    goto GENERIC_##NAME; \
+} while(0)
+
+// left operand on the top, right one under it, both stay
+// there while the prototype is called, the right one as the
+// argument
+#define ARITH_OPERATOR(NAME, STR) \
+HANDLER(NAME) { \
+    Value left = TOP(0); \
+    Value right = TOP(1); \
+    Value result; \
+    OPERATOR_FEEDBACK().RecordOperands(left, right); \
+    if (arith::NAME(left, right, result)) { \
+        sp -= 2; \
+        PUSH(result); \
+        NEXT(); \
+    } \
+    OPERATOR_FEEDBACK().RecordFallback(left); \
+    FunctionArgs _args(stack, static_cast<size_type>(sp - stack) - 2, 1); \
+    result = StackVM::InvokeOperator(left, Context::StringBuffer::STR, _args); \
+    RELOAD(); \
+    sp -= 2; \
+    PUSH(result); \
+    SAFEPOINT(); \
+    NEXT(); \
+}
 
 namespace halang {
 
-    StackVM::StackVM() {
+    StackVM::StackVM() :
+            stack(nullptr), sp(nullptr), stack_size(0), jit_depth(0),
+            recording(nullptr), recording_frame(0) {
         Context::vm = this;
         Context::runningContexts = new std::vector<ScriptContext *>();
 
+        stack_size = INITIAL_STACK_SIZE;
+        stack = new Value[stack_size];
+        sp = stack;
+
         Context::InitializeDefaultPrototype();
     }
 
     StackVM::~StackVM() {
         delete Context::runningContexts;
         Context::runningContexts = nullptr;
+        delete[] stack;
     }
 
     void StackVM::InitializeFunction(Function *fun) {
     }
 
 
-    Value StackVM::CallFunction(Function *_fun, Value _self, FunctionArgs *args) {
+    Value StackVM::CallFunction(Function *_fun, Value _self, FunctionArgs args) {
+
+        if (_fun->isExtern)
+            return _fun->externFunction(_self, args);
+
+        if (_fun->codepack->format == CodeFormat::Register)
+            return RegisterVM::CallFunction(_fun, _self, args);
+
+        if (_fun->codepack->is_generator)
+            return NewGenerator(_fun, _self, args);
 
-        if (args == nullptr)
-            args = Context::GetGC()->New<FunctionArgs>();
-        Executor executor(_self, _fun, args);
-        executor.Execute();
+        // the arguments go on the value stack as the caller
+        // in the bytecode would have pushed them
+        auto nargs = args.GetLength();
+        GrowStack(nargs);
+        auto base = static_cast<size_type>(sp - stack);
+        for (unsigned int i = 0; i < nargs; ++i)
+            Push(args.At(i));
 
-        return executor.ReturnValue();
+        auto entry = static_cast<size_type>(frames.size());
+        PushFrame(_fun, _self, base, nargs);
+        try {
+            return Run(entry);
+        } catch (...) {
+            // an error leaves every frame it went through
+            while (frames.size() > entry)
+                PopFrame();
+            throw;
+        }
     }
 
-    StackVM::Executor::Executor(Value _self, Function *_fn,
-                                FunctionArgs *_args) :
-            self(_self), fun(_fn), args(_args) {
-        sc = Context::GetGC()->New<ScriptContext>(_fn);
-        Context::GetRunningContexts()->push_back(sc);
+    Value StackVM::InvokeOperator(Value _self, String *name, FunctionArgs _args) {
+        auto proto = _self.GetPrototype();
+        Value vfun;
+
+        if (!proto->TryGetValue(name->toValue(), vfun))
+            throw std::runtime_error("This object does not contain that property.");
+
+        auto _fun = reinterpret_cast<Function *>(vfun.AsGC());
+        return Context::GetVM()->CallFunction(_fun, _self, _args);
     }
 
-    StackVM::Executor::~Executor() {
-        Context::GetRunningContexts()->pop_back();
+    Value StackVM::NewGenerator(Function *fun, Value self, FunctionArgs args) {
+        auto sc = Context::GetGC()->New<ScriptContext>(fun);
+        auto nargs = std::min(static_cast<size_type>(args.GetLength()), sc->variable_size);
+        for (size_type i = 0; i < nargs; ++i) {
+            sc->variables[i] = args.At(i);
+            GC::WriteBarrier(sc, sc->variables[i]);
+        }
+        return Context::GetGC()->New<Generator>(self, sc)->toValue();
     }
 
-    void StackVM::Executor::LoadArguments(FunctionArgs *_args) {
-        args = _args;
+    Value StackVM::Resume(Generator *gen) {
+        if (!PushGeneratorFrame(gen))
+            return Value();
+
+        auto entry = static_cast<size_type>(frames.size()) - 1;
+        try {
+            return Execute(entry);
+        } catch (...) {
+            while (frames.size() > entry)
+                PopFrame();
+            throw;
+        }
     }
 
-    void StackVM::Executor::Execute() {
-        if (fun->isExtern)
-            returnValue = fun->externFunction(self, *args);
-        else {
-            // load args
-            for (unsigned int i = 0; i < args->GetLength(); ++i)
-                sc->variables[i] = args->At(i);
+    bool StackVM::PushGeneratorFrame(Generator *gen) {
+        if (gen->state == Generator::State::Running)
+            throw std::runtime_error("generator is already running");
+        if (gen->state == Generator::State::Done)
+            return false;
+
+        ScriptContext *sc = gen->context;
+        auto var_size = sc->variable_size;
+        auto operands = static_cast<size_type>(sc->sptr - sc->stack);
+        auto base = static_cast<size_type>(sp - stack);
+
+        GrowStack(var_size + VM_STACK_SIZE);
+        Value *vars = stack + base;
+        std::copy(sc->variables, sc->variables + var_size, vars);
+        std::copy(sc->stack, sc->sptr, vars + var_size);
+        sp = vars + var_size + operands;
+
+        frames.emplace_back();
+        Frame &frame = frames.back();
+        frame.function = sc->function;
+        frame.self = gen->self;
+        frame.pc = sc->saved_ptr;
+        frame.base = base;
+        frame.generator = gen;
+
+        // the open upvalues come back to the value stack
+        frame.host_upvals.swap(sc->host_upvals);
+        for (auto i = frame.host_upvals.begin(); i != frame.host_upvals.end(); ++i)
+            if (!(*i)->closed()) {
+                (*i)->value = vars + ((*i)->value - sc->variables);
+                (*i)->host = nullptr;
+            }
 
-            inst = sc->function->codepack->_instructions;
+        gen->state = Generator::State::Running;
+        return true;
+    }
 
-            for (;;) {
-                InstIter current = inst++;
+    void StackVM::SuspendFrame(InstIter pc) {
+        Frame &frame = frames.back();
+        Generator *gen = frame.generator;
+        ScriptContext *sc = gen->context;
+        Value *vars = stack + frame.base;
+        auto var_size = sc->variable_size;
+
+        std::copy(vars, vars + var_size, sc->variables);
+        sc->sptr = std::copy(vars + var_size, sp, sc->stack);
+        sc->saved_ptr = pc;
+
+        // what the frame had on the value stack is now held by
+        // the ScriptContext, which may be old
+        for (Value *v = vars; v != sp; ++v)
+            GC::WriteBarrier(sc, *v);
+
+        frame.host_upvals.swap(sc->host_upvals);
+        for (auto i = sc->host_upvals.begin(); i != sc->host_upvals.end(); ++i) {
+            GC::WriteBarrier(sc, *i);
+            if (!(*i)->closed()) {
+                (*i)->value = sc->variables + ((*i)->value - vars);
+                (*i)->host = sc;
+                GC::WriteBarrier(*i, sc);
+            }
+        }
 
-                Value t1;
-                Function *func;
+        gen->state = Generator::State::Suspended;
+        sp = vars;
+        frames.pop_back();
+    }
 
-                switch (current->GetCode()) {
-                    case VM_CODE::STOP:
-                        goto OUT_LOOP;
-                        break;
-                    case VM_CODE::LOAD_V:
-                        PUSH(GET_VAR(current->GetParam()));
-                        break;
-                    case VM_CODE::LOAD_UPVAL: {
-                        auto _upval = GET_UPVAL(current->GetParam());
-                        PUSH(_upval->GetVal());
-                        break;
-                    }
-                    case VM_CODE::LOAD_C: {
-                        func = sc->function;
-                        PUSH(func->codepack->_constants[current->GetParam()]);
-                        break;
-                    }
-                    case VM_CODE::STORE_V:
-                        SET_VAR(current->GetParam(), POP());
-                        break;
-                    case VM_CODE::STORE_UPVAL: {
-                        auto _id = current->GetParam();
-                        auto _upval = GET_UPVAL(_id);
-                        _upval->SetVal(POP());
-                        break;
-                    }
-                    case VM_CODE::SET_VAL: {
-                        auto value = POP();
-                        auto key = POP();
-                        auto _dict = reinterpret_cast<Dict *>((POP()).value.gc);
-                        _dict->SetValue(key, value);
-                        PUSH(_dict->toValue());
-                        break;
-                    }
-                    case VM_CODE::GET_VAL: {
-                        auto key = POP();
-                        auto dict = reinterpret_cast<Dict *>((POP()).value.gc);
-                        PUSH(dict->GetValue(key));
-                        break;
-                    }
-                    case VM_CODE::PUSH_NULL:
-                        PUSH(Value());
-                        break;
-                    case VM_CODE::PUSH_INT:
-                        PUSH(Value(current->GetParam()));
-                        break;
-                    case VM_CODE::PUSH_BOOL:
-                        PUSH(Value(current->GetParam() != 0));
-                        break;
-                    case VM_CODE::POP:
-                        POP();
-                        break;
-                    case VM_CODE::JMP:
-                        inst += current->GetParam() - 1;
-                        break;
-                    case VM_CODE::CLOSURE: {
-                        Value v1 = POP();
-                        func = reinterpret_cast<Function *>(v1.value.gc);
+    /// <summary>
+    /// Make sure there are "needed" values above sp. The open
+    /// upvalues point into the value stack, so they are moved
+    /// with it.
+    /// </summary>
+    void StackVM::GrowStack(size_type needed) {
+        auto used = static_cast<size_type>(sp - stack);
+        if (used + needed <= stack_size)
+            return;
+
+        auto new_size = stack_size;
+        while (used + needed > new_size)
+            new_size *= 2;
+        if (new_size > MAX_STACK_SIZE)
+            throw std::runtime_error("stack overflow");
+
+        Value *new_stack = new Value[new_size];
+        std::copy(stack, sp, new_stack);
+
+        for (auto f = frames.begin(); f != frames.end(); ++f)
+            for (auto i = f->host_upvals.begin(); i != f->host_upvals.end(); ++i)
+                if (!(*i)->closed())
+                    (*i)->value = new_stack + ((*i)->value - stack);
+
+        delete[] stack;
+        stack = new_stack;
+        sp = new_stack + used;
+        stack_size = new_size;
+    }
 
-                        CodePack *cp = func->codepack;
-                        UpValue *_upval = nullptr;
-                        for (unsigned int i = 0; i < cp->_require_upvalues_size; ++i) {
+    void StackVM::PushFrame(Function *fun, Value self, size_type base, size_type nargs) {
+        auto cp = fun->codepack;
+        auto var_size = cp->_var_names_size;
 
-                            if (cp->_require_upvalues[i] >= 0) {
-                                _upval = Context::GetGC()->New<UpValue>(sc->variables + cp->_require_upvalues[i]);
-                                sc->host_upvals.push_back(_upval);
-                            } else
-                                _upval = sc->function->upvalues[(-1 - cp->_require_upvalues[i])];
+        if (cp->_jit == nullptr && ++cp->_call_count == Jit::GetThreshold() && Jit::IsEnabled())
+            Jit::Compile(cp);
 
-                            func->upvalues.push_back(_upval);
+        sp = stack + base + nargs;
+        GrowStack(var_size + VM_STACK_SIZE);
 
-                        }
-                        PUSH(func->toValue());
-                        break;
+        for (size_type i = nargs; i < var_size; ++i)
+            stack[base + i] = Value();
+        sp = stack + base + var_size;
 
-                    }
-                    case VM_CODE::CALL: {
+        frames.emplace_back();
+        Frame &frame = frames.back();
+        frame.function = fun;
+        frame.self = self;
+        frame.pc = fun->codepack->_instructions;
+        frame.base = base;
+        frame.generator = nullptr;
+    }
 
-                        t1 = POP();
-                        Value This = POP();
+    void StackVM::PopFrame() {
+        if (recording != nullptr && frames.size() == recording_frame + 1)
+            Tracer::Abort(this);
 
-                        func = reinterpret_cast<Function *>(t1.value.gc);
+        Frame &frame = frames.back();
+        for (auto i = frame.host_upvals.begin(); i != frame.host_upvals.end(); ++i)
+            (*i)->close();
 
-                        auto params_size = current->GetParam();
+        if (frame.generator != nullptr)
+            frame.generator->state = Generator::State::Done;
 
-                        FunctionArgs *args = Context::GetGC()->New<FunctionArgs>(params_size);
+        sp = stack + frame.base;
+        frames.pop_back();
+    }
 
-                        for (int i = 0; i < params_size; ++i)
-                            args->Set(params_size - i - 1, POP());
+    void StackVM::ReplaceFrame(Function *fun, Value self, size_type nargs) {
+        auto base = frames.back().base;
+        Value *args = sp - nargs;
 
-                        Executor executor(This, func, args);
+        PopFrame();
+        std::copy(args, args + nargs, stack + base);
+        PushFrame(fun, self, base, nargs);
+    }
 
-                        executor.Execute();
-                        sc->Push(executor.ReturnValue());
+    Value StackVM::GetProperty(Value obj, Value key, InlineCache &ic, bool &own,
+                               TypeFeedback *feedback) {
+        Value result;
+
+        Dict *_dict = obj.isDict() ? reinterpret_cast<Dict *>(obj.AsGC()) : nullptr;
+        Dict *proto = _dict == nullptr ? obj.GetPrototype() : nullptr;
+        Dict::size_type slot;
+
+        const InlineCache::Entry *en;
+        if (_dict == nullptr)
+            en = ic.Lookup(proto, key);
+        else if (_dict->GetShape() != nullptr)
+            en = ic.Lookup(_dict->GetShape(), key);
+        else
+            en = ic.Lookup(_dict, key);
+
+        if (en != nullptr) {
+            own = en->own;
+            result = en->slotted ? _dict->GetSlot(en->slot) : en->result;
+            return result;
+        }
 
-                        break;
-                    }
-                    case VM_CODE::DOT: {
-                        Value vo1, vs2;
-                        vs2 = POP();
-                        vo1 = POP();
-
-                        if (vo1.isDict()) {
-                            auto _dict = reinterpret_cast<Dict *>(vo1.value.gc);
-                            if (_dict->Exist(vs2)) {
-                                PUSH(_dict->GetValue(vs2));
-                                break;
+        if (feedback != nullptr)
+            feedback->RecordPrototype(proto != nullptr ? proto : _dict->GetPrototype());
+
+        if (_dict == nullptr) {
+            own = false;
+            if (!proto->TryGetValue(key, result))
+                throw std::runtime_error("This object does not contain that property.");
+            ic.Update(proto, key, result, false);
+        } else if (_dict->TryGetSlot(key, slot)) {
+            own = true;
+            result = _dict->GetSlot(slot);
+            ic.UpdateSlot(_dict->GetShape(), key, slot);
+        } else if (_dict->GetShape() == nullptr && _dict->TryGetValue(key, result)) {
+            own = true;
+            ic.Update(_dict, key, result, true);
+        } else {
+            own = false;
+            Dict *dict_proto = _dict->GetPrototype();
+            if (dict_proto == nullptr || !dict_proto->TryGetValue(key, result))
+                throw std::runtime_error("This object does not contain that property.");
+        }
+        return result;
+    }
+
+    bool StackVM::CallsNativeOnly(const TypeFeedback *feedback) {
+        if (feedback->callees.megamorphic)
+            return false;
+        for (unsigned int i = 0; i < feedback->callees.size; ++i) {
+            Function *callee = feedback->callees.entries[i];
+            if (!callee->isExtern || callee == Context::_gen_next_fun)
+                return false;
+        }
+        return true;
+    }
+
+    void StackVM::Capture(Function *func) {
+        Frame &frame = frames.back();
+        Value *vars = stack + frame.base;
+
+        CodePack *cp = func->codepack;
+        UpValue *_upval = nullptr;
+        GC::Mutation m;
+        for (unsigned int i = 0; i < cp->_require_upvalues_size; ++i) {
+
+            if (cp->_require_upvalues[i] >= 0) {
+                _upval = Context::GetGC()->New<UpValue>(vars + cp->_require_upvalues[i]);
+                frame.host_upvals.push_back(_upval);
+            } else
+                _upval = frame.function->upvalues[(-1 - cp->_require_upvalues[i])];
+
+            // the function is a constant of the code, old by now
+            func->upvalues.push_back(_upval);
+            GC::WriteBarrier(func, _upval);
+
+        }
+    }
+
+    Value StackVM::Run(size_type entry) {
+        for (;;) {
+            JitCode *code = frames[entry].function->codepack->_jit;
+            if (code == nullptr || jit_depth >= Jit::MAX_DEPTH)
+                return Execute(entry);
+
+            Value result;
+            ++jit_depth;
+            auto status = code->GetEntry()(this, &result, frames[entry].base * sizeof(Value));
+            --jit_depth;
+
+            switch (status) {
+                case JitCode::Returned:
+                    PopFrame();
+                    return result;
+                case JitCode::TailCalled:
+                    continue;
+                default:
+                    std::rethrow_exception(Jit::TakePending());
+            }
+        }
+    }
+
+    void StackVM::MarkRoots() {
+        for (Value *t = stack; t != sp; ++t)
+            GC::Shade(*t);
+
+        for (auto f = frames.begin(); f != frames.end(); ++f) {
+            GC::Shade(f->function);
+            GC::Shade(f->self);
+            if (f->generator != nullptr)
+                GC::Shade(f->generator);
+            for (auto i = f->host_upvals.begin(); i != f->host_upvals.end(); ++i)
+                GC::Shade(*i);
+        }
+    }
+
+    Value StackVM::Execute(size_type entry) {
+        Frame *frame;
+        Value *vars;
+        Value *constants;
+        TypeFeedback *feedback;
+        InstIter inst;
+        InstIter current;
+
+        LOAD_FRAME();
+
+#ifdef HALANG_THREADED_CODE
+#define LABEL_ADDR(NAME, CODE) &&LABEL_##NAME,
+        static void *dispatch_table[] = {
+            SVM_CODES(LABEL_ADDR)
+        };
+#undef LABEL_ADDR
+#define RECORD_ADDR(NAME, CODE) &&RECORD,
+        static void *record_table[] = {
+            SVM_CODES(RECORD_ADDR)
+        };
+#undef RECORD_ADDR
+        void **table = dispatch_table;
+
+        DISPATCH();
+
+        RECORD:
+        if (!Tracer::Record(this, current))
+            RECORDING(false);
+        goto *dispatch_table[static_cast<int>(current->GetCode())];
+#else
+        bool recording_loop = false;
+        for (;;) {
+            current = inst++;
+            if (recording_loop && !Tracer::Record(this, current))
+                RECORDING(false);
+            switch (current->GetCode()) {
+#endif
+                HANDLER(LOAD_V) {
+                    PUSH(GET_VAR(current->GetParam()));
+                    NEXT();
+                }
+                HANDLER(LOAD_G) {
+                    NEXT();
+                }
+                HANDLER(LOAD_UPVAL) {
+                    auto _upval = GET_UPVAL(current->GetParam());
+                    PUSH(_upval->GetVal());
+                    NEXT();
+                }
+                HANDLER(LOAD_C) {
+                    PUSH(constants[current->GetParam()]);
+                    NEXT();
+                }
+                HANDLER(STORE_V) {
+                    SET_VAR(current->GetParam(), POP());
+                    NEXT();
+                }
+                HANDLER(STORE_G) {
+                    NEXT();
+                }
+                HANDLER(STORE_UPVAL) {
+                    auto _id = current->GetParam();
+                    auto _upval = GET_UPVAL(_id);
+                    _upval->SetVal(POP());
+                    NEXT();
+                }
+                HANDLER(SET_VAL) {
+                    auto value = POP();
+                    auto key = POP();
+                    auto _dict = reinterpret_cast<Dict *>((POP()).AsGC());
+                    _dict->SetValue(key, value);
+                    PUSH(_dict->toValue());
+                    NEXT();
+                }
+                HANDLER(GET_VAL) {
+                    auto key = POP();
+                    auto dict = reinterpret_cast<Dict *>((POP()).AsGC());
+                    PUSH(dict->GetValue(key));
+                    NEXT();
+                }
+                HANDLER(PUSH_NULL) {
+                    PUSH(Value());
+                    NEXT();
+                }
+                HANDLER(PUSH_INT) {
+                    PUSH(Value(current->GetParam()));
+                    NEXT();
+                }
+                HANDLER(PUSH_BOOL) {
+                    PUSH(Value(current->GetParam() != 0));
+                    NEXT();
+                }
+                HANDLER(POP) {
+                    POP();
+                    NEXT();
+                }
+                HANDLER(JMP) {
+                    inst += current->GetParam() - 1;
+                    // a backward jump closes a loop, which the
+                    // tracer may record or run in its native code
+                    if (current->GetParam() < 0) {
+                        SAFEPOINT();
+                        if (Tracer::IsEnabled()) {
+                            frame->pc = inst;
+                            switch (Tracer::Loop(this, current)) {
+                                case Tracer::LoopState::Recording:
+                                    RECORDING(true);
+                                    break;
+                                case Tracer::LoopState::Ran:
+                                    LOAD_FRAME();
+                                    break;
+                                default:
+                                    break;
                             }
                         }
+                    }
+                    NEXT();
+                }
+                HANDLER(CLOSURE) {
+                    Value v1 = POP();
+                    Function *func = reinterpret_cast<Function *>(v1.AsGC());
+                    Capture(func);
+                    PUSH(func->toValue());
+                    SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(CALL) {
+                    GENERIC_CALL:
+                    Value t1 = POP();
+                    Value This = POP();
+
+                    Function *func = reinterpret_cast<Function *>(t1.AsGC());
+                    TypeFeedback *fb = FEEDBACK();
+                    fb->RecordCall(This, func);
+
+                    auto params_size = current->GetParam();
+
+                    // next() of a generator goes on in its frame
+                    // as a call would, without the native Resume
+                    if (This.isGenerator() && func == Context::_gen_next_fun) {
+                        sp -= params_size;
+                        frame->pc = inst;
+                        if (PushGeneratorFrame(reinterpret_cast<Generator *>(This.AsGC()))) {
+                            LOAD_FRAME();
+                            SAFEPOINT();
+                        } else
+                            PUSH(Value());
+                        NEXT();
+                    }
+
+                    // a call of a stack function only opens a frame
+                    // over the arguments, no native recursion
+                    if (!func->isExtern && func->codepack->format == CodeFormat::Stack &&
+                        !func->codepack->is_generator) {
+                        frame->pc = inst;
+                        PushFrame(func, This, static_cast<size_type>(sp - stack) - params_size,
+                                  params_size);
+
+                        // compiled code runs on the native stack, as
+                        // deep as it may, the interpreter goes on
+                        // with the frame otherwise
+                        if (func->codepack->_jit != nullptr && jit_depth < Jit::MAX_DEPTH) {
+                            Value result = Run(static_cast<size_type>(frames.size()) - 1);
+                            RELOAD();
+                            PUSH(result);
+                            SAFEPOINT();
+                            NEXT();
+                        }
 
-                        auto proto = vo1.GetPrototype();
-                        Value vfun;
+                        LOAD_FRAME();
+                        SAFEPOINT();
+                        NEXT();
+                    }
 
-                        bool ok = proto->TryGetValue(vs2, vfun);
-                        if (ok) {
-                            PUSH(vo1); // this
-                            PUSH(vfun);
-                        } else
-                            throw std::runtime_error("This object does not contain that property.");
+                    if (func->isExtern && CallsNativeOnly(fb))
+                        *current = Instruction(VM_CODE::CALL_NATIVE, params_size);
 
-                        break;
+                    // the arguments stay where they were pushed
+                    FunctionArgs args(stack, static_cast<size_type>(sp - stack) - params_size,
+                                      params_size);
+                    Value result = CallFunction(func, This, args);
+                    RELOAD();
+                    sp -= params_size;
+                    PUSH(result);
+
+                    SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(CALL_NATIVE) {
+                    Value t1 = TOP(0);
+                    Function *func = reinterpret_cast<Function *>(t1.AsGC());
+                    if (!t1.isFunction() || !func->isExtern || func == Context::_gen_next_fun)
+                        DEOPTIMIZE(CALL);
+
+                    POP();
+                    Value This = POP();
+                    FEEDBACK()->RecordCall(This, func);
+                    auto params_size = current->GetParam();
+
+                    FunctionArgs args(stack, static_cast<size_type>(sp - stack) - params_size,
+                                      params_size);
+                    Value result = func->externFunction(This, args);
+                    RELOAD();
+                    sp -= params_size;
+                    PUSH(result);
+
+                    SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(TAIL_CALL) {
+                    Value t1 = POP();
+                    Value This = POP();
+
+                    Function *func = reinterpret_cast<Function *>(t1.AsGC());
+                    FEEDBACK()->RecordCall(This, func);
+
+                    auto params_size = current->GetParam();
+
+                    // a generator frame must end with its own
+                    // RETURN, which finishes the generator
+                    if (!func->isExtern && func->codepack->format == CodeFormat::Stack &&
+                        !func->codepack->is_generator && frame->generator == nullptr) {
+                        ReplaceFrame(func, This, params_size);
+                        LOAD_FRAME();
+                        SAFEPOINT();
+                        NEXT();
                     }
-                    case VM_CODE::RETURN:
-                        if (current->GetParam() != 0)
-                            returnValue = sc->Pop();
 
-                        sc->CloseAllUpValue();
+                    // nothing to take over in an extern or a register
+                    // function, so call it and return what it returns
+                    FunctionArgs args(stack, static_cast<size_type>(sp - stack) - params_size,
+                                      params_size);
+                    Value result = CallFunction(func, This, args);
 
-                        goto OUT_LOOP;
-                        break;
-                    case VM_CODE::IFNO:
-                        if (!POP())
-                            inst += current->GetParam() - 1;
-                        break;
-                    case VM_CODE::OUT:
-                        break;
+                    PopFrame();
+                    if (frames.size() == entry)
+                        return result;
+
+                    LOAD_FRAME();
+                    PUSH(result);
+                    SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(DOT) {
+                    GENERIC_DOT:
+                    Value vo1, vs2;
+                    vs2 = POP();
+                    vo1 = POP();
+
+                    TypeFeedback *fb = FEEDBACK();
+                    fb->RecordReceiver(vo1);
+
+                    InlineCache &ic = frame->function->codepack->_inline_caches[current->GetParam()];
+                    bool own;
+                    Value result = GetProperty(vo1, vs2, ic, own, fb);
+
+                    // a site which has only seen strings so far
+                    if (vo1.isString() && fb->types == TypeFeedback::Bit(TypeId::String))
+                        *current = Instruction(VM_CODE::DOT_STR_PROTO, current->GetParam());
+
+                    if (!own)
+                        PUSH(vo1); // this
+                    PUSH(result);
+                    NEXT();
                 }
+                HANDLER(DOT_STR_PROTO) {
+                    if (!TOP(1).isString())
+                        DEOPTIMIZE(DOT);
+
+                    Value vs2 = POP();
+                    Value vo1 = POP();
+                    FEEDBACK()->RecordReceiver(vo1);
+
+                    // a string has no properties of its own, only
+                    // those of the string prototype, which the
+                    // version of it keeps cached
+                    InlineCache &ic = frame->function->codepack->_inline_caches[current->GetParam()];
+                    const InlineCache::Entry *en = ic.Lookup(Context::GetStringPrototype(), vs2);
+                    if (en != nullptr) {
+                        PUSH(vo1); // this
+                        PUSH(en->result);
+                        NEXT();
+                    }
 
-                Context::GetGC()->CheckAndGC();
+                    bool own;
+                    Value result = GetProperty(vo1, vs2, ic, own, FEEDBACK());
+                    PUSH(vo1); // this
+                    PUSH(result);
+                    NEXT();
+                }
+                HANDLER(STOP)
+                HANDLER(RETURN) {
+                    Value result;
+                    if (current->GetCode() == VM_CODE::RETURN && current->GetParam() != 0)
+                        result = POP();
+
+                    PopFrame();
+                    if (frames.size() == entry)
+                        return result;
+
+                    LOAD_FRAME();
+                    PUSH(result);
+                    SAFEPOINT();
+                    NEXT();
+                }
+                HANDLER(YIELD) {
+                    Value result;
+                    if (current->GetParam() != 0)
+                        result = POP();
+
+                    if (frame->generator == nullptr)
+                        throw std::runtime_error("yield outside of a generator");
+
+                    // back to the frame which resumed the generator
+                    SuspendFrame(inst);
+                    if (frames.size() == entry)
+                        return result;
+
+                    LOAD_FRAME();
+                    PUSH(result);
+                    NEXT();
+                }
+                HANDLER(IFNO) {
+                    if (!POP()) {
+                        inst += current->GetParam() - 1;
+                        if (current->GetParam() < 0)
+                            SAFEPOINT();
+                    }
+                    NEXT();
+                }
+                HANDLER(OUT) {
+                    NEXT();
+                }
+                ARITH_OPERATORS(ARITH_OPERATOR)
+#ifndef HALANG_THREADED_CODE
             }
-            OUT_LOOP:;
         }
-    }
-
-    Value StackVM::Executor::ReturnValue() {
-        return returnValue;
+#endif
     }
 
 }
@@ -11,61 +11,182 @@
 
 #define PRE(POINTER) ((POINTER) - 1)
 
+// computed goto dispatch, define HALANG_NO_THREADED_CODE to
+// fall back to the portable switch loop
+#if defined(__GNUC__) && !defined(HALANG_NO_THREADED_CODE)
+#define HALANG_THREADED_CODE
+#endif
+
 namespace halang {
     class CodePack;
+    class String;
+    class Generator;
+    class Trace;
+    struct InlineCache;
+    struct TypeFeedback;
 
     typedef Instruction *InstIter;
 
+    /// <summary>
+    /// Activation record of a stack format function.
+    ///
+    /// A frame is a window into the value stack of the StackVM,
+    /// the variables start at base and the operands follow them.
+    /// The arguments pushed by the caller become the first
+    /// variables in place.
+    /// </summary>
+    struct Frame {
+        Function *function;
+        Value self;
+        InstIter pc;            // where the frame goes on after a call
+        unsigned int base;      // index of the variables in the value stack
+        Generator *generator;   // the generator run by this frame, if any
+
+        /// <summary>
+        /// the upvalues created in this frame, they are closed
+        /// when the frame returns.
+        /// </summary>
+        std::vector<UpValue *> host_upvals;
+    };
+
     final class StackVM  {
     public:
 
         friend class GC;
 
-        class Executor;
-
-        StackVM();
-
-        StackVM(const StackVM &) = delete;
-
-        StackVM &operator=(const StackVM &) = delete;
+        friend class Jit;
 
-        void InitializeFunction(Function *);
+        friend class JitCompiler;
 
+        friend class Tracer;
 
-        Value CallFunction(Function *function, Value self, FunctionArgs *args = nullptr);
+        typedef unsigned int size_type;
 
-        ~StackVM();
+        static const size_type INITIAL_STACK_SIZE = 4 * VM_STACK_SIZE;
 
-    private:
+        // deep recursion ends with "stack overflow" at this size
+        static const size_type MAX_STACK_SIZE = 1 << 22;
 
-        InstIter inst;
-        Value *ptr;
+        StackVM();
 
-        GC gc;
+        StackVM(const StackVM &) = delete;
 
-    };
+        StackVM &operator=(const StackVM &) = delete;
 
-    class StackVM::Executor {
-    public:
+        void InitializeFunction(Function *);
 
-        Executor(Value _self, Function *, FunctionArgs *args = nullptr);
 
-        void LoadArguments(FunctionArgs *);
+        /// <summary>
+        /// Call "function" from native code, the arguments are
+        /// copied onto the value stack for a stack format function.
+        /// </summary>
+        Value CallFunction(Function *function, Value self, FunctionArgs args = FunctionArgs());
 
-        void Execute();
+        /// <summary>
+        /// Call the method named by "name" on the prototype of "self",
+        /// the operators without an inline path are all resolved in this way.
+        /// </summary>
+        static Value InvokeOperator(Value self, String *name, FunctionArgs args);
 
-        Value ReturnValue();
+        /// <summary>
+        /// Run the generator from where it is suspended until it
+        /// yields or returns, a finished generator gives null.
+        /// </summary>
+        Value Resume(Generator *);
 
-        ~Executor();
+        ~StackVM();
 
     private:
 
-        Value self;
-        ScriptContext *sc;
-        Function *fun;
-        FunctionArgs *args;
-        InstIter inst;
-        Value returnValue;
+        /// <summary>
+        /// Run the frames from the top one until the frame
+        /// at depth "entry" returns.
+        /// </summary>
+        Value Execute(size_type entry);
+
+        /// <summary>
+        /// Run the frame at depth "entry" until it returns, by its
+        /// native code if the JIT has compiled it, or by Execute.
+        /// </summary>
+        Value Run(size_type entry);
+
+        /// <summary>
+        /// Push a frame for "fun" whose "nargs" arguments
+        /// are already on the value stack at "base".
+        /// </summary>
+        void PushFrame(Function *fun, Value self, size_type base, size_type nargs);
+
+        void PopFrame();
+
+        /// <summary>
+        /// Put a frame for "fun" in the place of the top one, the
+        /// "nargs" arguments on the top of the value stack move down
+        /// to its base. Tail calls run in constant stack this way.
+        /// </summary>
+        void ReplaceFrame(Function *fun, Value self, size_type nargs);
+
+        /// <summary>
+        /// Move the top frame, which runs a generator, into the
+        /// ScriptContext of the generator and pop it.
+        /// </summary>
+        void SuspendFrame(InstIter pc);
+
+        /// <summary>
+        /// Push the frame of a suspended generator on the top of
+        /// the value stack, false if the generator is done.
+        /// </summary>
+        bool PushGeneratorFrame(Generator *);
+
+        Value NewGenerator(Function *fun, Value self, FunctionArgs args);
+
+        void GrowStack(size_type needed);
+
+        /// <summary>
+        /// Look "key" up in "obj" through the inline cache of the site,
+        /// "own" tells if it is not from the prototype. A miss records
+        /// the prototype of "obj" in the feedback of the site, if any.
+        /// </summary>
+        Value GetProperty(Value obj, Value key, InlineCache &ic, bool &own,
+                          TypeFeedback *feedback = nullptr);
+
+        /// <summary>
+        /// Only extern functions have been called at the site, so a
+        /// CALL of one may become CALL_NATIVE.
+        /// </summary>
+        static bool CallsNativeOnly(const TypeFeedback *feedback);
+
+        /// <summary>
+        /// Give "func" the upvalues it requires from the top frame.
+        /// </summary>
+        void Capture(Function *func);
+
+        void MarkRoots();
+
+        inline void Push(Value v) {
+            *(sp++) = v;
+        }
+
+        inline Value Pop() {
+            return *(--sp);
+        }
+
+        // the operand stack of a frame never goes beyond
+        // VM_STACK_SIZE, which PushFrame makes sure is there,
+        // so Push does not check.
+        Value *stack;
+        Value *sp;
+        size_type stack_size;
+
+        std::vector<Frame> frames;
+
+        // native frames of the JIT on the native stack
+        size_type jit_depth;
+
+        // the loop being recorded and the depth of its frame
+        Trace *recording;
+        size_type recording_frame;
+
+        GC gc;
 
     };
 
@@ -25,6 +25,20 @@
     V(JMP,                0x12) \
     V(OUT,                0x13) \
     V(STOP,                0x14) \
+    V(ADD,                0x15) \
+    V(SUB,                0x16) \
+    V(MUL,                0x17) \
+    V(DIV,                0x18) \
+    V(MOD,                0x19) \
+    V(LT,                0x1a) \
+    V(GT,                0x1b) \
+    V(LTEQ,                0x1c) \
+    V(GTEQ,                0x1d) \
+    V(EQ,                0x1e) \
+    V(TAIL_CALL,        0x1f) \
+    V(YIELD,            0x20) \
+    V(DOT_STR_PROTO,    0x21) \
+    V(CALL_NATIVE,        0x22) \
 
 namespace halang {
 #define CC(NAME, CODE) NAME = CODE ,
@@ -33,27 +47,77 @@ namespace halang {
     };
 #undef CC
 
+    namespace detail {
+#define CC(NAME, CODE) CODE ,
+        constexpr int vm_code_values[] = { SVM_CODES(CC) };
+#undef CC
+
+        constexpr bool CodesAreDense(unsigned int i = 0) {
+            return i == sizeof(vm_code_values) / sizeof(int) ||
+                   (vm_code_values[i] == static_cast<int>(i) && CodesAreDense(i + 1));
+        }
+    }
+
+    // the threaded dispatch table is indexed by the code itself
+    static_assert(detail::CodesAreDense(), "SVM_CODES must be numbered densely from 0x00");
+
+    /// <summary>
+    /// 32-bit stack instruction
+    ///
+    ///   | param : 24 (signed) | code : 8 |
+    ///
+    /// Decoding is a mask for the code and an arithmetic
+    /// shift for the param.
+    /// </summary>
     struct Instruction {
-        std::uint16_t _content_;
+        std::uint32_t _content_;
+
+        static const int MAX_PARAM = (1 << 23) - 1;
+        static const int MIN_PARAM = -(1 << 23);
 
         Instruction() {
             _content_ = 0;
         }
 
-        Instruction(VM_CODE _code, int param) : _content_(static_cast<std::int16_t>(_code)) {
-            _content_ = ((_content_ << 8) | (param & 0xFF));
+        Instruction(VM_CODE _code, int param) {
+            _content_ = (static_cast<std::uint32_t>(param) << 8) |
+                        (static_cast<std::uint32_t>(_code) & 0xFF);
         }
 
         Instruction(const Instruction &_another) {
             _content_ = _another._content_;
         }
 
+        inline static bool ParamFits(long long param) {
+            return param >= MIN_PARAM && param <= MAX_PARAM;
+        }
+
         inline VM_CODE GetCode() const {
-            return static_cast<VM_CODE>((_content_ >> 8) & 0xFF);
+            return static_cast<VM_CODE>(_content_ & 0xFF);
         }
 
-        inline std::int8_t GetParam() const {
-            return static_cast<int8_t>(_content_ & 0xFF);
+        inline int GetParam() const {
+            return static_cast<std::int32_t>(_content_) >> 8;
+        }
+
+        /// <summary>
+        /// The code a quickened one was rewritten from. Only the
+        /// interpreter tells them apart; everything else reading the
+        /// instructions sees the generic code, with the same param.
+        /// </summary>
+        inline VM_CODE GetGenericCode() const {
+            switch (GetCode()) {
+                case VM_CODE::DOT_STR_PROTO:
+                    return VM_CODE::DOT;
+                case VM_CODE::CALL_NATIVE:
+                    return VM_CODE::CALL;
+                default:
+                    return GetCode();
+            }
+        }
+
+        inline Instruction Generic() const {
+            return Instruction(GetGenericCode(), GetParam());
         }
 
     private:
@@ -76,10 +140,12 @@ case VM_CODE::NAME: \
 
         static std::string ToString(const Instruction &inst) {
             std::stringstream ss;
-            ss << CodeToString(inst.GetCode()) << "\t" << static_cast<int>(inst.GetParam());
+            ss << CodeToString(inst.GetCode()) << "\t" << inst.GetParam();
             return ss.str();
         }
 
     };
 
+    static_assert(sizeof(Instruction) == 4, "Instruction must be 32-bit");
+
 };
@@ -0,0 +1,416 @@
+#define CATCH_CONFIG_MAIN
+// the alternate signal stack of catch needs a constant SIGSTKSZ
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "catch.hpp"
+#include "svm.h"
+#include "context.h"
+#include "arith.h"
+#include "BigInt.h"
+#include "Dict.h"
+#include "function.h"
+
+using namespace halang;
+
+typedef BigInt::Magnitude Magnitude;
+
+// the first machine sets up the GC and the prototypes
+static StackVM *Setup() {
+    static StackVM *vm = new StackVM();
+    return vm;
+}
+
+static Value Parse(const std::string &text) {
+    Value v;
+    REQUIRE(BigInt::Parse(text, v));
+    return v;
+}
+
+static std::string Dec(Value v) {
+    return BigInt::Format(v, 10);
+}
+
+static bool Same(Value a, Value b) {
+    int order;
+    return BigInt::Compare(a, b, order) && order == 0;
+}
+
+// a small int where one can hold it, a BigInt with no zero limb
+// on the top otherwise
+static void RequireNormal(Value v) {
+    if (v.isSmallInt())
+        return;
+    REQUIRE(v.isBigInt());
+    auto big = reinterpret_cast<BigInt *>(v.AsGC());
+    Magnitude m = big->GetMagnitude();
+    REQUIRE(!m.empty());
+    REQUIRE(m.back() != 0);
+    REQUIRE(BigInt::Normalize(big->IsNegative(), std::move(m)).isBigInt());
+}
+
+// the reference the Karatsuba product is checked against
+static Magnitude Schoolbook(const Magnitude &a, const Magnitude &b) {
+    Magnitude r(a.size() + b.size(), 0);
+    for (std::size_t i = 0; i < a.size(); ++i) {
+        std::uint64_t carry = 0;
+        for (std::size_t j = 0; j < b.size(); ++j) {
+            std::uint64_t t = static_cast<std::uint64_t>(a[i]) * b[j] + r[i + j] + carry;
+            r[i + j] = static_cast<BigInt::limb_type>(t);
+            carry = t >> 32;
+        }
+        r[i + b.size()] = static_cast<BigInt::limb_type>(carry);
+    }
+    while (!r.empty() && r.back() == 0)
+        r.pop_back();
+    return r;
+}
+
+// "limbs" limbs of pseudo random hex digits, the top one not zero
+static std::string RandomHex(std::size_t limbs, std::uint32_t seed) {
+    static const char *HEX = "0123456789abcdef";
+    std::string s = "0x";
+    std::uint32_t x = seed;
+    for (std::size_t i = 0; i < limbs * 8; ++i) {
+        x = x * 1664525u + 1013904223u;
+        char c = HEX[(x >> 28) & 0xf];
+        if (i == 0 && c == '0')
+            c = '1';
+        s.push_back(c);
+    }
+    return s;
+}
+
+static const Magnitude &MagnitudeOf(Value v) {
+    REQUIRE(v.isBigInt());
+    return reinterpret_cast<BigInt *>(v.AsGC())->GetMagnitude();
+}
+
+TEST_CASE("BigInt carries and borrows across limbs", "[BigInt]") {
+    Setup();
+
+    Value ones = Parse("0xffffffffffffffffffffffff");
+    Value one = Value(static_cast<TSmallInt>(1));
+
+    Value sum = BigInt::Add(ones, one);
+    REQUIRE(BigInt::Format(sum, 16) == "0x1000000000000000000000000");
+    REQUIRE(MagnitudeOf(sum).size() == 4);
+
+    Value back = BigInt::Sub(sum, one);
+    REQUIRE(BigInt::Format(back, 16) == "0xffffffffffffffffffffffff");
+    REQUIRE(MagnitudeOf(back).size() == 3);
+
+    // adding a negative one borrows the same way
+    REQUIRE(Same(BigInt::Add(sum, Value(static_cast<TSmallInt>(-1))), ones));
+    REQUIRE(BigInt::Format(BigInt::Sub(one, sum), 16) == "-0xffffffffffffffffffffffff");
+
+    // a carry out of every limb of the product
+    Value square = BigInt::Mul(ones, ones);
+    REQUIRE(BigInt::Format(square, 16) == "0xfffffffffffffffffffffffe000000000000000000000001");
+
+    // the difference of two close ones has limbs to trim
+    Value a = Parse("0x1000000000000000000000005");
+    Value b = Parse("0x1000000000000000000000003");
+    Value d = BigInt::Sub(a, b);
+    REQUIRE(d.isSmallInt());
+    REQUIRE(d.AsSmallInt() == 2);
+    REQUIRE(Same(BigInt::Sub(b, a), Value(static_cast<TSmallInt>(-2))));
+}
+
+TEST_CASE("BigInt small int boundaries", "[BigInt]") {
+    Setup();
+
+    Value one = Value(static_cast<TSmallInt>(1));
+
+    Value over = arith::AddSmallInt(INT64_MAX, 1);
+    REQUIRE(over.isBigInt());
+    REQUIRE(Dec(over) == "9223372036854775808");
+    Value max = BigInt::Sub(over, one);
+    REQUIRE(Dec(max) == "9223372036854775807");
+    REQUIRE(max.isSmallInt() == Value::FitsSmallInt(INT64_MAX));
+
+    Value under = arith::SubSmallInt(INT64_MIN, 1);
+    REQUIRE(under.isBigInt());
+    REQUIRE(Dec(under) == "-9223372036854775809");
+    Value min = BigInt::Add(under, one);
+    REQUIRE(Dec(min) == "-9223372036854775808");
+    REQUIRE(min.isSmallInt() == Value::FitsSmallInt(INT64_MIN));
+
+    REQUIRE(Dec(arith::MulSmallInt(INT64_MIN, -1)) == "9223372036854775808");
+    REQUIRE(Dec(arith::DivSmallInt(INT64_MIN, -1)) == "9223372036854775808");
+    REQUIRE(Dec(arith::MulSmallInt(INT64_MAX, INT64_MAX)) ==
+            "85070591730234615847396907784232501249");
+
+    // the product goes back to a small int once divided
+    Value p = arith::MulSmallInt(INT64_MAX, 4);
+    Value q = BigInt::Div(p, Value(static_cast<TSmallInt>(4)));
+    REQUIRE(Dec(q) == "9223372036854775807");
+    REQUIRE(q.isSmallInt() == Value::FitsSmallInt(INT64_MAX));
+
+#ifdef HALANG_NAN_BOXING
+    // the payload of a NaN-boxed small int has 47 bits
+    const TSmallInt top = (static_cast<TSmallInt>(1) << 46) - 1;
+    REQUIRE(Value::FitsSmallInt(top));
+    REQUIRE(!Value::FitsSmallInt(top + 1));
+    REQUIRE(Value::FitsSmallInt(-top - 1));
+    REQUIRE(!Value::FitsSmallInt(-top - 2));
+
+    Value high = arith::AddSmallInt(top, 1);
+    REQUIRE(high.isBigInt());
+    REQUIRE(Dec(high) == "70368744177664");
+    Value low = BigInt::Sub(high, one);
+    REQUIRE(low.isSmallInt());
+    REQUIRE(low.AsSmallInt() == top);
+
+    Value below = arith::SubSmallInt(-top - 1, 1);
+    REQUIRE(below.isBigInt());
+    REQUIRE(Dec(below) == "-70368744177665");
+    Value bottom = BigInt::Add(below, one);
+    REQUIRE(bottom.isSmallInt());
+    REQUIRE(bottom.AsSmallInt() == -top - 1);
+
+    REQUIRE(arith::MulSmallInt(top, 2).isBigInt());
+    REQUIRE(BigInt::FromSmallInt(top + 1).isBigInt());
+    REQUIRE(BigInt::FromSmallInt(top).isSmallInt());
+#endif
+}
+
+TEST_CASE("BigInt Karatsuba against schoolbook", "[BigInt]") {
+    Setup();
+
+    const std::size_t K = BigInt::KARATSUBA_THRESHOLD;
+    const std::size_t sizes[][2] = {
+            {K, K},
+            {K, K + 1},
+            {K + 7, 3 * K},
+            {2 * K + 5, K},
+            {5 * K, 2 * K + 3},
+    };
+
+    for (std::size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        Value a = Parse(RandomHex(sizes[i][0], 17 + i));
+        Value b = Parse(RandomHex(sizes[i][1], 91 + i));
+        REQUIRE(MagnitudeOf(a).size() == sizes[i][0]);
+        REQUIRE(MagnitudeOf(b).size() == sizes[i][1]);
+
+        Magnitude expected = Schoolbook(MagnitudeOf(a), MagnitudeOf(b));
+        Value ab = BigInt::Mul(a, b);
+        REQUIRE(MagnitudeOf(ab) == expected);
+        REQUIRE(MagnitudeOf(BigInt::Mul(b, a)) == expected);
+
+        Value neg = BigInt::Mul(BigInt::Neg(a), b);
+        REQUIRE(MagnitudeOf(neg) == expected);
+        REQUIRE(reinterpret_cast<BigInt *>(neg.AsGC())->IsNegative());
+
+        // and the division takes it back apart
+        REQUIRE(Same(BigInt::Div(ab, b), a));
+        REQUIRE(Same(BigInt::Mod(ab, a), Value(static_cast<TSmallInt>(0))));
+    }
+}
+
+TEST_CASE("BigInt Div and Mod truncate", "[BigInt]") {
+    Setup();
+
+    Value a = Parse("1000000000000000000000000000007");
+    Value b = Parse("100000000000000000000");
+
+    REQUIRE(Dec(BigInt::Div(a, b)) == "10000000000");
+    REQUIRE(Dec(BigInt::Mod(a, b)) == "7");
+    REQUIRE(Dec(BigInt::Div(BigInt::Neg(a), b)) == "-10000000000");
+    REQUIRE(Dec(BigInt::Mod(BigInt::Neg(a), b)) == "-7");
+    REQUIRE(Dec(BigInt::Div(a, BigInt::Neg(b))) == "-10000000000");
+    REQUIRE(Dec(BigInt::Mod(a, BigInt::Neg(b))) == "7");
+    REQUIRE(Dec(BigInt::Div(BigInt::Neg(a), BigInt::Neg(b))) == "10000000000");
+    REQUIRE(Dec(BigInt::Mod(BigInt::Neg(a), BigInt::Neg(b))) == "-7");
+
+    // quotient times divisor plus remainder, with the remainder
+    // smaller than the divisor and the sign of the dividend
+    const char *dividends[] = {
+            "0x123456789abcdef0fedcba9876543210aaaaaaaa55555555",
+            "0xffffffffffffffffffffffffffffffffffffffff",
+            "0x80000000000000000000000000000000",
+    };
+    const char *divisors[] = {
+            "0x100000001",
+            "0xfedcba98765432100123",
+            "0x8000000000000000ffffffff",
+            "0xffffffffffffffffffffffffffffffff",
+    };
+    Value zero = Value(static_cast<TSmallInt>(0));
+    for (auto n : dividends)
+        for (auto m : divisors)
+            for (int signs = 0; signs < 4; ++signs) {
+                Value x = Parse(n), y = Parse(m);
+                if (signs & 1)
+                    x = BigInt::Neg(x);
+                if (signs & 2)
+                    y = BigInt::Neg(y);
+
+                Value q = BigInt::Div(x, y), r = BigInt::Mod(x, y);
+                RequireNormal(q);
+                RequireNormal(r);
+                REQUIRE(Same(BigInt::Add(BigInt::Mul(q, y), r), x));
+
+                int order;
+                Value absr = r, absy = y;
+                REQUIRE(BigInt::Compare(r, zero, order));
+                if (order < 0)
+                    absr = BigInt::Neg(r);
+                REQUIRE((order == 0 || (order < 0) == ((signs & 1) != 0)));
+                REQUIRE(BigInt::Compare(y, zero, order));
+                if (order < 0)
+                    absy = BigInt::Neg(y);
+                REQUIRE(BigInt::Compare(absr, absy, order));
+                REQUIRE(order < 0);
+
+                REQUIRE(BigInt::Compare(q, zero, order));
+                REQUIRE((order == 0 || (order < 0) == (signs == 1 || signs == 2)));
+            }
+
+    REQUIRE_THROWS(BigInt::Div(a, zero));
+    REQUIRE_THROWS(BigInt::Mod(a, zero));
+}
+
+TEST_CASE("BigInt Parse and Format", "[BigInt]") {
+    Setup();
+
+    const char *decimals[] = {
+            "0",
+            "-1",
+            "123456789",
+            "1000000000",
+            "-999999999999999999",
+            "9223372036854775808",
+            "-9223372036854775809",
+            "340282366920938463463374607431768211456",
+            "-123456789012345678901234567890123456789012345678901234567890",
+    };
+    for (auto s : decimals) {
+        Value v = Parse(s);
+        RequireNormal(v);
+        REQUIRE(Dec(v) == s);
+        REQUIRE(Same(Parse(BigInt::Format(v, 16)), v));
+    }
+
+    const char *hexes[] = {
+            "0x0",
+            "-0x1",
+            "0xffffffff",
+            "0x100000000",
+            "0x123456789abcdef0123456789abcdef",
+            "-0x8000000000000000",
+            "0x10000000000000000000000000000000000000000",
+    };
+    for (auto s : hexes) {
+        Value v = Parse(s);
+        RequireNormal(v);
+        REQUIRE(BigInt::Format(v, 16) == s);
+        REQUIRE(Same(Parse(Dec(v)), v));
+    }
+
+    // leading zeros, a plus and upper case go, a bad digit fails
+    REQUIRE(Dec(Parse("+000000000000000000000042")) == "42");
+    REQUIRE(BigInt::Format(Parse("0xABCDEF0123456789ABCDEF"), 16) == "0xabcdef0123456789abcdef");
+    Value v;
+    REQUIRE(!BigInt::Parse("12a", v));
+    REQUIRE(!BigInt::Parse("0xfg", v));
+    REQUIRE(!BigInt::Parse("-", v));
+    REQUIRE(!BigInt::Parse("", v));
+}
+
+// what the number prototype does when the inline path is not taken
+static Value CallNumberMethod(String *name, Value self, Value arg) {
+    StackVM *vm = Setup();
+    Value method = Context::GetNumberPrototype()->GetValue(name->toValue());
+    REQUIRE(method.isFunction());
+    Value *args = &arg;
+    return vm->CallFunction(reinterpret_cast<Function *>(method.AsGC()), self, FunctionArgs(args, 0, 1));
+}
+
+TEST_CASE("BigInt with the number prototype", "[BigInt]") {
+    Setup();
+
+    typedef Context::StringBuffer SB;
+    Value big = Parse("0x10000000000000000");
+    Value half = Value(1.5);
+
+    Value sum = CallNumberMethod(SB::__ADD__, half, big);
+    REQUIRE(sum.isNumber());
+    REQUIRE(sum.AsNumber() == 18446744073709551617.5);
+    REQUIRE(CallNumberMethod(SB::__SUB__, half, big).AsNumber() == 1.5 - 18446744073709551616.0);
+    REQUIRE(CallNumberMethod(SB::__MUL__, half, big).AsNumber() == 27670116110564327424.0);
+    REQUIRE(CallNumberMethod(SB::__DIV__, half, big).AsNumber() == 1.5 / 18446744073709551616.0);
+
+    REQUIRE(CallNumberMethod(SB::__LT__, half, big).AsBool());
+    REQUIRE(CallNumberMethod(SB::__LTEQ__, half, big).AsBool());
+    REQUIRE(!CallNumberMethod(SB::__GT__, half, big).AsBool());
+    REQUIRE(!CallNumberMethod(SB::__GTEQ__, half, big).AsBool());
+    REQUIRE(!CallNumberMethod(SB::__EQ__, half, big).AsBool());
+    REQUIRE(CallNumberMethod(SB::__EQ__, Value(18446744073709551616.0), big).AsBool());
+
+    // a small int is no number to read either
+    Value two = Value(static_cast<TSmallInt>(2));
+    REQUIRE(CallNumberMethod(SB::__ADD__, half, two).AsNumber() == 3.5);
+    REQUIRE(CallNumberMethod(SB::__EQ__, Value(2.0), two).AsBool());
+    REQUIRE(!CallNumberMethod(SB::__EQ__, Value(1.0), Value(2.0)).AsBool());
+    REQUIRE(CallNumberMethod(SB::__GT__, Value(2.5), two).AsBool());
+}
+
+TEST_CASE("Integers and numbers compare exactly", "[arith]") {
+    Setup();
+
+    typedef Context::StringBuffer SB;
+    // 2^53 + 1, which the cast to a number rounds to 2^53
+    Value odd = BigInt::FromSmallInt(9007199254740993);
+    Value even = Value(9007199254740992.0);
+    Value result;
+
+    // a BigInt where the small ints are narrower
+    if (odd.isSmallInt()) {
+        REQUIRE(arith::EQ(odd, even, result));
+        REQUIRE(!result.AsBool());
+        REQUIRE(arith::GT(odd, even, result));
+        REQUIRE(result.AsBool());
+        REQUIRE(arith::LT(even, odd, result));
+        REQUIRE(result.AsBool());
+        REQUIRE(arith::LTEQ(odd, even, result));
+        REQUIRE(!result.AsBool());
+        REQUIRE(arith::GTEQ(even, odd, result));
+        REQUIRE(!result.AsBool());
+
+        // past the range of the small ints, and NaN
+        Value top = BigInt::FromSmallInt(INT64_MAX);
+        REQUIRE(arith::LT(top, Value(9223372036854775807.0), result));
+        REQUIRE(result.AsBool());
+        REQUIRE(arith::EQ(odd, Value(std::nan("")), result));
+        REQUIRE(!result.AsBool());
+        REQUIRE(arith::LT(odd, Value(std::nan("")), result));
+        REQUIRE(!result.AsBool());
+    }
+
+    // the fraction decides between equal integer parts
+    Value three = Value(static_cast<TSmallInt>(3));
+    REQUIRE(arith::LT(three, Value(3.5), result));
+    REQUIRE(result.AsBool());
+    REQUIRE(arith::GT(Value(static_cast<TSmallInt>(-3)), Value(-3.5), result));
+    REQUIRE(result.AsBool());
+    REQUIRE(arith::EQ(Value(3.0), three, result));
+    REQUIRE(result.AsBool());
+
+    REQUIRE(!CallNumberMethod(SB::__EQ__, even, odd).AsBool());
+    REQUIRE(CallNumberMethod(SB::__LT__, even, odd).AsBool());
+    REQUIRE(!CallNumberMethod(SB::__GTEQ__, even, odd).AsBool());
+
+    int order;
+    REQUIRE(BigInt::Compare(Parse("0x10000000000000001"), Value(18446744073709551616.0), order));
+    REQUIRE(order == 1);
+    REQUIRE(BigInt::Compare(Value(-18446744073709551616.0), Parse("-0x10000000000000001"), order));
+    REQUIRE(order == 1);
+    REQUIRE(BigInt::Compare(Parse("0x10000000000000000"), Value(18446744073709551616.5), order));
+    REQUIRE(order == 0);
+    REQUIRE(BigInt::Compare(Parse("-0x10000000000000000"), Value(INFINITY), order));
+    REQUIRE(order == -1);
+}
@@ -0,0 +1,221 @@
+#define CATCH_CONFIG_MAIN
+// the alternate signal stack of catch needs a constant SIGSTKSZ
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+
+#include <string>
+#include "catch.hpp"
+#include "svm.h"
+#include "context.h"
+#include "Dict.h"
+#include "Shape.h"
+#include "String.h"
+#include "function.h"
+#include "inline_cache.h"
+#include "jit.h"
+#include "trace.h"
+#include "builder.h"
+
+using namespace halang;
+
+// the first machine sets up the GC and the prototypes
+static StackVM *Setup() {
+    static StackVM *vm = new StackVM();
+    return vm;
+}
+
+// a new string each time, as two scripts would make it
+static Value Key(const std::string &name) {
+    return String::FromStdString(name)->toValue();
+}
+
+static Dict *Make(std::initializer_list<const char *> names) {
+    Dict *dict = Context::GetGC()->New<Dict>();
+    TSmallInt i = 0;
+    for (auto name : names)
+        dict->SetValue(Key(name), Value(++i));
+    return dict;
+}
+
+static TSmallInt Get(Dict *dict, const std::string &name) {
+    Value v;
+    REQUIRE(dict->TryGetValue(Key(name), v));
+    REQUIRE(v.isSmallInt());
+    return v.AsSmallInt();
+}
+
+TEST_CASE("Dicts given the same names in the same order share a shape", "[dict]") {
+    Setup();
+
+    Dict *a = Make({"x", "y"});
+    Dict *b = Make({"x", "y"});
+    Dict *c = Make({"y", "x"});
+
+    REQUIRE(a->GetShape() != nullptr);
+    REQUIRE(a->GetShape() == b->GetShape());
+    REQUIRE(a->GetShape() != c->GetShape());
+    REQUIRE(a->GetShape()->GetCount() == 2);
+
+    // the slot is the place of the name in the shape
+    Dict::size_type slot;
+    REQUIRE(a->TryGetSlot(Key("y"), slot));
+    REQUIRE(slot == 1);
+    REQUIRE(c->TryGetSlot(Key("y"), slot));
+    REQUIRE(slot == 0);
+
+    REQUIRE(Get(b, "x") == 1);
+    REQUIRE(Get(c, "x") == 2);
+
+    // a new value keeps the shape
+    b->SetValue(Key("x"), Value(10));
+    REQUIRE(b->GetShape() == a->GetShape());
+    REQUIRE(Get(b, "x") == 10);
+}
+
+TEST_CASE("A removal leaves shapes for dictionary mode", "[dict]") {
+    Setup();
+
+    Dict *d = Make({"x", "y", "z"});
+    Shape *shape = d->GetShape();
+
+    // a name it does not have changes nothing
+    REQUIRE(!d->TryRemove(Key("w")));
+    REQUIRE(d->GetShape() == shape);
+
+    REQUIRE(d->TryRemove(Key("y")));
+    REQUIRE(d->GetShape() == nullptr);
+
+    Value v;
+    REQUIRE(!d->TryGetValue(Key("y"), v));
+    REQUIRE(Get(d, "x") == 1);
+    REQUIRE(Get(d, "z") == 3);
+
+    d->SetValue(Key("y"), Value(4));
+    REQUIRE(Get(d, "y") == 4);
+
+    // the others of the shape keep it
+    REQUIRE(Make({"x", "y", "z"})->GetShape() == shape);
+}
+
+TEST_CASE("Too many names or a key that is no string mean dictionary mode", "[dict]") {
+    Setup();
+
+    Dict *d = Context::GetGC()->New<Dict>();
+    for (Shape::size_type i = 0; i <= Shape::MAX_PROPERTIES; ++i) {
+        REQUIRE(d->GetShape() != nullptr);
+        d->SetValue(Key("p" + std::to_string(i)), Value(static_cast<TSmallInt>(i)));
+    }
+    REQUIRE(d->GetShape() == nullptr);
+    for (Shape::size_type i = 0; i <= Shape::MAX_PROPERTIES; ++i)
+        REQUIRE(Get(d, "p" + std::to_string(i)) == i);
+
+    Dict *e = Make({"x"});
+    e->SetValue(Value(7), Value(8));
+    REQUIRE(e->GetShape() == nullptr);
+    REQUIRE(Get(e, "x") == 1);
+    REQUIRE(e->GetValue(Value(7)).AsSmallInt() == 8);
+}
+
+// get(o) = o.<name>, its DOT the site 0, left to the interpreter
+static Function *MakeGet(const std::string &name) {
+    Jit::SetEnabled(false);
+    Tracer::SetEnabled(false);
+
+    CodePackBuilder b;
+    b.AddParameter("o");
+    auto key = b.AddConstant(Key(name));
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::LOAD_C, key);
+    b.Emit(VM_CODE::DOT, 0);
+    b.Emit(VM_CODE::RETURN, 1);
+    return b.Build();
+}
+
+static TSmallInt Call(Function *fun, Value obj) {
+    Value *values = &obj;
+    FunctionArgs args(values, 0, 1);
+    Value v = Setup()->CallFunction(fun, Value(), args);
+    REQUIRE(v.isSmallInt());
+    return v.AsSmallInt();
+}
+
+static InlineCache *CacheOf(Function *fun) {
+    InlineCache *ic = fun->GetCodePack()->GetInlineCache(0);
+    REQUIRE(ic != nullptr);
+    return ic;
+}
+
+TEST_CASE("A DOT site sees shapes as monomorphic, polymorphic, megamorphic", "[dict][ic]") {
+    Setup();
+
+    Function *get = MakeGet("x");
+    InlineCache *ic = CacheOf(get);
+    REQUIRE(ic->state == InlineCache::State::Uninitialized);
+
+    // ten dicts of one shape, one miss for all of them
+    for (int i = 0; i < 10; ++i)
+        REQUIRE(Call(get, Make({"x", "y"})->toValue()) == 1);
+    REQUIRE(ic->state == InlineCache::State::Monomorphic);
+    REQUIRE(ic->misses == 1);
+    REQUIRE(ic->hits == 9);
+
+    REQUIRE(Call(get, Make({"a", "x"})->toValue()) == 2);
+    REQUIRE(Call(get, Make({"a", "b", "x"})->toValue()) == 3);
+    REQUIRE(Call(get, Make({"a", "b", "c", "x"})->toValue()) == 4);
+    REQUIRE(ic->state == InlineCache::State::Polymorphic);
+    REQUIRE(ic->size == +InlineCache::MAX_ENTRIES);
+    REQUIRE(Call(get, Make({"a", "x"})->toValue()) == 2);
+    REQUIRE(ic->hits == 10);
+
+    // one shape too many, and it stops caching
+    REQUIRE(Call(get, Make({"a", "b", "c", "d", "x"})->toValue()) == 5);
+    REQUIRE(ic->state == InlineCache::State::Megamorphic);
+    REQUIRE(ic->size == 0);
+    REQUIRE(Call(get, Make({"x", "y"})->toValue()) == 1);
+    REQUIRE(ic->hits == 10);
+    REQUIRE(ic->misses == 6);
+}
+
+TEST_CASE("A DOT site on a dict in dictionary mode misses once it changes", "[dict][ic]") {
+    Setup();
+
+    Function *get = MakeGet("x");
+    InlineCache *ic = CacheOf(get);
+    Dict *d = Make({"x", "y"});
+    REQUIRE(Call(get, d->toValue()) == 1);
+
+    REQUIRE(d->TryRemove(Key("y")));
+    REQUIRE(d->GetShape() == nullptr);
+    REQUIRE(Call(get, d->toValue()) == 1);
+    REQUIRE(Call(get, d->toValue()) == 1);
+    REQUIRE(ic->misses == 2);
+    REQUIRE(ic->hits == 1);
+
+    // the entry holds the value, a new one renews the version
+    d->SetValue(Key("x"), Value(5));
+    REQUIRE(Call(get, d->toValue()) == 5);
+    REQUIRE(ic->misses == 3);
+    REQUIRE(Call(get, d->toValue()) == 5);
+    REQUIRE(ic->hits == 2);
+}
+
+TEST_CASE("A change of the prototype makes the cached entry miss", "[dict][ic]") {
+    Setup();
+
+    Dict *proto = Context::GetSmallIntPrototype();
+    Value key = Key("answer");
+    proto->SetValue(key, Value(1));
+
+    Function *get = MakeGet("answer");
+    InlineCache *ic = CacheOf(get);
+    REQUIRE(Call(get, Value(7)) == 1);
+    REQUIRE(Call(get, Value(8)) == 1);
+    REQUIRE(ic->state == InlineCache::State::Monomorphic);
+    REQUIRE(ic->hits == 1);
+
+    proto->SetValue(key, Value(2));
+    REQUIRE(Call(get, Value(7)) == 2);
+    REQUIRE(ic->misses == 2);
+    REQUIRE(ic->state == InlineCache::State::Monomorphic);
+
+    REQUIRE(proto->TryRemove(key));
+}
@@ -0,0 +1,272 @@
+#define CATCH_CONFIG_MAIN
+// the alternate signal stack of catch needs a constant SIGSTKSZ
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <random>
+#include <utility>
+#include <vector>
+#include "catch.hpp"
+#include "svm.h"
+#include "context.h"
+#include "GC.h"
+#include "Heap.h"
+#include "Array.h"
+#include "Dict.h"
+#include "String.h"
+
+using namespace halang;
+
+// the first machine sets up the GC and the prototypes
+static StackVM *Setup() {
+    static StackVM *vm = new StackVM();
+    return vm;
+}
+
+// a cell too big for the size classes, a page of its own
+struct LargeObject : public GCObject {
+    char bytes[Heap::MAX_CELL * 2];
+};
+
+TEST_CASE("Minor collections give back large pages", "[GC]") {
+    Setup();
+
+    GC *gc = Context::GetGC();
+    auto pages = gc->GetPageCount();
+    auto per_nursery = GC::GetNurserySize() / Heap::CellSize(sizeof(LargeObject)) + 1;
+
+    for (std::size_t i = 0; i < per_nursery * 16; ++i) {
+        gc->New<LargeObject>();
+        gc->CheckAndGC();
+    }
+
+    // no more than a nursery of them waits for the next one
+    REQUIRE(gc->GetPageCount() <= pages + per_nursery);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double Since(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static Value Key(const char *name) {
+    String *str = String::FromCharArray(name);
+    Context::GetGC()->MakePersistent(str);
+    return str->toValue();
+}
+
+/// <summary>
+/// Holders in a persistent array, each of them a dict whose "item"
+/// is a node { id, payload }, the payload an array of the id times
+/// 1, 2 and 3. The ids are mirrored here, for Check to find a node
+/// the GC has freed while it was still reachable.
+/// </summary>
+class Graph {
+public:
+
+    explicit Graph(unsigned int size) :
+            item(Key("item")), id(Key("id")), payload(Key("payload")), next_id(0) {
+        GC *gc = Context::GetGC();
+        holders = gc->NewPersistent<Array>();
+        for (unsigned int i = 0; i < size; ++i) {
+            Dict *holder = gc->New<Dict>();
+            holder->SetValue(item, NewNode()->toValue());
+            holders->Push(holder->toValue());
+            ids.push_back(next_id - 1);
+        }
+    }
+
+    /// <summary>
+    /// Stores that lose a node unless the barriers see them: two
+    /// holders swap their nodes, one gets a new node, and a node
+    /// has its payload taken out and put back.
+    /// </summary>
+    void Mutate(std::mt19937 &rng) {
+        std::uniform_int_distribution<unsigned int> pick(0, static_cast<unsigned int>(ids.size()) - 1);
+
+        auto a = pick(rng), b = pick(rng);
+        Value na = Holder(a)->GetValue(item);
+        Value nb = Holder(b)->GetValue(item);
+        Holder(a)->SetValue(item, nb);
+        Holder(b)->SetValue(item, na);
+        std::swap(ids[a], ids[b]);
+
+        auto c = pick(rng);
+        Holder(c)->SetValue(item, NewNode()->toValue());
+        ids[c] = next_id - 1;
+
+        auto node = reinterpret_cast<Dict *>(Holder(pick(rng))->GetValue(item).AsGC());
+        Value p = node->GetValue(payload);
+        node->TryRemove(payload);
+        node->SetValue(payload, p);
+    }
+
+    // the nodes that are not as they were made
+    unsigned int Check() {
+        unsigned int bad = 0;
+        for (unsigned int i = 0; i < ids.size(); ++i) {
+            Value node = Holder(i)->GetValue(item);
+            if (!node.isDict()) {
+                ++bad;
+                continue;
+            }
+            auto d = reinterpret_cast<Dict *>(node.AsGC());
+            Value v = d->GetValue(id);
+            Value p = d->GetValue(payload);
+            if (!v.isSmallInt() || v.AsSmallInt() != ids[i] || !p.isArray()) {
+                ++bad;
+                continue;
+            }
+            auto arr = reinterpret_cast<Array *>(p.AsGC());
+            if (arr->GetLength() != 3)
+                ++bad;
+            else
+                for (unsigned int j = 0; j < 3; ++j)
+                    if (!arr->At(j).isSmallInt() || arr->At(j).AsSmallInt() != ids[i] * (j + 1))
+                        ++bad;
+        }
+        return bad;
+    }
+
+private:
+
+    Value item, id, payload;
+    Array *holders;
+    std::vector<TSmallInt> ids;
+    TSmallInt next_id;
+
+    Dict *NewNode() {
+        GC *gc = Context::GetGC();
+        TSmallInt n = next_id++;
+        Array *arr = gc->New<Array>();
+        for (TSmallInt j = 1; j <= 3; ++j)
+            arr->Push(Value(n * j));
+        Dict *node = gc->New<Dict>();
+        node->SetValue(id, Value(n));
+        node->SetValue(payload, arr->toValue());
+        return node;
+    }
+
+    Dict *Holder(unsigned int i) {
+        return reinterpret_cast<Dict *>(holders->At(i).AsGC());
+    }
+
+};
+
+static const unsigned int GRAPH_SIZE = 50000;
+
+/// <summary>
+/// Make garbage and mutate the graph between safepoints until the
+/// next full cycle has finished, in one pause or in slices. The
+/// pauses of the cycle are counted and the longest goes to
+/// "longest", none when the cycle never came.
+/// </summary>
+static unsigned long RunCycle(Graph &graph, std::mt19937 &rng, double &longest) {
+    GC *gc = Context::GetGC();
+    auto cycles = gc->GetCycleCount();
+    unsigned long slices = 0;
+    longest = 0;
+
+    for (unsigned long step = 0; step < 1000000; ++step) {
+        graph.Mutate(rng);
+        for (int i = 0; i < 8; ++i)
+            gc->New<Array>(4u);
+
+        bool before = gc->IsCycleUnderWay();
+        auto pauses = gc->GetPauseCount();
+        auto start = Clock::now();
+        gc->CheckAndGC();
+        double pause = Since(start);
+        bool done = gc->GetCycleCount() != cycles;
+
+        // a minor collection, or none
+        if (gc->GetPauseCount() == pauses || (!before && !done && !gc->IsCycleUnderWay()))
+            continue;
+        ++slices;
+        longest = std::max(longest, pause);
+        if (done)
+            return slices;
+    }
+    return 0;
+}
+
+TEST_CASE("A cycle in slices keeps the graph and the pauses short", "[GC]") {
+    Setup();
+
+    GC *gc = Context::GetGC();
+    Graph graph(GRAPH_SIZE);
+    std::mt19937 rng(20);
+    double whole, longest;
+
+    // the first cycle has the graph to itself, the next two start
+    // alike, at twice what the one before left
+    REQUIRE(RunCycle(graph, rng, whole) == 1);
+    REQUIRE(RunCycle(graph, rng, whole) == 1);
+    REQUIRE(graph.Check() == 0);
+    auto max_pause = gc->GetMaxPause();
+
+    GC::SetPauseBudget(0.1);
+    auto slices = RunCycle(graph, rng, longest);
+    GC::SetPauseBudget(0);
+
+    INFO("the longest of " << slices << " slices " << longest << " ms, in one pause " << whole << " ms");
+    REQUIRE(slices > 1);
+    REQUIRE(longest < whole);
+    // none of them is the longest pause so far either
+    REQUIRE(gc->GetMaxPause() == max_pause);
+    REQUIRE(graph.Check() == 0);
+
+    gc->FullGC();
+    REQUIRE(graph.Check() == 0);
+}
+
+TEST_CASE("A concurrent cycle keeps what the scripts move meanwhile", "[GC]") {
+    Setup();
+
+    GC *gc = Context::GetGC();
+    Graph graph(GRAPH_SIZE);
+    std::mt19937 rng(21);
+    double longest;
+
+    // the nodes swap holders, come and go while the thread marks
+    GC::SetConcurrentMarking(true);
+    for (int cycle = 0; cycle < 3; ++cycle) {
+        REQUIRE(RunCycle(graph, rng, longest) > 1);
+        REQUIRE(graph.Check() == 0);
+    }
+    GC::SetConcurrentMarking(false);
+
+    gc->FullGC();
+    REQUIRE(graph.Check() == 0);
+}
+
+TEST_CASE("Collections on many threads keep what one thread keeps", "[GC]") {
+    Setup();
+
+    GC *gc = Context::GetGC();
+    Graph graph(GRAPH_SIZE);
+    std::mt19937 rng(22);
+    for (int i = 0; i < 10000; ++i)
+        graph.Mutate(rng);
+
+    GC::SetThreadCount(1);
+    gc->FullGC();
+    auto heap_size = gc->GetHeapSize();
+
+    // the same objects alive, so nothing more is found dead
+    GC::SetThreadCount(4);
+    gc->FullGC();
+    REQUIRE(gc->GetHeapSize() == heap_size);
+    REQUIRE(graph.Check() == 0);
+
+    // and as the scripts go on
+    double longest;
+    for (int cycle = 0; cycle < 3; ++cycle) {
+        REQUIRE(RunCycle(graph, rng, longest) == 1);
+        REQUIRE(graph.Check() == 0);
+    }
+    GC::SetThreadCount(1);
+}
@@ -0,0 +1,299 @@
+#define CATCH_CONFIG_MAIN
+// the alternate signal stack of catch needs a constant SIGSTKSZ
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "catch.hpp"
+#include "svm.h"
+#include "context.h"
+#include "BigInt.h"
+#include "Dict.h"
+#include "function.h"
+#include "jit.h"
+#include "trace.h"
+#include "builder.h"
+
+using namespace halang;
+
+// the first machine sets up the GC and the prototypes
+static StackVM *Setup() {
+    static StackVM *vm = new StackVM();
+    return vm;
+}
+
+// the interpreter alone, or the JIT from the first call on
+static void SetTier(bool jit) {
+    Jit::SetEnabled(jit);
+    Jit::SetThreshold(1);
+    Tracer::SetEnabled(false);
+}
+
+static Value Call(Function *fun, std::vector<Value> args) {
+    Value *values = args.data();
+    FunctionArgs _args(values, 0, static_cast<FunctionArgs::size_type>(args.size()));
+    return Setup()->CallFunction(fun, Value(), _args);
+}
+
+static bool Same(Value a, Value b) {
+    int order;
+    return BigInt::Compare(a, b, order) && order == 0;
+}
+
+static Value Parse(const std::string &text) {
+    Value v;
+    REQUIRE(BigInt::Parse(text, v));
+    return v;
+}
+
+// fun(a, b) = a + b
+static Function *MakeAdd() {
+    CodePackBuilder b;
+    b.AddParameter("a");
+    b.AddParameter("b");
+    b.Emit(VM_CODE::LOAD_V, 1);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::ADD);
+    b.Emit(VM_CODE::RETURN, 1);
+    return b.Build();
+}
+
+// sum(n, acc) = n == 0 ? acc : sum(n - 1, acc + n), by a tail call
+static Function *MakeTailSum() {
+    CodePackBuilder b;
+    b.AddParameter("n");
+    b.AddParameter("acc");
+    auto self = b.AddSelf();
+    b.Emit(VM_CODE::PUSH_INT, 0);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::EQ);
+    auto branch = b.Emit(VM_CODE::IFNO);
+    b.Emit(VM_CODE::LOAD_V, 1);
+    b.Emit(VM_CODE::RETURN, 1);
+    b.PatchJump(branch, b.Here());
+    b.Emit(VM_CODE::PUSH_INT, 1);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::SUB);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::LOAD_V, 1);
+    b.Emit(VM_CODE::ADD);
+    b.Emit(VM_CODE::PUSH_NULL);
+    b.Emit(VM_CODE::LOAD_C, self);
+    b.Emit(VM_CODE::TAIL_CALL, 2);
+    return b.Build();
+}
+
+// sum(n) = n == 0 ? 0 : n + sum(n - 1), a frame for each n
+static Function *MakeSum() {
+    CodePackBuilder b;
+    b.AddParameter("n");
+    auto self = b.AddSelf();
+    b.Emit(VM_CODE::PUSH_INT, 0);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::EQ);
+    auto branch = b.Emit(VM_CODE::IFNO);
+    b.Emit(VM_CODE::PUSH_INT, 0);
+    b.Emit(VM_CODE::RETURN, 1);
+    b.PatchJump(branch, b.Here());
+    b.Emit(VM_CODE::PUSH_INT, 1);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::SUB);
+    b.Emit(VM_CODE::PUSH_NULL);
+    b.Emit(VM_CODE::LOAD_C, self);
+    b.Emit(VM_CODE::CALL, 1);
+    b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::ADD);
+    b.Emit(VM_CODE::RETURN, 1);
+    return b.Build();
+}
+
+TEST_CASE("A compiled overflow goes on in the helper", "[jit]") {
+    Setup();
+    if (!Jit::IsSupported())
+        return;
+
+    const TSmallInt max = std::numeric_limits<TSmallInt>::max();
+    std::vector<Value> args{Value(max), Value(static_cast<TSmallInt>(1))};
+
+    SetTier(false);
+    Value interpreted = Call(MakeAdd(), args);
+
+    SetTier(true);
+    Function *fun = MakeAdd();
+    REQUIRE(Same(Call(fun, {Value(2), Value(3)}), Value(5)));
+    REQUIRE(fun->GetCodePack()->IsCompiled());
+    Value compiled = Call(fun, args);
+
+    REQUIRE(compiled.isBigInt());
+    REQUIRE(Same(compiled, interpreted));
+    REQUIRE(Same(compiled, Parse("9223372036854775808")));
+}
+
+TEST_CASE("An error of a helper comes back through TakePending", "[jit]") {
+    Setup();
+    if (!Jit::IsSupported())
+        return;
+
+    GC *gc = Context::GetGC();
+    auto thrower = gc->NewPersistent<Function>([](Value, FunctionArgs &) -> Value {
+        throw std::runtime_error("thrown by the native");
+    });
+
+    for (int tier = 0; tier < 2; ++tier) {
+        SetTier(tier == 1);
+
+        // fun() = thrower()
+        CodePackBuilder b;
+        auto callee = b.AddConstant(thrower->toValue());
+        b.Emit(VM_CODE::PUSH_NULL);
+        b.Emit(VM_CODE::LOAD_C, callee);
+        b.Emit(VM_CODE::CALL, 0);
+        b.Emit(VM_CODE::RETURN, 1);
+        Function *fun = b.Build();
+
+        REQUIRE_THROWS_WITH(Call(fun, {}), "thrown by the native");
+        REQUIRE(fun->GetCodePack()->IsCompiled() == (tier == 1));
+        REQUIRE(Jit::TakePending() == nullptr);
+
+        // no frame of it is left behind
+        REQUIRE(Same(Call(MakeAdd(), {Value(2), Value(3)}), Value(5)));
+    }
+}
+
+TEST_CASE("A compiled tail call runs in the frame of the caller", "[jit]") {
+    Setup();
+    if (!Jit::IsSupported())
+        return;
+
+    std::vector<Value> args{Value(100000), Value(0)};
+
+    SetTier(false);
+    Value interpreted = Call(MakeTailSum(), args);
+
+    SetTier(true);
+    Function *fun = MakeTailSum();
+    Value compiled = Call(fun, args);
+
+    REQUIRE(fun->GetCodePack()->IsCompiled());
+    REQUIRE(Same(compiled, interpreted));
+    REQUIRE(Same(compiled, Value(static_cast<TSmallInt>(5000050000LL))));
+}
+
+TEST_CASE("Compiled calls past MAX_DEPTH go on in the interpreter", "[jit]") {
+    Setup();
+    if (!Jit::IsSupported())
+        return;
+
+    const TSmallInt n = Jit::MAX_DEPTH * 3;
+    std::vector<Value> args{Value(n)};
+
+    SetTier(false);
+    Value interpreted = Call(MakeSum(), args);
+
+    SetTier(true);
+    Function *fun = MakeSum();
+    Value compiled = Call(fun, args);
+
+    REQUIRE(fun->GetCodePack()->IsCompiled());
+    REQUIRE(Same(compiled, interpreted));
+    REQUIRE(Same(compiled, Value(n * (n + 1) / 2)));
+
+    // the depth is back to none, the first calls are native again
+    REQUIRE(Same(Call(fun, {Value(10)}), Value(55)));
+}
+
+// sum(n, s) adds "step" to s n times in a loop
+static Function *MakeLoop(Value step) {
+    CodePackBuilder b;
+    b.AddParameter("n");
+    b.AddParameter("s");
+    b.AddVariable("i");
+    auto c = b.AddConstant(step);
+    b.Emit(VM_CODE::PUSH_INT, 0);
+    b.Emit(VM_CODE::STORE_V, 2);
+    auto header = b.Emit(VM_CODE::LOAD_V, 0);
+    b.Emit(VM_CODE::LOAD_V, 2);
+    b.Emit(VM_CODE::LT);
+    auto branch = b.Emit(VM_CODE::IFNO);
+    b.Emit(VM_CODE::LOAD_C, c);
+    b.Emit(VM_CODE::LOAD_V, 1);
+    b.Emit(VM_CODE::ADD);
+    b.Emit(VM_CODE::STORE_V, 1);
+    b.Emit(VM_CODE::PUSH_INT, 1);
+    b.Emit(VM_CODE::LOAD_V, 2);
+    b.Emit(VM_CODE::ADD);
+    b.Emit(VM_CODE::STORE_V, 2);
+    auto loop = b.Emit(VM_CODE::JMP);
+    b.PatchJump(loop, header);
+    b.PatchJump(branch, b.Here());
+    b.Emit(VM_CODE::LOAD_V, 1);
+    b.Emit(VM_CODE::RETURN, 1);
+    return b.Build();
+}
+
+TEST_CASE("A trace leaves an overflow to the interpreter", "[jit][trace]") {
+    Setup();
+    if (!Jit::IsSupported())
+        return;
+
+    // the sum overflows a small int at the 8th step
+    Value step(static_cast<TSmallInt>(1) << 60);
+    std::vector<Value> args{Value(200), Value(0)};
+
+    SetTier(false);
+    Value interpreted = Call(MakeLoop(step), args);
+
+    // the loop is traced after a few rounds, the function itself
+    // is left to the interpreter
+    Jit::SetEnabled(true);
+    Jit::SetThreshold(Jit::DEFAULT_THRESHOLD);
+    Tracer::SetEnabled(true);
+    Tracer::SetThreshold(2);
+    Function *fun = MakeLoop(step);
+    Value traced = Call(fun, args);
+    Tracer::SetThreshold(Tracer::DEFAULT_THRESHOLD);
+
+    CodePack *cp = fun->GetCodePack();
+    REQUIRE(!cp->IsCompiled());
+    Trace *trace = cp->GetTrace(14);
+    REQUIRE(trace != nullptr);
+    REQUIRE(trace->IsCompiled());
+
+    REQUIRE(traced.isBigInt());
+    REQUIRE(Same(traced, interpreted));
+    REQUIRE(Same(traced, Parse("230584300921369395200")));
+}
+
+// it changes a prototype every other case relies on, so it goes last
+TEST_CASE("Compiled small int code checks the prototype", "[jit]") {
+    Setup();
+    if (!Jit::IsSupported())
+        return;
+
+    GC *gc = Context::GetGC();
+    Dict *proto = Context::GetSmallIntPrototype();
+    Value key = Context::StringBuffer::__ADD__->toValue();
+    Value add;
+    REQUIRE(proto->TryGetValue(key, add));
+
+    SetTier(true);
+    Function *compiled = MakeAdd();
+    REQUIRE(Same(Call(compiled, {Value(2), Value(3)}), Value(5)));
+    REQUIRE(compiled->GetCodePack()->IsCompiled());
+
+    auto answer = gc->NewPersistent<Function>([](Value, FunctionArgs &) -> Value {
+        return Value(42);
+    });
+    proto->SetValue(key, answer->toValue());
+
+    SetTier(false);
+    Value interpreted = Call(MakeAdd(), {Value(2), Value(3)});
+    REQUIRE(Same(interpreted, Value(42)));
+
+    SetTier(true);
+    REQUIRE(Same(Call(compiled, {Value(2), Value(3)}), interpreted));
+
+    proto->SetValue(key, add);
+    REQUIRE(Same(Call(compiled, {Value(2), Value(3)}), Value(5)));
+}
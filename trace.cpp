@@ -0,0 +1,154 @@
+#include "trace.h"
+#include "jit.h"
+#include "svm.h"
+#include "function.h"
+#include <cstdint>
+
+namespace halang {
+
+    bool Tracer::enabled = true;
+    unsigned int Tracer::threshold = Tracer::DEFAULT_THRESHOLD;
+    unsigned int Tracer::hotcounts[Tracer::HOTCOUNT_SIZE];
+
+    Trace::Trace(size_type _header, size_type _loop) :
+            header(_header), loop(_loop), code(nullptr), aborts(0) {}
+
+    Trace::~Trace() {
+        delete code;
+    }
+
+    bool Tracer::IsEnabled() { return enabled && Jit::IsEnabled(); }
+
+    void Tracer::SetEnabled(bool _enabled) { enabled = _enabled; }
+
+    unsigned int Tracer::GetThreshold() { return threshold; }
+
+    void Tracer::SetThreshold(unsigned int _threshold) { threshold = _threshold; }
+
+    bool Tracer::Tick(const Instruction *jmp) {
+        auto &count = hotcounts[(reinterpret_cast<std::uintptr_t>(jmp) / sizeof(Instruction)) % HOTCOUNT_SIZE];
+        if (++count < threshold)
+            return false;
+        count = 0;
+        return true;
+    }
+
+    Trace *Tracer::GetOrCreate(CodePack *cp, size_type header, size_type loop) {
+        if (cp->_traces == nullptr)
+            cp->_traces = new Trace *[cp->_instructions_size]();
+        if (cp->_traces[loop] == nullptr)
+            cp->_traces[loop] = new Trace(header, loop);
+        return cp->_traces[loop];
+    }
+
+    Tracer::LoopState Tracer::Loop(StackVM *vm, const Instruction *jmp) {
+        Frame &frame = vm->frames.back();
+        CodePack *cp = frame.function->GetCodePack();
+        auto loop = static_cast<size_type>(jmp - cp->_instructions);
+        Trace *trace = cp->GetTrace(loop);
+
+        if (trace != nullptr && trace->IsCompiled()) {
+            if (vm->jit_depth >= Jit::MAX_DEPTH)
+                return LoopState::Interpreted;
+
+            ++vm->jit_depth;
+            int exit = trace->code->GetEntry()(vm, nullptr, frame.base * sizeof(Value));
+            --vm->jit_depth;
+
+            if (exit < 0)
+                std::rethrow_exception(Jit::TakePending());
+            vm->frames.back().pc = cp->_instructions + exit;
+            return LoopState::Ran;
+        }
+
+        if (vm->recording != nullptr || !Tick(jmp))
+            return LoopState::Interpreted;
+        if (trace != nullptr && trace->aborts >= MAX_ABORTS)
+            return LoopState::Interpreted;
+
+        auto header = static_cast<size_type>(frame.pc - cp->_instructions);
+        trace = GetOrCreate(cp, header, loop);
+        trace->steps.clear();
+        vm->recording = trace;
+        vm->recording_frame = static_cast<StackVM::size_type>(vm->frames.size()) - 1;
+        return LoopState::Recording;
+    }
+
+    bool Tracer::Record(StackVM *vm, const Instruction *inst) {
+        Trace *trace = vm->recording;
+        if (trace == nullptr)
+            return false;
+
+        // the code of a callee is not part of the trace
+        if (vm->frames.size() > vm->recording_frame + 1)
+            return true;
+
+        CodePack *cp = vm->frames.back().function->GetCodePack();
+        auto index = static_cast<size_type>(inst - cp->_instructions);
+        auto param = inst->GetParam();
+        auto target = static_cast<long long>(index) + param;
+
+        if (index < trace->header || index > trace->loop ||
+            trace->steps.size() >= MAX_LENGTH) {
+            Abort(vm);
+            return false;
+        }
+
+        TraceStep step;
+        step.index = index;
+        step.top = vm->sp - vm->stack > 0 ? (vm->sp - 1)->GetType() : TypeId::Null;
+        step.under = vm->sp - vm->stack > 1 ? (vm->sp - 2)->GetType() : TypeId::Null;
+        step.taken = false;
+
+        switch (inst->GetCode()) {
+            case VM_CODE::JMP:
+                // "continue" closes the loop as well
+                if (target == trace->header) {
+                    trace->steps.push_back(step);
+                    Finish(vm);
+                    return false;
+                }
+                if (param < 0 || target > trace->loop) {
+                    Abort(vm);
+                    return false;
+                }
+                break;
+            case VM_CODE::IFNO:
+                step.taken = !*(vm->sp - 1);
+                if (param < 0 || (step.taken && target > trace->loop)) {
+                    Abort(vm);
+                    return false;
+                }
+                break;
+            case VM_CODE::RETURN:
+            case VM_CODE::STOP:
+            case VM_CODE::TAIL_CALL:
+            case VM_CODE::YIELD:
+                Abort(vm);
+                return false;
+            default:
+                break;
+        }
+
+        trace->steps.push_back(step);
+        return true;
+    }
+
+    void Tracer::Abort(StackVM *vm) {
+        Trace *trace = vm->recording;
+        trace->steps.clear();
+        ++trace->aborts;
+        vm->recording = nullptr;
+    }
+
+    void Tracer::Finish(StackVM *vm) {
+        Trace *trace = vm->recording;
+        CodePack *cp = vm->frames.back().function->GetCodePack();
+        vm->recording = nullptr;
+
+        if (!Jit::CompileTrace(cp, trace))
+            trace->aborts = MAX_ABORTS;
+        trace->steps.clear();
+    }
+
+}
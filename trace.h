@@ -0,0 +1,142 @@
+#pragma once
+
+#include <vector>
+#include "object.h"
+#include "svm_codes.h"
+
+namespace halang {
+
+    class CodePack;
+
+    class StackVM;
+
+    class JitCode;
+
+    /// <summary>
+    /// One instruction of the recorded iteration, with the types
+    /// of the two operands on the top when it ran.
+    /// </summary>
+    struct TraceStep {
+        unsigned int index;     // in the instructions of the CodePack
+        TypeId top;
+        TypeId under;
+        bool taken;             // IFNO jumped
+    };
+
+    /// <summary>
+    /// A hot loop of a CodePack and the native code of one
+    /// iteration of it.
+    ///
+    /// The code runs the path the recorded iteration took,
+    /// specialized to the types seen on it, and loops back to the
+    /// header for as long as it stays on that path. A guard that
+    /// fails gives the index of the instruction to go on with to
+    /// the interpreter, which finds the frame just as it would
+    /// have left it itself.
+    /// </summary>
+    class Trace {
+    public:
+
+        typedef unsigned int size_type;
+
+        Trace(size_type _header, size_type _loop);
+
+        Trace(const Trace &) = delete;
+
+        Trace &operator=(const Trace &) = delete;
+
+        ~Trace();
+
+        inline bool IsCompiled() const { return code != nullptr; }
+
+        inline size_type GetHeader() const { return header; }
+
+        inline size_type GetLoop() const { return loop; }
+
+    private:
+
+        size_type header;               // where the loop starts over
+        size_type loop;                 // the backward jump to it
+        std::vector<TraceStep> steps;   // while it is recorded
+        JitCode *code;
+        unsigned int aborts;
+
+        friend class Tracer;
+
+        friend class Jit;
+
+        friend class JitCompiler;
+
+    };
+
+    /// <summary>
+    /// Finds the hot loops of the interpreter and records them.
+    ///
+    /// Each backward jump ticks a counter. The counters live in a
+    /// small table hashed by the address of the jump, so a few loops
+    /// may share one and become hot a bit sooner. When one reaches
+    /// the threshold, the interpreter runs the next iteration with
+    /// every code going through Record first. A trace ends at
+    /// a backward jump to the header; leaving the loop, returning or
+    /// running too long aborts it, and a loop that aborts too often
+    /// is left to the interpreter.
+    /// </summary>
+    class Tracer {
+    public:
+
+        typedef unsigned int size_type;
+
+        static const unsigned int DEFAULT_THRESHOLD = 50;
+
+        static const unsigned int MAX_ABORTS = 4;
+
+        static const unsigned int MAX_LENGTH = 1000;
+
+        enum class LoopState {
+            Interpreted,    // go on with the jump
+            Recording,      // record from the header
+            Ran,            // the trace ran, go on from frame's pc
+        };
+
+        static bool IsEnabled();
+
+        static void SetEnabled(bool);
+
+        static unsigned int GetThreshold();
+
+        static void SetThreshold(unsigned int);
+
+        /// <summary>
+        /// Called at the backward jump "jmp" of the top frame,
+        /// whose pc is already at the header.
+        /// </summary>
+        static LoopState Loop(StackVM *, const Instruction *jmp);
+
+        /// <summary>
+        /// Record the code before it runs, false when the
+        /// recording is over.
+        /// </summary>
+        static bool Record(StackVM *, const Instruction *);
+
+        /// <summary>
+        /// Drop the recording, as its frame has gone.
+        /// </summary>
+        static void Abort(StackVM *);
+
+    private:
+
+        static const unsigned int HOTCOUNT_SIZE = 64;
+
+        static bool enabled;
+        static unsigned int threshold;
+        static unsigned int hotcounts[HOTCOUNT_SIZE];
+
+        static bool Tick(const Instruction *);
+
+        static Trace *GetOrCreate(CodePack *, size_type header, size_type loop);
+
+        static void Finish(StackVM *);
+
+    };
+
+}
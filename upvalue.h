@@ -1,6 +1,7 @@
 #pragma once
 
 #include "object.h"
+#include "GC.h"
 
 namespace halang {
 
@@ -16,7 +17,7 @@ namespace halang {
     protected:
 
         UpValue(Value *_re = nullptr) :
-                value(_re), _closed(false) {}
+                GCObject(TypeId::UpValue), value(_re), _closed(false), host(nullptr) {}
 
     public:
 
@@ -24,14 +25,15 @@ namespace halang {
 
         friend class StackVM;
 
-        virtual void Mark() override {
-            if (!marked) {
-                marked = true;
-                if (value->isGCObject())
-                    value->value.gc->Mark();
-            }
+        virtual void Scan() override {
+            GC::Shade(*value);
+            if (host != nullptr)
+                GC::Shade(host);
         }
 
+        // an open one points into the value stack, which moves
+        virtual bool IsScannedConcurrently() const override { return false; }
+
         virtual ~UpValue() {
             if (_closed)
                 delete value;
@@ -41,28 +43,35 @@ namespace halang {
             return *value;
         }
 
+        // an open one writes into the value stack, or into the
+        // ScriptContext "host" while its generator is suspended
         void SetVal(Value _v) {
             *value = _v;
+            GC::WriteBarrier(_closed ? this : host, _v);
         }
 
         void close() {
             if (!_closed) {
                 value = new Value(*value);
                 _closed = true;
+                GC::WriteBarrier(this, *value);
             }
         }
 
         inline bool closed() const { return _closed; }
 
-        virtual Value toValue() override {
-            return Value(this, TypeId::UpValue);
-        }
-
     private:
 
         Value *value;
         bool _closed;
 
+        /// <summary>
+        /// While the generator of its frame is suspended, an open
+        /// upvalue points into the ScriptContext of the generator,
+        /// which must live as long as the upvalue does.
+        /// </summary>
+        GCObject *host;
+
     };
 
 }